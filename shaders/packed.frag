@@ -0,0 +1,34 @@
+/*
+ * Copyright (C) 2017-2020 Philip Jones
+ *
+ * Licensed under the MIT License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/licenses/MIT
+ *
+ */
+
+#version 150 core
+
+out vec4 out_colour;
+
+uniform sampler2D tex;
+uniform bool dmg;
+uniform vec3 palette[12];
+
+void main()
+{
+	/* Drawn at the native resolution, so there's one texel per fragment */
+	vec4 texel = texelFetch(tex, ivec2(gl_FragCoord.xy), 0);
+	if (texel.a > 0.5) {
+		/* Blank screen */
+		out_colour = vec4(1.0);
+	} else if (dmg) {
+		/* The red channel holds 1 + the index of the shade */
+		int idx = min(int(texel.r * 31.0 + 0.5), 12);
+		out_colour = idx > 0 ? vec4(palette[idx - 1], 1.0) : vec4(0.0, 0.0, 0.0, 1.0);
+	} else {
+		/* Match the 5-bit to 8-bit conversion of the cpu (x8) */
+		out_colour = vec4(texel.rgb * (31.0 * 8.0 / 255.0), 1.0);
+	}
+}
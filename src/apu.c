@@ -15,15 +15,15 @@
 #include "gbcc.h"
 #include "memory.h"
 #include "nelem.h"
-#include "time_diff.h"
+#include "scheduler.h"
+#include "timer.h"
 #include <stdint.h>
-#include <time.h>
+#include <string.h>
 
-#define SYNC_FREQ 1024
-#define SYNC_RESET_CLOCKS 512
-#define CLOCKS_PER_SYNC (GBC_CLOCK_FREQ / SYNC_FREQ)
-#define SLEEP_TIME (SECOND / SYNC_FREQ)
-#define SLEEP_DETECT (SECOND / 10)
+/* Max amplitude / no. channels / max global volume multiplier */
+#define MAX_CHANNEL_AMPLITUDE (INT16_MAX / 4 / 0x10u)
+/* Max channel amplitude / max envelope volume multiplier */
+#define BASE_AMPLITUDE (MAX_CHANNEL_AMPLITUDE / 0x10u)
 
 static const bool duty_table[4][8] = {
 	{0, 0, 0, 0, 0, 0, 0, 1}, 	/* 00000001b */
@@ -35,10 +35,17 @@ static const bool duty_table[4][8] = {
 static void length_counter_clock(struct channel *ch);
 static uint16_t frequency_calc(struct sweep *sweep);
 static bool timer_clock(struct timer *timer);
+static uint32_t timer_advance(struct timer *timer, uint32_t n);
 static void timer_reset(struct timer *timer);
-static bool duty_clock(struct duty *duty);
+static void duty_run(struct apu *apu, uint8_t index, struct channel *ch, uint32_t time, uint32_t n);
+static void noise_run(struct apu *apu, uint32_t time, uint32_t n);
+static void wave_run(struct gbcc_core *gbc, uint32_t time, uint32_t n);
+static void noise_step(struct apu *apu);
+static void wave_step(struct gbcc_core *gbc, uint32_t n);
+static uint8_t wave_amplitude(const struct apu *apu);
 static void envelope_clock(struct envelope *envelope);
-static void time_sync(struct gbcc_core *gbc);
+static void channel_output(struct apu *apu, uint8_t index, const struct channel *ch, uint8_t amplitude, uint32_t time);
+static void update_output(struct apu *apu);
 static void ch1_trigger(struct gbcc_core *gbc);
 static void ch2_trigger(struct gbcc_core *gbc);
 static void ch3_trigger(struct gbcc_core *gbc);
@@ -46,70 +53,213 @@ static void ch4_trigger(struct gbcc_core *gbc);
 
 void gbcc_apu_init(struct gbcc_core *gbc)
 {
-	gbc->apu = (struct apu){0};
-	gbc->apu.wave.addr = WAVE_START;
-	clock_gettime(CLOCK_REALTIME, &gbc->apu.start_time);
+	struct apu *apu = &gbc->apu;
+	struct apu old = *apu;
+	*apu = (struct apu){0};
+	apu->wave.addr = WAVE_START;
+	/* The output doesn't care about the APU being powered off */
+	apu->blip = old.blip;
+	apu->next_clock = old.next_clock;
+	apu->frame_clocks = old.frame_clocks;
+	memcpy(apu->output, old.output, sizeof(apu->output));
 }
 
-ANDROID_INLINE
-void gbcc_apu_clock(struct gbcc_core *gbc)
+/*
+ * Run every clock up to the current time. Each channel's timer is stepped
+ * from one change in output to the next, rather than a clock at a time.
+ */
+void gbcc_apu_sync(struct gbcc_core *gbc)
 {
 	struct apu *apu = &gbc->apu;
-	if (!gbc->sync_to_video) {
-		apu->sync_clock++;
-		if (apu->sync_clock == CLOCKS_PER_SYNC) {
-			apu->sync_clock = 0;
-			apu->sample++;
-			time_sync(gbc);
+	uint64_t now = gbc->scheduler.now;
+	if (now < apu->next_clock) {
+		return;
+	}
+	/* Clocks happen at the start of each cycle, along with the dot */
+	uint32_t n = (uint32_t)((now - apu->next_clock) / 4 + 1);
+	apu->next_clock += 4 * (uint64_t)n;
+
+	if (!apu->disabled) {
+		uint32_t time = apu->frame_clocks;
+		/* Duty cycle doesn't clock after powering on until first trigger */
+		if (apu->ch1.duty.enabled) {
+			duty_run(apu, 0, &apu->ch1, time, n);
+		}
+		if (apu->ch2.duty.enabled) {
+			duty_run(apu, 1, &apu->ch2, time, n);
+		}
+		/*
+		 * Some obscure behaviour, where the lfsr isn't clocked if the
+		 * shift is 14 or 15.
+		 */
+		if (apu->noise.shift < 14) {
+			noise_run(apu, time, n);
+		}
+		wave_run(gbc, time, n);
+	}
+	apu->frame_clocks += n;
+}
+
+/*
+ * Line the next clock up with the scheduler's time after it's been reset,
+ * and bring the output in line with the channels (which may have just been
+ * loaded from a savestate).
+ */
+void gbcc_apu_schedule(struct gbcc_core *gbc)
+{
+	gbc->apu.next_clock = gbcc_scheduler_next_dot(gbc);
+	update_output(&gbc->apu);
+}
+
+/* Catch up, and make everything so far available to read from apu.blip */
+void gbcc_apu_end_frame(struct gbcc_core *gbc)
+{
+	gbcc_apu_sync(gbc);
+	gbcc_blip_end_frame(gbc->apu.blip, gbc->apu.frame_clocks);
+	gbc->apu.frame_clocks = 0;
+}
+
+/*
+ * The timers of channels that can't be heard are just advanced in one go,
+ * as nothing in between matters.
+ */
+void duty_run(struct apu *apu, uint8_t index, struct channel *ch, uint32_t time, uint32_t n)
+{
+	struct duty *duty = &ch->duty;
+	duty->timer.period = (2048u - duty->freq) * 4;
+	if (!ch->enabled || !ch->envelope.volume) {
+		duty->counter = (uint8_t)((duty->counter + timer_advance(&duty->timer, n)) % 8u);
+		ch->state = duty_table[duty->cycle][duty->counter];
+		return;
+	}
+	uint32_t left = duty->timer.counter ? duty->timer.counter : 0x10000u;
+	while (left <= n) {
+		n -= left;
+		time += left;
+		duty->counter = (duty->counter + 1) % 8u;
+		ch->state = duty_table[duty->cycle][duty->counter];
+		channel_output(apu, index, ch, ch->state * ch->envelope.volume, time);
+		left = duty->timer.period;
+	}
+	duty->timer.counter = (uint16_t)(left - n);
+}
+
+void noise_run(struct apu *apu, uint32_t time, uint32_t n)
+{
+	struct timer *timer = &apu->noise.timer;
+	struct channel *ch = &apu->ch4;
+	if (!ch->enabled || !ch->envelope.volume) {
+		for (uint32_t i = timer_advance(timer, n); i > 0; i--) {
+			noise_step(apu);
 		}
+		return;
 	}
+	/* A counter or period of 0 wraps round to 0x10000 */
+	uint32_t left = timer->counter ? timer->counter : 0x10000u;
+	uint32_t period = timer->period ? timer->period : 0x10000u;
+	while (left <= n) {
+		n -= left;
+		time += left;
+		noise_step(apu);
+		channel_output(apu, 3, ch, ch->state * ch->envelope.volume, time);
+		left = period;
+	}
+	timer->counter = (uint16_t)(left - n);
+}
 
-	if (apu->disabled) {
+void wave_run(struct gbcc_core *gbc, uint32_t time, uint32_t n)
+{
+	struct apu *apu = &gbc->apu;
+	struct timer *timer = &apu->wave.timer;
+	if (!apu->ch3.enabled || !apu->wave.shift) {
+		uint32_t steps = timer_advance(timer, n);
+		if (steps > 0) {
+			wave_step(gbc, steps);
+		}
 		return;
 	}
+	uint32_t left = timer->counter ? timer->counter : 0x10000u;
+	while (left <= n) {
+		n -= left;
+		time += left;
+		wave_step(gbc, 1);
+		channel_output(apu, 2, &apu->ch3, wave_amplitude(apu), time);
+		left = timer->period;
+	}
+	timer->counter = (uint16_t)(left - n);
+}
 
-	/* Duty */
-	/* Duty cycle doesn't clock after powering on until first trigger */
+void noise_step(struct apu *apu)
+{
+	uint8_t lfsr_low = apu->noise.lfsr & 0xFFu;
+	uint8_t tmp = check_bit(lfsr_low, 0) ^ check_bit(lfsr_low, 1);
+	apu->noise.lfsr >>= 1u;
+	apu->noise.lfsr &= ~bit16(14);
+	apu->noise.lfsr |= tmp * bit16(14);
+	if (apu->noise.width_mode) {
+		apu->noise.lfsr &= ~bit(6);
+		apu->noise.lfsr |= tmp * bit(6);
+	}
+	apu->ch4.state = !check_bit16(apu->noise.lfsr, 0);
+}
+
+/* Move the wave channel on n samples, and fetch the new one */
+void wave_step(struct gbcc_core *gbc, uint32_t n)
+{
+	struct apu *apu = &gbc->apu;
+	apu->wave.position = (uint8_t)((apu->wave.position + n) & 31u);
+	apu->wave.addr = WAVE_START + (apu->wave.position / 2);
+	//printf("Wave clocked to %04X\n", apu->wave.addr);
+	apu->wave.buffer = gbcc_memory_read_force(gbc, apu->wave.addr);
+	/* Alternates between high & low nibble, high first */
+	if (apu->wave.position % 2) {
+		apu->wave.buffer &= 0x0Fu;
+	} else {
+		apu->wave.buffer >>= 4u;
+	}
+}
+
+uint8_t wave_amplitude(const struct apu *apu)
+{
+	if (!apu->wave.shift) {
+		return 0;
+	}
+	return apu->wave.buffer >> (apu->wave.shift - 1u);
+}
+
+/*
+ * Set a channel's contribution to the mix, given its current amplitude (0 -
+ * 15), and record any change time clocks into the blip frame.
+ */
+void channel_output(struct apu *apu, uint8_t index, const struct channel *ch, uint8_t amplitude, uint32_t time)
+{
+	/* The DAC produces a signal in the range [-1, 1] */
+	int32_t dac = ch->dac ? -(int32_t)MAX_CHANNEL_AMPLITUDE / 2 : 0;
+	int32_t level = ch->enabled ? amplitude * (int32_t)BASE_AMPLITUDE : 0;
+	int32_t left = (dac + ch->left * level) * (1 + apu->left_vol);
+	int32_t right = (dac + ch->right * level) * (1 + apu->right_vol);
+	int32_t *output = apu->output[index];
+	if (left != output[0] || right != output[1]) {
+		gbcc_blip_add_delta(apu->blip, time, left - output[0], right - output[1]);
+		output[0] = left;
+		output[1] = right;
+	}
+}
+
+/* Recalculate every channel's output, after a change to any of the settings */
+void update_output(struct apu *apu)
+{
+	uint32_t time = apu->frame_clocks;
 	if (apu->ch1.duty.enabled) {
-		apu->ch1.state = duty_clock(&apu->ch1.duty);
+		apu->ch1.state = duty_table[apu->ch1.duty.cycle][apu->ch1.duty.counter];
 	}
 	if (apu->ch2.duty.enabled) {
-		apu->ch2.state = duty_clock(&apu->ch2.duty);
-	}
-
-	/* Noise */
-	/*
-	 * < 14 check is some obscure behaviour, where the lfsr isn't clocked
-	 * if the shift is 14 or 15. Short-circuiting prevents timer_clock
-	 * being called in this case.
-	 */
-	if (apu->noise.shift < 14 && timer_clock(&apu->noise.timer)) {
-		uint8_t lfsr_low = apu->noise.lfsr & 0xFFu;
-		uint8_t tmp = check_bit(lfsr_low, 0) ^ check_bit(lfsr_low, 1);
-		apu->noise.lfsr >>= 1u;
-		apu->noise.lfsr &= ~bit16(14);
-		apu->noise.lfsr |= tmp * bit16(14);
-		if (apu->noise.width_mode) {
-			apu->noise.lfsr &= ~bit(6);
-			apu->noise.lfsr |= tmp * bit(6);
-		}
-		apu->ch4.state = !check_bit16(apu->noise.lfsr, 0);
-	}
-
-	/* Wave */
-	if (timer_clock(&apu->wave.timer)) {
-		apu->wave.position++;
-		apu->wave.position &= 31u;
-		apu->wave.addr = WAVE_START + (apu->wave.position / 2);
-		//printf("Wave clocked to %04X\n", apu->wave.addr);
-		apu->wave.buffer = gbcc_memory_read_force(gbc, apu->wave.addr);
-		/* Alternates between high & low nibble, high first */
-		if (apu->wave.position % 2) {
-			apu->wave.buffer &= 0x0Fu;
-		} else {
-			apu->wave.buffer >>= 4u;
-		}
+		apu->ch2.state = duty_table[apu->ch2.duty.cycle][apu->ch2.duty.counter];
 	}
+	channel_output(apu, 0, &apu->ch1, apu->ch1.state * apu->ch1.envelope.volume, time);
+	channel_output(apu, 1, &apu->ch2, apu->ch2.state * apu->ch2.envelope.volume, time);
+	channel_output(apu, 2, &apu->ch3, wave_amplitude(apu), time);
+	channel_output(apu, 3, &apu->ch4, apu->ch4.state * apu->ch4.envelope.volume, time);
 }
 
 void length_counter_clock(struct channel *ch)
@@ -129,30 +279,27 @@ bool timer_clock(struct timer *timer)
 	return false;
 }
 
-void timer_reset(struct timer *timer)
+/* Clock a timer n times, returning the number of times it fired */
+uint32_t timer_advance(struct timer *timer, uint32_t n)
 {
-	timer->counter = timer->period;
+	/* A counter or period of 0 wraps round to 0x10000 */
+	uint32_t counter = timer->counter ? timer->counter : 0x10000u;
+	if (n < counter) {
+		timer->counter = (uint16_t)(counter - n);
+		return 0;
+	}
+	uint32_t period = timer->period ? timer->period : 0x10000u;
+	n -= counter;
+	timer->counter = (uint16_t)(period - n % period);
+	return 1 + n / period;
 }
 
-
-bool duty_clock(struct duty *duty)
+void timer_reset(struct timer *timer)
 {
-	duty->timer.period = (2048u - duty->freq) * 4;
-	/*
-	 * Manually clock the duty timer here for performance reasons, rather
-	 * than calling timer_clock.
-	 */
-	if (duty->timer.counter == 1) {
-		duty->counter++;
-		duty->counter %= 8u;
-		duty->timer.counter = duty->timer.period;
-	} else {
-		duty->timer.counter--;
-	}
-
-	return duty_table[duty->cycle][duty->counter];
+	timer->counter = timer->period;
 }
 
+
 void envelope_clock(struct envelope *envelope)
 {
 	if (!envelope->enabled) {
@@ -181,6 +328,8 @@ uint16_t frequency_calc(struct sweep *sweep)
 
 void gbcc_apu_sequencer_clock(struct gbcc_core *gbc)
 {
+	gbcc_apu_sync(gbc);
+
 	/* Length counters every other clock */
 	if (!(gbc->apu.sequencer_counter & 0x01u)) {
 		if (gbc->apu.ch1.length_enable && gbc->apu.ch1.enabled) {
@@ -226,32 +375,13 @@ void gbcc_apu_sequencer_clock(struct gbcc_core *gbc)
 
 	gbc->apu.sequencer_counter++;
 	gbc->apu.sequencer_counter &= 0x7u;
-}
-
-void time_sync(struct gbcc_core *gbc)
-{
-	clock_gettime(CLOCK_REALTIME, &gbc->apu.cur_time);
-	uint64_t diff = gbcc_time_diff(&gbc->apu.cur_time, &gbc->apu.start_time);
-	if (diff > SLEEP_DETECT + (SECOND * gbc->apu.sample) / SYNC_FREQ || gbc->keys.turbo) {
-		gbc->apu.start_time = gbc->apu.cur_time;
-		gbc->apu.sample = 0;
-		return;
-	}
-	while (diff < (SECOND * gbc->apu.sample) / SYNC_FREQ) {
-		const struct timespec time = {.tv_sec = 0, .tv_nsec = SLEEP_TIME};
-		nanosleep(&time, NULL);
-		clock_gettime(CLOCK_REALTIME, &gbc->apu.cur_time);
-		diff = gbcc_time_diff(&gbc->apu.cur_time, &gbc->apu.start_time);
-	}
-	if (gbc->apu.sample > SYNC_RESET_CLOCKS) {
-		gbc->apu.sample = 0;
-		gbc->apu.start_time = gbc->apu.cur_time;
-	}
+	update_output(&gbc->apu);
 }
 
 void gbcc_apu_memory_write(struct gbcc_core *gbc, uint16_t addr, uint8_t val)
 {
 	uint8_t tmp;
+	gbcc_apu_sync(gbc);
 	switch (addr) {
 		case NR10:
 			gbc->apu.sweep.period = (val & 0x70u) >> 4u;
@@ -450,6 +580,7 @@ void gbcc_apu_memory_write(struct gbcc_core *gbc, uint16_t addr, uint8_t val)
 			gbc->apu.ch1.right = check_bit(val, 0);
 			break;
 		case NR52:
+			gbcc_timer_sync(gbc);
 			gbc->apu.disabled = !check_bit(val, 7);
 			if (gbc->apu.disabled) {
 				for (size_t i = NR10; i < NR52; i++) {
@@ -458,10 +589,12 @@ void gbcc_apu_memory_write(struct gbcc_core *gbc, uint16_t addr, uint8_t val)
 				gbcc_apu_init(gbc);
 				gbc->apu.disabled = true;
 			}
+			gbcc_timer_schedule(gbc);
 			break;
 		default:
 			gbcc_log_error("Invalid APU address 0x%04X\n", addr);
 	}
+	update_output(&gbc->apu);
 }
 
 void ch1_trigger(struct gbcc_core *gbc)
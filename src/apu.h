@@ -11,9 +11,20 @@
 #ifndef GBCC_APU_H
 #define GBCC_APU_H
 
+#include "blip.h"
 #include <stdbool.h>
 #include <stdint.h>
-#include <time.h>
+
+/*
+ * The channels' timers aren't clocked every cycle. Instead, they're caught
+ * up by gbcc_apu_sync() whenever something is about to look at or change
+ * the APU's state (register accesses, the frame sequencer, savestates &
+ * audio output), with each change in a channel's output that happens on the
+ * way recorded in apu.blip.
+ */
+
+/* Samples the band-limited buffer can hold between reads */
+#define GBCC_APU_BUFFER_SAMPLES 1024
 
 struct gbcc_core;
 
@@ -77,14 +88,10 @@ struct channel {
 };
 
 struct apu {
-	uint16_t sync_clock;
-	uint16_t sample;
 	uint8_t left_vol;
 	uint8_t right_vol;
 	bool disabled;
 	bool div_bit;
-	struct timespec cur_time;
-	struct timespec start_time;
 	struct channel ch1; 	/* Tone & Sweep */
 	struct channel ch2; 	/* Tone */
 	struct channel ch3; 	/* Wave Output */
@@ -93,10 +100,18 @@ struct apu {
 	struct noise noise;
 	struct wave wave;
 	uint8_t sequencer_counter;
+
+	/* Output, carried across power cycles & savestates */
+	struct gbcc_blip *blip;
+	uint64_t next_clock;	/* Scheduler time of the next clock to run */
+	uint32_t frame_clocks;	/* Clocks run since the blip frame started */
+	int32_t output[4][2];	/* Each channel's current contribution to the mix */
 };
 
 void gbcc_apu_init(struct gbcc_core *gbc);
-void gbcc_apu_clock(struct gbcc_core *gbc);
+void gbcc_apu_sync(struct gbcc_core *gbc);
+void gbcc_apu_schedule(struct gbcc_core *gbc);
+void gbcc_apu_end_frame(struct gbcc_core *gbc);
 void gbcc_apu_sequencer_clock(struct gbcc_core *gbc);
 void gbcc_apu_memory_write(struct gbcc_core *gbc, uint16_t addr, uint8_t val);
 
@@ -17,12 +17,14 @@
 #include <ctype.h>
 #include <errno.h>
 #include <getopt.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
 
 static void usage()
 {
-	printf("Usage: gbcc [-aAbfFhivV] [-c config_file] [-p palette] [-s shader] [-t speed] rom\n"
+	printf("Usage: gbcc [-aAbfFhiPuvV] [-c config_file] [-k frames] [-p palette] [-r MiB] [-s shader] [-t speed] rom\n"
 	       "  -a, --autoresume      Automatically resume gameplay if possible.\n"
 	       "  -A, --autosave        Automatically save SRAM after last write.\n"
 	       "  -b, --background      Enable playback while unfocused.\n"
@@ -32,11 +34,16 @@ static void usage()
 	       "  -F, --frame-blending  Enable simple frame blending.\n"
 	       "  -h, --help            Print this message and exit.\n"
 	       "  -i, --interlacing     Enable interlacing.\n"
+	       "  -k, --frame-skip=NUM  Frames to skip drawing per frame drawn in turbo\n"
+	       "                        mode (default = auto).\n"
 	       "  -p, --palette=NAME    Select the colour palette (DMG mode only).\n"
+	       "  -P, --packed-frames   Convert colours in shaders, from 16-bit frames.\n"
+	       "  -r, --rewind=MiB      Memory to keep for rewinding (0 = no rewind).\n"
 	       "  -s, --shader=NAME     Select the initial shader to use.\n"
 	       "  -S, --save-dir=PATH   Path to use for save files.\n"
 	       "  -t, --turbo=NUM    	Set a fractional speed limit for turbo mode\n"
 	       "                        (0 = unlimited).\n"
+	       "  -u, --audio-sync      Let the sound card set the emulation speed.\n"
 	       "  -v, --vsync           Enable VSync (experimental).\n"
 	       "  -V, --vram-window     Display a window with all vram tile data.\n"
 	      );
@@ -56,15 +63,19 @@ bool gbcc_parse_args(struct gbcc *gbc, bool file_required, int argc, char **argv
 		{"frame-blending", no_argument, NULL, 'F'},
 		{"help", no_argument, NULL, 'h'},
 		{"interlacing", no_argument, NULL, 'i'},
+		{"frame-skip", required_argument, NULL, 'k'},
 		{"palette", required_argument, NULL, 'p'},
+		{"packed-frames", no_argument, NULL, 'P'},
+		{"rewind", required_argument, NULL, 'r'},
 		{"shader", required_argument, NULL, 's'},
 		{"save-dir", required_argument, NULL, 'S'},
 		{"turbo", required_argument, NULL, 't'},
+		{"audio-sync", no_argument, NULL, 'u'},
 		{"vsync", no_argument, NULL, 'v'},
 		{"vram-window", no_argument, NULL, 'V'},
 		{0, 0, 0, 0}
 	};
-	const char *short_options = "aAbc:C:fFhip:s:S:t:vV";
+	const char *short_options = "aAbc:C:fFhik:p:Pr:s:S:t:uvV";
 
 	for (int opt; (opt = getopt_long(argc, argv, short_options, long_options, NULL)) != -1;) {
 		if (opt == 'h') {
@@ -94,6 +105,8 @@ bool gbcc_parse_args(struct gbcc *gbc, bool file_required, int argc, char **argv
 	}
 	gbcc_load_config(gbc, config);
 
+	int skip;
+	int mib;
 	optind = 1;
 	for (int opt; (opt = getopt_long(argc, argv, short_options, long_options, NULL)) != -1;) {
 		switch (opt) {
@@ -124,10 +137,35 @@ bool gbcc_parse_args(struct gbcc *gbc, bool file_required, int argc, char **argv
 			case 'i':
 				gbc->interlacing = true;
 				break;
+			case 'k':
+				if (strcasecmp(optarg, "auto") == 0) {
+					gbc->core.frame_skip = GBCC_FRAME_SKIP_AUTO;
+					break;
+				}
+				errno = 0;
+				if (sscanf(optarg, "%d", &skip) != 1 || errno || skip < 0 || skip > UINT8_MAX) {
+					gbcc_log_error("Failed to parse frame skip '%s'.\n", optarg);
+					break;
+				}
+				gbc->core.frame_skip = skip;
+				break;
 			case 'p':
 				gbc->core.ppu.palette = gbcc_get_palette(optarg);
+				gbcc_ppu_update_colours(&gbc->core);
 				gbcc_log_debug("%s palette selected\n", gbc->core.ppu.palette.name);
 				break;
+			case 'P':
+				gbc->core.packed_frames = true;
+				gbcc_ppu_update_colours(&gbc->core);
+				break;
+			case 'r':
+				errno = 0;
+				if (sscanf(optarg, "%d", &mib) != 1 || errno || mib < 0 || mib > GBCC_REWIND_MAX_MIB) {
+					gbcc_log_error("Failed to parse rewind size '%s'.\n", optarg);
+					break;
+				}
+				gbc->rewind.budget = (size_t)mib * 1024 * 1024;
+				break;
 			case 's':
 				strncpy(gbc->default_shader, optarg, N_ELEM(gbc->default_shader));
 				gbc->default_shader[N_ELEM(gbc->default_shader) - 1] = '\0';
@@ -142,6 +180,9 @@ bool gbcc_parse_args(struct gbcc *gbc, bool file_required, int argc, char **argv
 					gbcc_log_error("Failed to parse turbo multiplier '%s'.\n", optarg);
 				}
 				break;
+			case 'u':
+				gbc->core.sync_to_audio = true;
+				break;
 			case 'v':
 				gbc->core.sync_to_video = true;
 				break;
@@ -150,7 +191,9 @@ bool gbcc_parse_args(struct gbcc *gbc, bool file_required, int argc, char **argv
 				break;
 			case '?':
 				if (optopt == 'c'
+						|| optopt == 'k'
 						|| optopt == 'p'
+						|| optopt == 'r'
 						|| optopt == 's'
 						|| optopt == 'S'
 						|| optopt == 't') {
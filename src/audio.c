@@ -8,150 +8,232 @@
  *
  */
 
+#include "apu.h"
 #include "audio.h"
+#include "audio_ring.h"
+#include "blip.h"
+#include "debug.h"
 #include "gbcc.h"
+#include "time_diff.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
 
-/* Max amplitude / no. channels / max global volume multiplier */
-#define MAX_CHANNEL_AMPLITUDE (INT16_MAX / 4 / 0x10u)
-/* Max channel amplitude / max envelope volume multiplier */
-#define BASE_AMPLITUDE (MAX_CHANNEL_AMPLITUDE / 0x10u)
+/*
+ * The ring is kept about half full by making samples very slightly faster or
+ * slower than the backend plays them, which absorbs the drift between the
+ * emulator's & sound card's clocks. Half a percent is far too little to hear
+ * as a change in pitch.
+ */
+#define MAX_RATE_DELTA 0.005f
+
+/*
+ * In audio sync mode, how long to wait for the backend to take anything
+ * before deciding it's broken, and falling back to the normal timing.
+ */
+#define STALL_TIMEOUT (SECOND / 4)
+
+/*
+ * Without an audio backend (e.g. headless), there's no rate to size blocks
+ * by, but the APU's frame still has to be ended now & then.
+ */
+#define NO_AUDIO_BLOCK_CLOCKS GBC_FRAME_CLOCKS
 
-static void ch1_update(struct gbcc *gbc);
-static void ch2_update(struct gbcc *gbc);
-static void ch3_update(struct gbcc *gbc);
-static void ch4_update(struct gbcc *gbc);
+static uint32_t block_clocks(const struct gbcc_audio *audio);
+static void end_block(struct gbcc *gbc);
+static void wait_for_backend(struct gbcc *gbc);
+static void set_rate(struct gbcc *gbc);
 
 
+/*
+ * buffer_samples is the size of the ring between the emulator & the audio
+ * backend, which is kept about half full.
+ */
 void gbcc_audio_initialise(struct gbcc *gbc, size_t sample_rate, size_t buffer_samples)
 {
 	struct gbcc_audio *audio = &gbc->audio;
 
 	audio->sample_rate = sample_rate;
-	audio->buffer_samples = buffer_samples;
-	audio->buffer_bytes = buffer_samples * 2 * sizeof(*audio->mix_buffer);
 	audio->clocks_per_sample = (float)GBC_CLOCK_FREQ / (float)sample_rate;
-	audio->mix_buffer = calloc(buffer_samples * 2, sizeof(*audio->mix_buffer));
+	audio->rate = 1.0f;
+	audio->mix_buffer = calloc(GBCC_AUDIO_BLOCK_SAMPLES * 2, sizeof(*audio->mix_buffer));
+	audio->ring = gbcc_audio_ring_create(buffer_samples);
+	if (!audio->mix_buffer || !audio->ring) {
+		gbcc_log_error("Failed to allocate audio buffers.\n");
+		exit(EXIT_FAILURE);
+	}
 	audio->volume = 1.0f;
+	pthread_mutex_init(&audio->lock, NULL);
+	/* So the stall timeout isn't thrown off by the wall clock jumping */
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&audio->drained, &attr);
+	pthread_condattr_destroy(&attr);
 	gbcc_audio_platform_initialise(gbc);
+	set_rate(gbc);
 }
 
 void gbcc_audio_destroy(struct gbcc *gbc)
 {
 	gbcc_audio_platform_destroy(gbc);
+	gbcc_audio_ring_destroy(gbc->audio.ring);
 	free(gbc->audio.mix_buffer);
+	pthread_cond_destroy(&gbc->audio.drained);
+	pthread_mutex_destroy(&gbc->audio.lock);
 }
 
+/*
+ * Called after every batch of cycles the core runs. The APU records its own
+ * output as it goes, so this only has to do anything once per block, when
+ * the samples are collected.
+ */
 ANDROID_INLINE
-void gbcc_audio_update(struct gbcc *gbc)
+void gbcc_audio_update(struct gbcc *gbc, uint32_t cycles)
 {
 	struct gbcc_audio *audio = &gbc->audio;
-
-	float mult = 1;
-	if (gbc->core.keys.turbo) {
-		if (gbc->turbo_speed > 0) {
-			mult = gbc->turbo_speed;
-		} else {
-			return;
-		}
+	audio->clock += cycles;
+	if (audio->clock >= block_clocks(audio)) {
+		end_block(gbc);
 	}
-	audio->clock++;
-	if (gbc->core.sync_to_video) {
-		mult /= audio->scale;
-	}
-	/* When err > 0, it tells us how much we overshot the last sample by */
-	float err = audio->clock - audio->clocks_per_sample * mult * (float)audio->sample;
-	if (err >= 0) {
-		if (err < 1) {
-			/*
-			 * Some minor black magic to keep our audio buffers
-			 * being filled at the correct rate. If we overshot
-			 * this sample, we take the next sample slightly early.
-			 *
-			 * err < 1 is just a sanity check, so we don't mess
-			 * everything up if there's a stutter.
-			 */
-			audio->clock += err;
-		}
-		if (audio->sample >= audio->buffer_samples) {
-			gbcc_audio_platform_queue_buffer(gbc);
-			audio->index = 0;
-			audio->clock = 0;
-			audio->sample = 0;
-		}
-		audio->sample++;
-		audio->mix_buffer[audio->index] = 0;
-		audio->mix_buffer[audio->index + 1] = 0;
-		ch1_update(gbc);
-		ch2_update(gbc);
-		ch3_update(gbc);
-		ch4_update(gbc);
-		float left_vol = (1 + gbc->core.apu.left_vol) * audio->volume;
-		float right_vol = (1 + gbc->core.apu.right_vol) * audio->volume;
-		audio->mix_buffer[audio->index] = (int16_t)(audio->mix_buffer[audio->index] * left_vol);
-		audio->mix_buffer[audio->index + 1] = (int16_t)(audio->mix_buffer[audio->index + 1] * right_vol);
-		audio->index += 2;
+}
+
+/*
+ * Number of cycles until the current block is finished, which the core
+ * shouldn't run past before calling gbcc_audio_update().
+ */
+uint32_t gbcc_audio_cycles_until_block(struct gbcc *gbc)
+{
+	struct gbcc_audio *audio = &gbc->audio;
+	uint32_t length = block_clocks(audio);
+	if (audio->clock >= length) {
+		return 1;
 	}
+	return length - audio->clock;
 }
 
-void ch1_update(struct gbcc *gbc)
+/*
+ * Called by the audio backend for the next n frames to play. If the ring runs
+ * dry, the last frame is held rather than dropping to 0, which would click
+ * due to the DACs' offset. Nothing is taken from the ring until it can cover
+ * all n frames, so it gets a chance to refill.
+ *
+ * Each read wakes the emulation thread, in case it's waiting for room in the
+ * ring (see wait_for_backend()).
+ */
+void gbcc_audio_fill(struct gbcc_audio *audio, GBCC_AUDIO_FMT *frames, size_t n)
 {
-	struct channel *ch1 = &gbc->core.apu.ch1;
-	if (ch1->dac) {
-		/* The DAC produces a signal in the range [-1, 1] */
-		gbc->audio.mix_buffer[gbc->audio.index] -= MAX_CHANNEL_AMPLITUDE / 2;
-		gbc->audio.mix_buffer[gbc->audio.index + 1] -= MAX_CHANNEL_AMPLITUDE / 2;
+	size_t read = 0;
+	if (gbcc_audio_ring_fill(audio->ring) >= n) {
+		read = gbcc_audio_ring_read(audio->ring, frames, n);
 	}
-	if (!ch1->enabled) {
-		return;
+	if (read > 0) {
+		audio->last[0] = frames[2 * read - 2];
+		audio->last[1] = frames[2 * read - 1];
+		pthread_mutex_lock(&audio->lock);
+		pthread_cond_signal(&audio->drained);
+		pthread_mutex_unlock(&audio->lock);
+	}
+	for (size_t i = read; i < n; i++) {
+		frames[2 * i] = audio->last[0];
+		frames[2 * i + 1] = audio->last[1];
 	}
-	uint8_t volume = ch1->envelope.volume;
-	gbc->audio.mix_buffer[gbc->audio.index] += (GBCC_AUDIO_FMT)(ch1->left * ch1->state * volume * BASE_AMPLITUDE);
-	gbc->audio.mix_buffer[gbc->audio.index + 1] += (GBCC_AUDIO_FMT)(ch1->right * ch1->state * volume * BASE_AMPLITUDE);
 }
 
-void ch2_update(struct gbcc *gbc)
+uint32_t block_clocks(const struct gbcc_audio *audio)
 {
-	struct channel *ch2 = &gbc->core.apu.ch2;
-	if (ch2->dac) {
-		/* The DAC produces a signal in the range [-1, 1] */
-		gbc->audio.mix_buffer[gbc->audio.index] -= MAX_CHANNEL_AMPLITUDE / 2;
-		gbc->audio.mix_buffer[gbc->audio.index + 1] -= MAX_CHANNEL_AMPLITUDE / 2;
+	if (!audio->ring) {
+		return NO_AUDIO_BLOCK_CLOCKS;
 	}
-	if (!ch2->enabled) {
+	return audio->block_clocks;
+}
+
+/*
+ * Hand the finished block to the backend, and adjust the rate to match. The
+ * block may come out a sample longer or shorter than GBCC_AUDIO_BLOCK_SAMPLES,
+ * as the fractions of a sample are carried over.
+ */
+void end_block(struct gbcc *gbc)
+{
+	struct gbcc_audio *audio = &gbc->audio;
+	struct gbcc_audio_ring *ring = audio->ring;
+	struct gbcc_blip *blip = gbc->core.apu.blip;
+	/* With no limit on the turbo speed, there's no sensible rate to play at */
+	bool discard = gbc->core.keys.turbo && gbc->turbo_speed <= 0;
+	/*
+	 * Frames played while rewinding are just noise, but still need to be
+	 * written as silence, to keep audio sync pacing things.
+	 */
+	float volume = gbc->rewind.active ? 0 : audio->volume;
+
+	gbcc_apu_end_frame(&gbc->core);
+	audio->clock = 0;
+	if (!ring) {
+		/* The blip's rate was never set, so it has no samples to read */
 		return;
 	}
-	uint8_t volume = ch2->envelope.volume;
-	gbc->audio.mix_buffer[gbc->audio.index] += (GBCC_AUDIO_FMT)(ch2->left * ch2->state * volume * BASE_AMPLITUDE);
-	gbc->audio.mix_buffer[gbc->audio.index + 1] += (GBCC_AUDIO_FMT)(ch2->right * ch2->state * volume * BASE_AMPLITUDE);
+	size_t n;
+	while ((n = gbcc_blip_read(blip, audio->mix_buffer, GBCC_AUDIO_BLOCK_SAMPLES)) > 0) {
+		if (discard) {
+			continue;
+		}
+		for (size_t i = 0; i < 2 * n; i++) {
+			audio->mix_buffer[i] = (GBCC_AUDIO_FMT)(audio->mix_buffer[i] * volume);
+		}
+		/* If the ring's full, the backend has stalled, so there's no point waiting */
+		gbcc_audio_ring_write(ring, audio->mix_buffer, n);
+	}
+	if (gbc->core.sync_to_audio && !gbc->core.sync_to_video && !discard) {
+		wait_for_backend(gbc);
+	}
+	float fill = (float)gbcc_audio_ring_fill(ring) / (float)ring->size;
+	/* More than half full means sampling too fast, so slow down */
+	audio->rate = 1 + MAX_RATE_DELTA * (2 * fill - 1);
+	set_rate(gbc);
 }
 
-void ch3_update(struct gbcc *gbc)
+/*
+ * Sleep until the backend has played the ring down to half full, so that
+ * the emulator runs exactly as fast as the sound card plays. This replaces
+ * the pacer (see pacer.h) in audio sync mode.
+ */
+void wait_for_backend(struct gbcc *gbc)
 {
-	struct channel *ch3 = &gbc->core.apu.ch3;
-	if (ch3->dac) {
-		/* The DAC produces a signal in the range [-1, 1] */
-		gbc->audio.mix_buffer[gbc->audio.index] -= MAX_CHANNEL_AMPLITUDE / 2;
-		gbc->audio.mix_buffer[gbc->audio.index + 1] -= MAX_CHANNEL_AMPLITUDE / 2;
-	}
-	if (!ch3->enabled || gbc->core.apu.wave.shift == 0) {
-		return;
+	struct gbcc_audio *audio = &gbc->audio;
+	size_t target = audio->ring->size / 2;
+
+	pthread_mutex_lock(&audio->lock);
+	while (gbcc_audio_ring_fill(audio->ring) > target) {
+		struct timespec deadline;
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		uint64_t nsec = (uint64_t)deadline.tv_nsec + STALL_TIMEOUT;
+		deadline.tv_sec += (time_t)(nsec / SECOND);
+		deadline.tv_nsec = (long)(nsec % SECOND);
+		if (pthread_cond_timedwait(&audio->drained, &audio->lock, &deadline) == ETIMEDOUT) {
+			gbcc_log_error("Audio backend stalled, falling back to timer sync.\n");
+			gbc->core.sync_to_audio = false;
+			break;
+		}
 	}
-	gbc->audio.mix_buffer[gbc->audio.index] += (GBCC_AUDIO_FMT)(ch3->left * (gbc->core.apu.wave.buffer >> (gbc->core.apu.wave.shift - 1u)) * BASE_AMPLITUDE);
-	gbc->audio.mix_buffer[gbc->audio.index + 1] += (GBCC_AUDIO_FMT)(ch3->right * (gbc->core.apu.wave.buffer >> (gbc->core.apu.wave.shift - 1u)) * BASE_AMPLITUDE);
+	pthread_mutex_unlock(&audio->lock);
 }
 
-void ch4_update(struct gbcc *gbc)
+/* Work out the length of a sample & the next block at the current speed */
+void set_rate(struct gbcc *gbc)
 {
-	struct channel *ch4 = &gbc->core.apu.ch4;
-	if (ch4->dac) {
-		/* The DAC produces a signal in the range [-1, 1] */
-		gbc->audio.mix_buffer[gbc->audio.index] -= MAX_CHANNEL_AMPLITUDE / 2;
-		gbc->audio.mix_buffer[gbc->audio.index + 1] -= MAX_CHANNEL_AMPLITUDE / 2;
+	struct gbcc_audio *audio = &gbc->audio;
+
+	float mult = 1;
+	if (gbc->core.keys.turbo && gbc->turbo_speed > 0) {
+		mult = gbc->turbo_speed;
 	}
-	if (!ch4->enabled) {
-		return;
+	if (gbc->core.sync_to_video) {
+		mult /= audio->scale;
 	}
-	uint8_t volume = ch4->envelope.volume;
-	gbc->audio.mix_buffer[gbc->audio.index] += (GBCC_AUDIO_FMT)(ch4->left * ch4->state * volume * BASE_AMPLITUDE);
-	gbc->audio.mix_buffer[gbc->audio.index + 1] += (GBCC_AUDIO_FMT)(ch4->right * ch4->state * volume * BASE_AMPLITUDE);
+	mult *= audio->rate;
+	float clocks = audio->clocks_per_sample * mult;
+	gbcc_blip_set_rate(gbc->core.apu.blip, clocks);
+	audio->block_clocks = (uint32_t)(clocks * GBCC_AUDIO_BLOCK_SAMPLES);
 }
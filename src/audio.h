@@ -16,34 +16,43 @@
 #else
 #include "audio_platform/openal.h"
 #endif
+#include "audio_ring.h"
+#include <pthread.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <time.h>
 
 #define GBCC_AUDIO_FMT int16_t
 
+/* Samples are mixed in blocks of this many before going into the ring */
+#define GBCC_AUDIO_BLOCK_SAMPLES 64
+
 struct gbcc;
 
 struct gbcc_audio {
 	struct gbcc_audio_platform platform;
-	float clock;
-	unsigned int sample;
-	size_t index;
+	struct gbcc_audio_ring *ring;
+	uint32_t clock;		/* Cycles into the current block */
+	uint32_t block_clocks;	/* Length of the current block in cycles */
 	size_t sample_rate;
-	size_t buffer_samples;
-	size_t buffer_bytes;
 	float clocks_per_sample;
+	float rate;	/* Adjustment to clocks_per_sample to keep the ring half full */
 	float scale;
 	float volume;
 	GBCC_AUDIO_FMT *mix_buffer;
+	GBCC_AUDIO_FMT last[2];	/* Last frame played, held if the ring runs dry */
+	pthread_mutex_t lock;
+	pthread_cond_t drained;	/* Signalled by the backend after each read */
 };
 
 void gbcc_audio_initialise(struct gbcc *gbc, size_t sample_rate, size_t buffer_samples);
 void gbcc_audio_destroy(struct gbcc *gbc);
-void gbcc_audio_update(struct gbcc *gbc);
+void gbcc_audio_update(struct gbcc *gbc, uint32_t cycles);
+uint32_t gbcc_audio_cycles_until_block(struct gbcc *gbc);
+void gbcc_audio_fill(struct gbcc_audio *audio, GBCC_AUDIO_FMT *frames, size_t n);
 void gbcc_audio_play_wav(const char *filename);
 
 void gbcc_audio_platform_initialise(struct gbcc *gbc);
 void gbcc_audio_platform_destroy(struct gbcc *gbc);
-void gbcc_audio_platform_queue_buffer(struct gbcc *gbc);
 
 #endif /* GBCC_AUDIO_H */
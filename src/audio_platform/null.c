@@ -3,4 +3,3 @@
 void gbcc_audio_play_wav(const char *filename) {};
 void gbcc_audio_platform_initialise(struct gbcc *gbc) {};
 void gbcc_audio_platform_destroy(struct gbcc *gbc) {};
-void gbcc_audio_platform_queue_buffer(struct gbcc *gbc) {};
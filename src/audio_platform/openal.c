@@ -24,12 +24,19 @@
 #include <AL/al.h>
 #include <AL/alc.h>
 #endif
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
+/* Each OpenAL buffer holds this many frames, ~5ms at 96kHz */
+#define CHUNK_SAMPLES 512
+
 static int check_openal_error(const char *msg);
+static void *feed_thread(void *_audio);
 static void *wav_thread(void *filename);
 
 void gbcc_audio_platform_initialise(struct gbcc *gbc)
@@ -81,13 +88,17 @@ void gbcc_audio_platform_initialise(struct gbcc *gbc)
 		exit(EXIT_FAILURE);
 	}
 
-	memset(audio->mix_buffer, 0, audio->buffer_bytes);
+	audio->platform.chunk = calloc(CHUNK_SAMPLES * 2, sizeof(*audio->platform.chunk));
+	if (!audio->platform.chunk) {
+		gbcc_log_error("Failed to allocate audio chunk.\n");
+		exit(EXIT_FAILURE);
+	}
 	for (size_t i = 0; i < N_ELEM(audio->platform.buffers); i++) {
 		alBufferData(
 				audio->platform.buffers[i],
 				AL_FORMAT_STEREO16,
-				audio->mix_buffer,
-				(ALsizei)audio->buffer_bytes,
+				audio->platform.chunk,
+				CHUNK_SAMPLES * 2 * sizeof(*audio->platform.chunk),
 				(ALsizei)audio->sample_rate
 			    );
 	}
@@ -95,45 +106,57 @@ void gbcc_audio_platform_initialise(struct gbcc *gbc)
 	check_openal_error("Failed to queue buffers.\n");
 	alSourcePlay(audio->platform.source);
 	check_openal_error("Failed to play audio.\n");
+
+	atomic_init(&audio->platform.quit, false);
+	pthread_create(&audio->platform.thread, NULL, feed_thread, audio);
+	pthread_setname_np(audio->platform.thread, "AudioThread");
 }
 
 void gbcc_audio_platform_destroy(struct gbcc *gbc) {
+	atomic_store(&gbc->audio.platform.quit, true);
+	pthread_join(gbc->audio.platform.thread, NULL);
+	free(gbc->audio.platform.chunk);
 	alDeleteSources(1, &gbc->audio.platform.source);
 	alDeleteBuffers(N_ELEM(gbc->audio.platform.buffers), gbc->audio.platform.buffers);
 	alcDestroyContext(gbc->audio.platform.context);
 	alcCloseDevice(gbc->audio.platform.device);
 }
 
-ANDROID_INLINE
-void gbcc_audio_platform_queue_buffer(struct gbcc *gbc)
+/*
+ * OpenAL has no callback for when a buffer's finished, so this polls for
+ * them, refilling each one from the ring. The emulation thread never waits
+ * for the sound card itself.
+ */
+void *feed_thread(void *_audio)
 {
-	struct gbcc_audio *audio = &gbc->audio;
-	ALint processed = 0;
-	alGetSourcei(audio->platform.source, AL_BUFFERS_PROCESSED, &processed);
-	while (!processed) {
-		const struct timespec time = {.tv_sec = 0, .tv_nsec = 100000};
+	struct gbcc_audio *audio = (struct gbcc_audio *)_audio;
+	struct gbcc_audio_platform *al = &audio->platform;
+	while (!atomic_load(&al->quit)) {
+		ALint processed = 0;
+		alGetSourcei(al->source, AL_BUFFERS_PROCESSED, &processed);
+		for (; processed > 0; processed--) {
+			ALuint buffer;
+			alSourceUnqueueBuffers(al->source, 1, &buffer);
+			check_openal_error("Failed to unqueue buffer.\n");
+			gbcc_audio_fill(audio, al->chunk, CHUNK_SAMPLES);
+			alBufferData(buffer, AL_FORMAT_STEREO16, al->chunk, CHUNK_SAMPLES * 2 * sizeof(*al->chunk), (ALsizei)audio->sample_rate);
+			check_openal_error("Failed to fill buffer.\n");
+			alSourceQueueBuffers(al->source, 1, &buffer);
+			check_openal_error("Failed to queue buffer.\n");
+		}
+		ALint state;
+		alGetSourcei(al->source, AL_SOURCE_STATE, &state);
+		check_openal_error("Failed to get source state.\n");
+		if (state == AL_STOPPED) {
+			alSourcePlay(al->source);
+			check_openal_error("Failed to resume audio playback.\n");
+		}
+		const struct timespec time = {.tv_sec = 0, .tv_nsec = 1000000};
 		nanosleep(&time, NULL);
-		alGetSourcei(audio->platform.source, AL_BUFFERS_PROCESSED, &processed);
-	}
-	ALuint buffer;
-	alSourceUnqueueBuffers(audio->platform.source, 1, &buffer);
-	check_openal_error("Failed to unqueue buffer.\n");
-	alBufferData(buffer, AL_FORMAT_STEREO16, audio->mix_buffer, (ALsizei)audio->buffer_bytes, (ALsizei)audio->sample_rate);
-	check_openal_error("Failed to fill buffer.\n");
-	alSourceQueueBuffers(audio->platform.source, 1, &buffer);
-	check_openal_error("Failed to queue buffer.\n");
-	ALint state;
-	alGetSourcei(audio->platform.source, AL_SOURCE_STATE, &state);
-	check_openal_error("Failed to get source state.\n");
-	if (state == AL_STOPPED) {
-		clock_gettime(CLOCK_REALTIME, &gbc->core.apu.start_time);
-		gbc->core.apu.sample = 0;
-		alSourcePlay(audio->platform.source);
-		check_openal_error("Failed to resume audio playback.\n");
 	}
+	return NULL;
 }
 
-
 int check_openal_error(const char *msg)
 {
 	ALenum error = alGetError();
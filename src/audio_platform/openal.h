@@ -18,12 +18,19 @@
 #include <AL/al.h>
 #include <AL/alc.h>
 #endif
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
 
 struct gbcc_audio_platform {
 	ALCdevice *device;
 	ALCcontext *context;
 	ALuint source;
-	ALuint buffers[8];
+	ALuint buffers[4];
+	int16_t *chunk;
+	pthread_t thread;	/* Refills buffers from the ring as they're played */
+	atomic_bool quit;
 };
 
 #endif /* GBCC_OPENAL_H */
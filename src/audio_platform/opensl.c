@@ -24,6 +24,10 @@
 #include "../time_diff.h"
 #include "../wav.h"
 
+/* Each buffer holds this many frames, ~2.7ms at 96kHz */
+#define CHUNK_SAMPLES 256
+#define CHUNK_BYTES (CHUNK_SAMPLES * 2 * sizeof(int16_t))
+
 static void buffer_callback(SLAndroidSimpleBufferQueueItf bq, void *_audio);
 
 void gbcc_audio_platform_initialise(struct gbcc *gbc)
@@ -32,12 +36,14 @@ void gbcc_audio_platform_initialise(struct gbcc *gbc)
 	struct gbcc_audio_platform *sl = &audio->platform;
 	audio->scale = 0.9955;
 
-	for (size_t i = 0; i < N_ELEM(sl->mix_buffers); i++) {
-		sl->mix_buffers[i] = calloc(audio->buffer_samples * 2, sizeof(*sl->mix_buffers[i]));
-		sl->playback_buffers[i] = calloc(audio->buffer_samples * 2, sizeof(*sl->playback_buffers[i]));
+	for (size_t i = 0; i < N_ELEM(sl->playback_buffers); i++) {
+		sl->playback_buffers[i] = calloc(CHUNK_SAMPLES * 2, sizeof(*sl->playback_buffers[i]));
+		if (!sl->playback_buffers[i]) {
+			gbcc_log_error("Failed to allocate audio buffers.\n");
+			exit(EXIT_FAILURE);
+		}
 	}
-	sl->write_buffer = 1;
-	sl->read_buffer = 0;
+	sl->next_buffer = 0;
 
 	SLresult result;
 
@@ -75,7 +81,7 @@ void gbcc_audio_platform_initialise(struct gbcc *gbc)
 	/* Create the buffer queue player */
 	SLDataLocator_AndroidSimpleBufferQueue bq_locator = {
 		.locatorType = SL_DATALOCATOR_ANDROIDSIMPLEBUFFERQUEUE,
-		.numBuffers = 4
+		.numBuffers = N_ELEM(sl->playback_buffers)
 	};
 
 	SLDataFormat_PCM format = {
@@ -136,10 +142,10 @@ void gbcc_audio_platform_initialise(struct gbcc *gbc)
 		exit(EXIT_FAILURE);
 	}
 
-	result = (*sl->buffer_queue)->Enqueue(sl->buffer_queue, sl->playback_buffers[0], audio->buffer_bytes);
-	result |= (*sl->buffer_queue)->Enqueue(sl->buffer_queue, sl->playback_buffers[1], audio->buffer_bytes);
-	result |= (*sl->buffer_queue)->Enqueue(sl->buffer_queue, sl->playback_buffers[2], audio->buffer_bytes);
-	result |= (*sl->buffer_queue)->Enqueue(sl->buffer_queue, sl->playback_buffers[3], audio->buffer_bytes);
+	result = SL_RESULT_SUCCESS;
+	for (size_t i = 0; i < N_ELEM(sl->playback_buffers); i++) {
+		result |= (*sl->buffer_queue)->Enqueue(sl->buffer_queue, sl->playback_buffers[i], CHUNK_BYTES);
+	}
 	if (result != SL_RESULT_SUCCESS) {
 		gbcc_log_error("Failed to queue buffer.\n");
 		exit(EXIT_FAILURE);
@@ -157,28 +163,13 @@ void gbcc_audio_platform_destroy(struct gbcc *gbc) {
 	struct gbcc_audio *audio = &gbc->audio;
 	struct gbcc_audio_platform *sl = &audio->platform;
 
-	for (size_t i = 0; i < N_ELEM(sl->mix_buffers); i++) {
-		free(sl->mix_buffers[i]);
-		free(sl->playback_buffers[i]);
-	}
-
 	(*sl->player_object)->Destroy(sl->player_object);
 	(*sl->output_mix)->Destroy(sl->output_mix);
 	(*sl->engine_object)->Destroy(sl->engine_object);
-	*sl = (struct gbcc_audio_platform){0};
-}
-
-void gbcc_audio_platform_queue_buffer(struct gbcc *gbc)
-{
-	struct gbcc_audio *audio = &gbc->audio;
-	struct gbcc_audio_platform *sl = &audio->platform;
-
-	sl->write_buffer = (sl->write_buffer + 1) % 4;
-	while (sl->read_buffer == sl->write_buffer) {
-		const struct timespec time = {.tv_sec = 0, .tv_nsec = 100000};
-		nanosleep(&time, NULL);
+	for (size_t i = 0; i < N_ELEM(sl->playback_buffers); i++) {
+		free(sl->playback_buffers[i]);
 	}
-	memcpy(sl->mix_buffers[sl->write_buffer], audio->mix_buffer, audio->buffer_bytes);
+	*sl = (struct gbcc_audio_platform){0};
 }
 
 void gbcc_audio_play_wav(const char *filename)
@@ -186,13 +177,17 @@ void gbcc_audio_play_wav(const char *filename)
 	gbcc_log_error("Stubbed function \"gbcc_audio_play_wav()\" called.");
 }
 
+/*
+ * Called by OpenSL on its own thread each time a buffer finishes, which is
+ * then refilled straight from the ring and queued again.
+ */
 void buffer_callback(SLAndroidSimpleBufferQueueItf bq, void *_audio) {
 	struct gbcc_audio *audio = (struct gbcc_audio *)_audio;
 	struct gbcc_audio_platform *sl = &audio->platform;
-	memcpy(sl->playback_buffers[sl->read_buffer], sl->mix_buffers[sl->read_buffer], audio->buffer_bytes);
-	memset(sl->mix_buffers[sl->read_buffer], 0, audio->buffer_bytes);
-	sl->read_buffer = (sl->read_buffer + 1) % 4;
-	SLresult result = (*sl->buffer_queue)->Enqueue(sl->buffer_queue, sl->playback_buffers[sl->read_buffer], audio->buffer_bytes);
+	int16_t *buffer = sl->playback_buffers[sl->next_buffer];
+	gbcc_audio_fill(audio, buffer, CHUNK_SAMPLES);
+	sl->next_buffer = (sl->next_buffer + 1) % N_ELEM(sl->playback_buffers);
+	SLresult result = (*sl->buffer_queue)->Enqueue(sl->buffer_queue, buffer, CHUNK_BYTES);
 	if (result != SL_RESULT_SUCCESS) {
 		gbcc_log_error("OpenSLES failed to enqueue buffer.\n");
 	}
@@ -25,11 +25,8 @@ struct gbcc_audio_platform {
 	SLPlayItf player;
 	SLAndroidSimpleBufferQueueItf buffer_queue;
 	SLmilliHertz sample_rate;
-	uint16_t buffer_size;
-	uint16_t *mix_buffers[4];
-	uint16_t *playback_buffers[4];
-	uint16_t read_buffer;
-	uint16_t write_buffer;
+	int16_t *playback_buffers[4];
+	uint8_t next_buffer;	/* Oldest queued buffer, the next to finish */
 };
 
 #endif /* GBCC_OPENSL_H */
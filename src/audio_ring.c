@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2017-2020 Philip Jones
+ *
+ * Licensed under the MIT License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/licenses/MIT
+ *
+ */
+
+#include "audio_ring.h"
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void copy_frames(int16_t *dst, const int16_t *src, size_t n);
+
+/* frames is rounded up to the next power of 2 */
+struct gbcc_audio_ring *gbcc_audio_ring_create(size_t frames)
+{
+	struct gbcc_audio_ring *ring = calloc(1, sizeof(*ring));
+	if (!ring) {
+		return NULL;
+	}
+	ring->size = 1;
+	while (ring->size < frames) {
+		ring->size *= 2;
+	}
+	ring->data = calloc(ring->size * 2, sizeof(*ring->data));
+	if (!ring->data) {
+		free(ring);
+		return NULL;
+	}
+	atomic_init(&ring->head, 0);
+	atomic_init(&ring->tail, 0);
+	return ring;
+}
+
+void gbcc_audio_ring_destroy(struct gbcc_audio_ring *ring)
+{
+	if (!ring) {
+		return;
+	}
+	free(ring->data);
+	free(ring);
+}
+
+/*
+ * Called from the emulation thread. Returns the number of frames written,
+ * which is less than n if the ring filled up.
+ */
+size_t gbcc_audio_ring_write(struct gbcc_audio_ring *ring, const int16_t *frames, size_t n)
+{
+	size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+	size_t space = ring->size - (head - tail);
+	if (n > space) {
+		n = space;
+	}
+	size_t start = head & (ring->size - 1);
+	size_t first = ring->size - start;
+	if (first > n) {
+		first = n;
+	}
+	copy_frames(&ring->data[2 * start], frames, first);
+	copy_frames(ring->data, &frames[2 * first], n - first);
+	atomic_store_explicit(&ring->head, head + n, memory_order_release);
+	return n;
+}
+
+/*
+ * Called from the audio backend. Returns the number of frames read, which is
+ * less than n if the ring ran dry.
+ */
+size_t gbcc_audio_ring_read(struct gbcc_audio_ring *ring, int16_t *frames, size_t n)
+{
+	size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+	size_t fill = head - tail;
+	if (n > fill) {
+		n = fill;
+	}
+	size_t start = tail & (ring->size - 1);
+	size_t first = ring->size - start;
+	if (first > n) {
+		first = n;
+	}
+	copy_frames(frames, &ring->data[2 * start], first);
+	copy_frames(&frames[2 * first], ring->data, n - first);
+	atomic_store_explicit(&ring->tail, tail + n, memory_order_release);
+	return n;
+}
+
+/* Number of frames waiting to be read, safe to call from either side */
+size_t gbcc_audio_ring_fill(struct gbcc_audio_ring *ring)
+{
+	size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+	size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+	return head - tail;
+}
+
+void copy_frames(int16_t *dst, const int16_t *src, size_t n)
+{
+	if (n > 0) {
+		memcpy(dst, src, 2 * n * sizeof(*dst));
+	}
+}
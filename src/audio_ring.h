@@ -0,0 +1,39 @@
+/*
+ * Copyright (C) 2017-2020 Philip Jones
+ *
+ * Licensed under the MIT License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/licenses/MIT
+ *
+ */
+
+#ifndef GBCC_AUDIO_RING_H
+#define GBCC_AUDIO_RING_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Single-producer, single-consumer ring of stereo frames, passing audio from
+ * the emulation thread to the audio backend without either side ever
+ * waiting on the other.
+ *
+ * head & tail only ever increase (wrapping round), so the fill level is just
+ * their difference, and the ring can be completely filled.
+ */
+struct gbcc_audio_ring {
+	int16_t *data;		/* Interleaved left & right samples */
+	size_t size;		/* In frames, a power of 2 */
+	atomic_size_t head;	/* Written by the producer */
+	atomic_size_t tail;	/* Written by the consumer */
+};
+
+struct gbcc_audio_ring *gbcc_audio_ring_create(size_t frames);
+void gbcc_audio_ring_destroy(struct gbcc_audio_ring *ring);
+size_t gbcc_audio_ring_write(struct gbcc_audio_ring *ring, const int16_t *frames, size_t n);
+size_t gbcc_audio_ring_read(struct gbcc_audio_ring *ring, int16_t *frames, size_t n);
+size_t gbcc_audio_ring_fill(struct gbcc_audio_ring *ring);
+
+#endif /* GBCC_AUDIO_RING_H */
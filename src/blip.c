@@ -0,0 +1,171 @@
+/*
+ * Copyright (C) 2017-2020 Philip Jones
+ *
+ * Licensed under the MIT License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/licenses/MIT
+ *
+ */
+
+#include "blip.h"
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PHASE_BITS 6
+#define PHASES (1u << PHASE_BITS)
+#define WIDTH 16	/* Taps in each impulse */
+#define KERNEL_BITS 14	/* Each impulse sums to 1 << KERNEL_BITS */
+/* Fraction of the output's Nyquist frequency that's let through */
+#define CUTOFF 0.9
+/*
+ * The integrator leaks by 1 / (1 << BASS_SHIFT) per sample, which removes
+ * any DC offset (e.g. from the DACs) with a cutoff of ~30Hz at 96kHz.
+ */
+#define BASS_SHIFT 9
+
+/* Impulses for a step at PHASES positions between two samples */
+static int16_t kernel[PHASES][WIDTH];
+static bool kernel_built;
+
+static void build_kernel(void);
+
+struct gbcc_blip *gbcc_blip_create(size_t frames)
+{
+	if (!kernel_built) {
+		build_kernel();
+		kernel_built = true;
+	}
+	struct gbcc_blip *blip = calloc(1, sizeof(*blip));
+	if (!blip) {
+		return NULL;
+	}
+	blip->size = frames;
+	/* Impulses near the end of a frame spill past it */
+	blip->buffer = calloc((frames + WIDTH) * 2, sizeof(*blip->buffer));
+	if (!blip->buffer) {
+		free(blip);
+		return NULL;
+	}
+	return blip;
+}
+
+void gbcc_blip_destroy(struct gbcc_blip *blip)
+{
+	if (!blip) {
+		return;
+	}
+	free(blip->buffer);
+	free(blip);
+}
+
+/*
+ * Can be changed at any point, and takes effect from the start of the
+ * current frame.
+ */
+void gbcc_blip_set_rate(struct gbcc_blip *blip, double clocks_per_sample)
+{
+	blip->factor = (uint64_t)((double)(1ull << 32u) / clocks_per_sample);
+}
+
+void gbcc_blip_clear(struct gbcc_blip *blip)
+{
+	blip->offset &= 0xFFFFFFFFu;
+	blip->avail = 0;
+	blip->integrator[0] = 0;
+	blip->integrator[1] = 0;
+	memset(blip->buffer, 0, (blip->size + WIDTH) * 2 * sizeof(*blip->buffer));
+}
+
+/* Change the output level by left & right, time clocks into the frame */
+void gbcc_blip_add_delta(struct gbcc_blip *blip, uint32_t time, int32_t left, int32_t right)
+{
+	uint64_t fixed = blip->offset + time * blip->factor;
+	size_t pos = (size_t)(fixed >> 32u);
+	if (pos > blip->size) {
+		/* Nobody's been reading, so there's nowhere to put it */
+		return;
+	}
+	const int16_t *impulse = kernel[(fixed >> (32u - PHASE_BITS)) & (PHASES - 1)];
+	int32_t *out = &blip->buffer[2 * pos];
+	for (size_t i = 0; i < WIDTH; i++) {
+		out[2 * i] += impulse[i] * left;
+		out[2 * i + 1] += impulse[i] * right;
+	}
+}
+
+/*
+ * Make the samples up to clocks into the frame available to read, and start
+ * a new frame there. If they won't fit, everything is thrown away.
+ */
+void gbcc_blip_end_frame(struct gbcc_blip *blip, uint32_t clocks)
+{
+	blip->offset += clocks * blip->factor;
+	blip->avail = (size_t)(blip->offset >> 32u);
+	if (blip->avail > blip->size) {
+		gbcc_blip_clear(blip);
+	}
+}
+
+/* Read up to n frames, returning how many there were */
+size_t gbcc_blip_read(struct gbcc_blip *blip, int16_t *frames, size_t n)
+{
+	if (n > blip->avail) {
+		n = blip->avail;
+	}
+	for (size_t c = 0; c < 2; c++) {
+		int32_t sum = blip->integrator[c];
+		for (size_t i = 0; i < n; i++) {
+			int32_t s = sum >> KERNEL_BITS;
+			sum += blip->buffer[2 * i + c];
+			if (s > INT16_MAX) {
+				s = INT16_MAX;
+			} else if (s < INT16_MIN) {
+				s = INT16_MIN;
+			}
+			frames[2 * i + c] = (int16_t)s;
+			sum -= s * (1 << (KERNEL_BITS - BASS_SHIFT));
+		}
+		blip->integrator[c] = sum;
+	}
+
+	/* Shift what's left, including impulses spilling into the next frame */
+	size_t remaining = blip->avail - n + WIDTH;
+	memmove(blip->buffer, &blip->buffer[2 * n], remaining * 2 * sizeof(*blip->buffer));
+	memset(&blip->buffer[2 * remaining], 0, n * 2 * sizeof(*blip->buffer));
+	blip->avail -= n;
+	blip->offset -= (uint64_t)n << 32u;
+	return n;
+}
+
+/*
+ * A Blackman-windowed sinc, with the step WIDTH / 2 - 1 samples in, plus
+ * however far between samples the phase puts it.
+ */
+void build_kernel(void)
+{
+	for (size_t p = 0; p < PHASES; p++) {
+		double taps[WIDTH];
+		double sum = 0;
+		for (size_t i = 0; i < WIDTH; i++) {
+			double x = (double)i - (WIDTH / 2 - 1) - (double)p / PHASES;
+			double window = 0.42
+				+ 0.5 * cos(M_PI * x / (WIDTH / 2))
+				+ 0.08 * cos(2 * M_PI * x / (WIDTH / 2));
+			double y = M_PI * CUTOFF * x;
+			taps[i] = window * (y == 0 ? 1 : sin(y) / y);
+			sum += taps[i];
+		}
+		/* Each impulse must add up to exactly one step, or levels drift */
+		int32_t total = 0;
+		for (size_t i = 0; i < WIDTH; i++) {
+			kernel[p][i] = (int16_t)lround(taps[i] / sum * (1 << KERNEL_BITS));
+			total += kernel[p][i];
+		}
+		kernel[p][WIDTH / 2 - 1] += (int16_t)((1 << KERNEL_BITS) - total);
+	}
+}
@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2017-2020 Philip Jones
+ *
+ * Licensed under the MIT License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/licenses/MIT
+ *
+ */
+
+#ifndef GBCC_BLIP_H
+#define GBCC_BLIP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Band-limited step synthesis, for turning the APU's square-edged output
+ * into samples at the host's rate without aliasing.
+ *
+ * Rather than being sampled, the output is described by the changes in its
+ * level, each stamped with the clock it happened on. Every change adds a
+ * windowed-sinc impulse to the buffer at the corresponding (fractional)
+ * sample position, and reading the buffer integrates those impulses back
+ * into steps. The cost is per change, not per clock or per sample.
+ *
+ * Clocks are counted from the start of the current frame, which is ended
+ * whenever samples are wanted. Samples then become available to read up to
+ * the end of the frame.
+ */
+
+struct gbcc_blip {
+	uint64_t factor;	/* Samples per clock, in 32.32 fixed point */
+	uint64_t offset;	/* Position of the frame start, in the same */
+	int32_t integrator[2];
+	size_t size;		/* In frames */
+	size_t avail;		/* Frames ready to be read */
+	int32_t *buffer;	/* Interleaved left & right impulses */
+};
+
+struct gbcc_blip *gbcc_blip_create(size_t frames);
+void gbcc_blip_destroy(struct gbcc_blip *blip);
+void gbcc_blip_set_rate(struct gbcc_blip *blip, double clocks_per_sample);
+void gbcc_blip_clear(struct gbcc_blip *blip);
+void gbcc_blip_add_delta(struct gbcc_blip *blip, uint32_t time, int32_t left, int32_t right);
+void gbcc_blip_end_frame(struct gbcc_blip *blip, uint32_t clocks);
+size_t gbcc_blip_read(struct gbcc_blip *blip, int16_t *frames, size_t n);
+
+#endif /* GBCC_BLIP_H */
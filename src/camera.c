@@ -12,6 +12,7 @@
 #include "bit_utils.h"
 #include "debug.h"
 #include "gbcc.h"
+#include "tile_decode.h"
 #include <string.h>
 
 #define GB_CAMERA_WIDTH 128
@@ -215,20 +216,7 @@ void write_tile_data(struct gbcc_core *gbc, uint8_t image[GB_CAMERA_SENSOR_SIZE]
 		for (uint8_t tx = 0; tx < GB_CAMERA_WIDTH_TILES; tx++) {
 			uint32_t base_idx = 8 * ty * GB_CAMERA_WIDTH + 8 * tx + 8 * GB_CAMERA_WIDTH;
 			uint8_t *tile = &gbc->cart.ram[0x0100u + (ty * GB_CAMERA_WIDTH_TILES + tx) * 16];
-
-			for (uint8_t y = 0; y < 8; y++) {
-				uint8_t lower = 0;
-				uint8_t upper = 0;
-				for (uint8_t x = 0; x < 8; x++) {
-					uint8_t px = image[base_idx + y * GB_CAMERA_WIDTH + x];
-					lower <<= 1;
-					upper <<= 1;
-					lower |= check_bit(px, 0);
-					upper |= check_bit(px, 1);
-				}
-				tile[2 * y] = lower;
-				tile[2 * y + 1] = upper;
-			}
+			gbcc_tile_encode(&image[base_idx], GB_CAMERA_WIDTH, tile);
 		}
 	}
 }
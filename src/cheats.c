@@ -1,6 +1,7 @@
 #include "cheats.h"
 #include "core.h"
 #include "debug.h"
+#include "icache.h"
 #include "nelem.h"
 #include <stdio.h>
 #include <string.h>
@@ -75,11 +76,15 @@ void gbcc_cheats_gameshark_update(struct gbcc_core *gbc)
 			size_t addr = cheat.ram_bank * SRAM_SIZE + (cheat.address - SRAM_START);
 			gbc->cart.ram[addr] = cheat.new_data;
 		} else if (cheat.address >= WRAM0_START && cheat.address < WRAMX_END) {
+			uint8_t *dest;
 			if (cheat.address < WRAMX_START) {
-				gbc->memory.wram0[cheat.address - WRAM0_START] = cheat.new_data;
+				dest = &gbc->memory.wram0[cheat.address - WRAM0_START];
 			} else {
-				gbc->memory.wramx[cheat.address - WRAMX_START] = cheat.new_data;
+				dest = &gbc->memory.wramx[cheat.address - WRAMX_START];
 			}
+			*dest = cheat.new_data;
+			/* Code could be running from here, like any other write */
+			gbcc_icache_invalidate_wram(gbc, dest);
 		}
 	}
 }
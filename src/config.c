@@ -16,6 +16,7 @@
 #include "window.h"
 #include <ctype.h>
 #include <errno.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -226,6 +227,8 @@ bool parse_option(struct gbcc *gbc, size_t lineno, const char *option, const cha
 	bool err = false;
 	if (strcasecmp(option, "autoresume") == 0) {
 		gbc->autoresume = parse_bool(lineno, value, &err);
+	} else if (strcasecmp(option, "audio-sync") == 0) {
+		gbc->core.sync_to_audio = parse_bool(lineno, value, &err);
 	} else if (strcasecmp(option, "autosave") == 0) {
 		gbc->autosave = parse_bool(lineno, value, &err);
 	} else if (strcasecmp(option, "background") == 0) {
@@ -237,10 +240,40 @@ bool parse_option(struct gbcc *gbc, size_t lineno, const char *option, const cha
 		gbc->fractional_scaling = parse_bool(lineno, value, &err);
 	} else if (strcasecmp(option, "frame-blending") == 0) {
 		gbc->frame_blending = parse_bool(lineno, value, &err);
+	} else if (strcasecmp(option, "frame-skip") == 0) {
+		if (strcasecmp(value, "auto") == 0) {
+			gbc->core.frame_skip = GBCC_FRAME_SKIP_AUTO;
+		} else {
+			errno = 0;
+			char *endptr;
+			long skip = strtol(value, &endptr, 10);
+			if (endptr == value) {
+				PARSE_ERROR(lineno, "Failed to parse \"%s\" as integer.\n", value);
+			} else if (errno || skip < 0 || skip > UINT8_MAX) {
+				PARSE_ERROR(lineno, "Frame skip \"%s\" out of range.\n", value);
+			} else {
+				gbc->core.frame_skip = (int)skip;
+			}
+		}
 	} else if (strcasecmp(option, "interlacing") == 0) {
 		gbc->interlacing = parse_bool(lineno, value, &err);
+	} else if (strcasecmp(option, "packed-frames") == 0) {
+		gbc->core.packed_frames = parse_bool(lineno, value, &err);
+		gbcc_ppu_update_colours(&gbc->core);
 	} else if (strcasecmp(option, "palette") == 0) {
 		gbc->core.ppu.palette = gbcc_get_palette(value);
+		gbcc_ppu_update_colours(&gbc->core);
+	} else if (strcasecmp(option, "rewind") == 0) {
+		errno = 0;
+		char *endptr;
+		long mib = strtol(value, &endptr, 10);
+		if (endptr == value) {
+			PARSE_ERROR(lineno, "Failed to parse \"%s\" as integer.\n", value);
+		} else if (errno || mib < 0 || mib > GBCC_REWIND_MAX_MIB) {
+			PARSE_ERROR(lineno, "Rewind size \"%s\" out of range.\n", value);
+		} else {
+			gbc->rewind.budget = (size_t)mib * 1024 * 1024;
+		}
 	} else if (strcasecmp(option, "shader") == 0) {
 		strncpy(gbc->default_shader, value, N_ELEM(gbc->default_shader));
 		gbc->default_shader[N_ELEM(gbc->default_shader) - 1] = '\0';
@@ -13,10 +13,15 @@
 #include "bit_utils.h"
 #include "constants.h"
 #include "debug.h"
+#include "icache.h"
+#include "interrupt.h"
+#include "jit.h"
 #include "memory.h"
 #include "nelem.h"
 #include "palettes.h"
 #include "save.h"
+#include "scheduler.h"
+#include "tile_decode.h"
 #include <errno.h>
 #include <semaphore.h>
 #include <stdbool.h>
@@ -50,8 +55,8 @@ static void init_ioreg(struct gbcc_core *gbc);
 void gbcc_initialise(struct gbcc_core *gbc, const char *filename)
 {
 	*gbc = (const struct gbcc_core){0};
+	gbcc_tile_decode_init();
 	gbc->error_msg = NULL;
-	gbc->version = GBCC_SAVE_STATE_VERSION;
 	gbc->cart.filename = filename;
 	gbc->cart.mbc.type = NONE;
 	gbc->cart.mbc.romx_bank = 0x01u;
@@ -62,10 +67,19 @@ void gbcc_initialise(struct gbcc_core *gbc, const char *filename)
 	gbc->cpu.ime = false;
 	gbc->ppu.clock = 0;
 	gbc->ppu.palette = gbcc_get_palette("default");
-	gbc->ppu.screen.buffer_0 = calloc(GBC_SCREEN_SIZE, sizeof(uint32_t));
-	gbc->ppu.screen.buffer_1 = calloc(GBC_SCREEN_SIZE, sizeof(uint32_t));
-	gbc->ppu.screen.gbc = gbc->ppu.screen.buffer_0;
-	gbc->ppu.screen.sdl = gbc->ppu.screen.buffer_1;
+	gbc->frame_skip = GBCC_FRAME_SKIP_AUTO;
+	gbc->ppu.screen = gbcc_screen_create();
+	if (!gbc->ppu.screen) {
+		gbcc_log_error("Failed to allocate screen buffers.\n");
+		gbc->error = true;
+		return;
+	}
+	gbc->apu.blip = gbcc_blip_create(GBCC_APU_BUFFER_SAMPLES);
+	if (!gbc->apu.blip) {
+		gbcc_log_error("Failed to allocate audio buffers.\n");
+		gbc->error = true;
+		return;
+	}
 	load_rom(gbc, filename);
 	if (gbc->error) {
 		return;
@@ -74,6 +88,25 @@ void gbcc_initialise(struct gbcc_core *gbc, const char *filename)
 	if (gbc->error) {
 		return;
 	}
+	gbc->icache = gbcc_icache_create(gbc->cart.rom_banks);
+	if (!gbc->icache) {
+		gbcc_log_error("Failed to allocate instruction cache.\n");
+		gbc->error = true;
+		return;
+	}
+#ifdef GBCC_JIT
+	/* If this fails, we just carry on interpreting */
+	gbc->jit = gbcc_jit_create(gbc->cart.rom_banks);
+	if (!gbc->jit) {
+		gbcc_log_error("Failed to allocate recompiler, carrying on without it.\n");
+	}
+#endif
+	gbc->tile_cache = gbcc_tile_cache_create();
+	if (!gbc->tile_cache) {
+		gbcc_log_error("Failed to allocate tile cache.\n");
+		gbc->error = true;
+		return;
+	}
 	init_mmap(gbc);
 	init_ioreg(gbc);
 	gbcc_apu_init(gbc);
@@ -87,6 +120,8 @@ void gbcc_initialise(struct gbcc_core *gbc, const char *filename)
 		gbc->memory.hram[i] = (uint8_t)rand();
 	}
 
+	gbcc_scheduler_reset(gbc);
+
 	sem_init(&gbc->ppu.vsync_semaphore, 0, 0);
 	gbc->initialised = true;
 }
@@ -102,8 +137,13 @@ void gbcc_free(struct gbcc_core *gbc)
 	if (gbc->cart.ram_size > 0) {
 		free(gbc->cart.ram);
 	}
-	free(gbc->ppu.screen.buffer_0);
-	free(gbc->ppu.screen.buffer_1);
+	gbcc_screen_destroy(gbc->ppu.screen);
+	gbcc_blip_destroy(gbc->apu.blip);
+	gbcc_icache_destroy(gbc->icache);
+#ifdef GBCC_JIT
+	gbcc_jit_destroy(gbc->jit);
+#endif
+	gbcc_tile_cache_destroy(gbc->tile_cache);
 	*gbc = (const struct gbcc_core){0};
 }
 
@@ -444,6 +484,7 @@ void get_cartridge_hardware(struct gbcc_core *gbc)
 			gbc->cart.mbc.type = MBC3;
 			break;
 	}
+	gbcc_mbc_bind(gbc);
 }
 
 void init_ram(struct gbcc_core *gbc)
@@ -545,6 +586,7 @@ void init_mmap(struct gbcc_core *gbc)
 	gbc->memory.wram0 = gbc->memory.wram_bank[0];
 	gbc->memory.wramx = gbc->memory.wram_bank[1];
 	gbc->memory.echo = gbc->memory.wram0;
+	gbcc_memory_update_map(gbc);
 }
 
 void init_ioreg(struct gbcc_core *gbc)
@@ -587,5 +629,7 @@ void init_ioreg(struct gbcc_core *gbc)
 	gbc->memory.ioreg[HDMA5 - IOREG_START] = 0xFFu;
 	gbc->memory.ioreg[SVBK - IOREG_START] = 0x01u;
 	gbc->memory.iereg = 0x00u;
+	gbcc_interrupt_update(gbc);
 	memset(gbc->ppu.bgp, 0xFFu, sizeof(gbc->ppu.bgp));
+	gbcc_ppu_update_colours(gbc);
 }
@@ -11,15 +11,18 @@
 #ifndef GBCC_CORE_H
 #define GBCC_CORE_H
 
-#define GBCC_SAVE_STATE_VERSION 8
-
 #include "apu.h"
 #include "cheats.h"
 #include "constants.h"
 #include "cpu.h"
+#include "icache.h"
+#include "idle.h"
+#include "jit.h"
 #include "mbc.h"
 #include "ppu.h"
 #include "printer.h"
+#include "scheduler.h"
+#include "tile_cache.h"
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -33,9 +36,6 @@ enum GBCC_LINK_CABLE_STATE {
 };
 
 struct gbcc_core {
-	/* Version number for checking save state compatibility */
-	uint32_t version;
-
 	/* Core emulator areas */
 	struct cpu cpu;
 	struct apu apu;
@@ -60,6 +60,9 @@ struct gbcc_core {
 		uint8_t *wram0;	/* Non-switchable Work RAM */
 		uint8_t *wramx;	/* Work RAM (switchable in GBC mode) */
 		uint8_t *echo;	/* Mirror of WRAM */
+		/* Direct pointers to each 4KiB page, or NULL to use the handlers */
+		uint8_t *read_page[16];
+		uint8_t *write_page[16];
 		uint8_t oam[OAM_SIZE];	/* Object Attribute Table */
 		uint8_t unused[UNUSED_SIZE];	/* Complicated unused memory */
 		uint8_t ioreg[IOREG_SIZE];	/* I/O Registers */
@@ -111,6 +114,7 @@ struct gbcc_core {
 		uint16_t divider;
 		uint16_t clock;
 		enum GBCC_LINK_CABLE_STATE state;
+		uint64_t sent;	/* Bytes sent, for gbcc_run_until() to spot new ones */
 	} link_cable;
 
 	struct {
@@ -123,14 +127,25 @@ struct gbcc_core {
 
 	/* Settings */
 	bool sync_to_video;
+	bool sync_to_audio;	/* Let the audio backend set the speed */
+	int frame_skip;	/* Frames skipped per frame shown in turbo mode */
 	bool hide_background;
 	bool hide_window;
 	bool hide_sprites;
+	bool packed_frames;	/* Output 16-bit pixels, see ppu.c */
 
 	/* Initialisation state */
 	bool initialised;
 	bool error;
 	const char *error_msg;
+
+	/* Derived state, rebuilt whenever a savestate is loaded */
+	struct gbcc_scheduler scheduler;
+	struct gbcc_idle idle;
+	struct gbcc_icache *icache;
+	struct gbcc_jit *jit;		/* Only with -Djit=enabled */
+	struct gbcc_tile_cache *tile_cache;
+	uint8_t pending_interrupts;	/* IE & IF (see interrupt.h) */
 };
 
 void gbcc_initialise(struct gbcc_core *gbc, const char *filename);
@@ -9,37 +9,91 @@
  */
 
 #include "core.h"
-#include "apu.h"
 #include "bit_utils.h"
 #include "cpu.h"
 #include "debug.h"
 #include "gbcc.h"
 #include "hdma.h"
+#include "icache.h"
+#include "idle.h"
+#include "interrupt.h"
+#include "jit.h"
 #include "memory.h"
 #include "ops.h"
 #include "ppu.h"
+#include "scheduler.h"
 #include <stdio.h>
 #include <sys/time.h>
 #include <time.h>
 
-static inline void clock_div(struct gbcc_core *gbc);
 static void check_interrupts(struct gbcc_core *gbc);
+static uint32_t halted_cycles(struct gbcc_core *gbc, uint32_t max);
+static void skip_cycles(struct gbcc_core *gbc, uint32_t n);
 static inline void cpu_clock(struct gbcc_core *gbc);
+static inline void cpu_tick(struct gbcc_core *gbc);
 
-/* TODO: Check order of all of these */
+/*
+ * Everything other than the CPU is driven by the scheduler (see scheduler.h),
+ * and only gets called on the cycles where it has work to do, or is caught up
+ * lazily when it's next needed (see apu.h).
+ */
 ANDROID_INLINE
 void gbcc_emulate_cycle(struct gbcc_core *gbc)
 {
+	struct gbcc_scheduler *sched = &gbc->scheduler;
+	sched->now = gbcc_scheduler_next_dot(gbc);
 	check_interrupts(gbc);
-	gbcc_apu_clock(gbc);
-	gbcc_ppu_clock(gbc);
-	cpu_clock(gbc);
-	clock_div(gbc);
-	gbcc_link_cable_clock(gbc);
+	if (sched->next <= sched->now) {
+		gbcc_scheduler_dispatch(gbc);
+	}
+	cpu_tick(gbc);
 	if (gbc->cpu.double_speed) {
-		cpu_clock(gbc);
-		clock_div(gbc);
-		gbcc_link_cable_clock(gbc);
+		cpu_tick(gbc);
+	}
+}
+
+/*
+ * Emulate between 1 and max cycles, returning how many were run.
+ *
+ * While the CPU is halted, the only thing that happens each cycle is DIV
+ * ticking over, so every cycle up to the next scheduled event (or
+ * a pending interrupt) is skipped in one go. The same goes for the CPU
+ * spinning in a busy-wait loop (see idle.h), and for code that's been run
+ * ahead by the recompiler (see jit.h).
+ */
+uint32_t gbcc_emulate_cycles(struct gbcc_core *gbc, uint32_t max)
+{
+	uint32_t n = halted_cycles(gbc, max);
+	if (n <= 1) {
+		n = gbcc_idle_cycles(gbc, max);
+	}
+#ifdef GBCC_JIT
+	if (n <= 1) {
+		n = gbcc_jit_cycles(gbc, max);
+	}
+#endif
+	if (n > 1) {
+		skip_cycles(gbc, n);
+		return n;
+	}
+	gbcc_emulate_cycle(gbc);
+	return 1;
+}
+
+ANDROID_INLINE
+void cpu_tick(struct gbcc_core *gbc)
+{
+	struct gbcc_scheduler *sched = &gbc->scheduler;
+	sched->now = sched->next_tick;
+	cpu_clock(gbc);
+	gbc->cpu.div_timer++;
+	if (gbc->cpu.double_speed && (sched->now & 3u) == 1) {
+		sched->next_tick = sched->now + 1;
+	} else {
+		sched->next_tick = (sched->now | 3u) + 2;
+	}
+	if (sched->next <= sched->now) {
+		gbcc_scheduler_dispatch(gbc);
 	}
 }
 
@@ -85,10 +139,15 @@ void cpu_clock(struct gbcc_core *gbc)
 			return;
 		}
 		//printf("%d::%04X\n", gbc->cart.mbc.romx_bank, cpu->reg.pc);
-		cpu->opcode = gbcc_fetch_instruction(gbc);
+		const struct gbcc_icache_entry *op = gbcc_icache_fetch(gbc);
+		cpu->opcode = op->opcode;
+		cpu->instruction.mod = op->mod;
+		cpu->instruction.div = op->div;
 		//gbcc_print_registers(gbc);
 		//gbcc_print_op(gbc);
 		cpu->instruction.running = true;
+		op->handler(gbc);
+		return;
 	}
 	if (cpu->instruction.prefix_cb) {
 		gbcc_ops[0xCB](gbc);
@@ -97,101 +156,15 @@ void cpu_clock(struct gbcc_core *gbc)
 	}
 }
 
-__attribute__((always_inline))
-void clock_div(struct gbcc_core *gbc)
-{
-	struct cpu *cpu = &gbc->cpu;
-	cpu->div_timer++;
-	uint8_t tac = gbcc_memory_read_force(gbc, TAC);
-	uint16_t mask = 0;
-	switch (tac & 0x03u) {
-		/* 
-		 * TIMA register detects the falling edge of a bit in
-		 * the internal DIV timer, which is selected by TAC.
-		 */
-		case 0:
-			mask = bit16(9);
-			break;
-		case 1:
-			mask = bit16(3);
-			break;
-		case 2:
-			mask = bit16(5);
-			break;
-		case 3:
-			mask = bit16(7);
-			break;
-	}
-	/* If TAC is disabled, this will always see 0 */
-	mask *= check_bit(tac, 2);
-	bool old_bit = cpu->tac_bit;
-	cpu->tac_bit = cpu->div_timer & mask;
-	if (old_bit && !cpu->tac_bit) {
-		/* 
-		 * The selected bit was previously high, and is now low, so
-		 * the tima increment logic triggers.
-		 */
-		uint8_t tima = gbcc_memory_read(gbc, TIMA);
-		tima++;
-		if (tima == 0) {
-			/* 
-			 * TIMA overflow
-			 * Rather than being reloaded immediately, TIMA takes
-			 * 4 cycles to be reloaded, and another 4 to write, 
-			 * so we just queue it here. This also affects the
-			 * interrupt.
-			 */
-			cpu->tima_reload = 8;
-		}
-		gbcc_memory_write(gbc, TIMA, tima);
-	}
-	if (cpu->tima_reload > 0) {
-		cpu->tima_reload--;
-		if (cpu->tima_reload == 4) {
-			/*
-			 * Some more weird behaviour here: if TIMA has been
-			 * written to while this copy & interrupt are waiting,
-			 * they get cancelled, and everything proceeds as
-			 * normal.
-			 */
-			if (gbcc_memory_read(gbc, TIMA) != 0) {
-				cpu->tima_reload = 0;
-			} else {
-				gbcc_memory_copy(gbc, TMA, TIMA);
-				gbcc_memory_set_bit(gbc, IF, 2);
-			}
-		}
-		else if (cpu->tima_reload == 0) {
-			gbcc_memory_copy(gbc, TMA, TIMA);
-		}
-	}
-	if (!gbc->apu.disabled) {
-		/* APU also updates based on falling edge of DIV timer bit */
-		if (gbc->cpu.double_speed) {
-			mask = bit16(13);
-		} else {
-			mask = bit16(12);
-		}
-		old_bit = gbc->apu.div_bit;
-		gbc->apu.div_bit = cpu->div_timer & mask;
-		if (old_bit && !gbc->apu.div_bit) {
-			gbcc_apu_sequencer_clock(gbc);
-		}
-	}
-}
-
 void check_interrupts(struct gbcc_core *gbc)
 {
 	if (gbc->keys.interrupt) {
-		gbcc_memory_set_bit(gbc, IF, 4);
+		gbcc_interrupt_request(gbc, 4);
 		gbc->keys.interrupt = false;
 	}
 
 	struct cpu *cpu = &gbc->cpu;
-	uint8_t iereg = gbcc_memory_read(gbc, IE);
-	uint8_t ifreg = gbcc_memory_read(gbc, IF);
-	uint8_t interrupt = (uint8_t)(iereg & ifreg) & 0x1Fu;
-	if (interrupt) {
+	if (gbc->pending_interrupts) {
 		cpu->halt.set = false;
 		gbc->cpu.stop = false;
 		if (cpu->ime) {
@@ -202,6 +175,39 @@ void check_interrupts(struct gbcc_core *gbc)
 	}
 }
 
+/*
+ * Number of cycles, starting with the next, which the CPU is guaranteed to
+ * spend halted without any other event happening.
+ */
+uint32_t halted_cycles(struct gbcc_core *gbc, uint32_t max)
+{
+	struct cpu *cpu = &gbc->cpu;
+	if (max < 2 || cpu->instruction.running || !(cpu->halt.set || cpu->stop)) {
+		return 0;
+	}
+	if (gbc->pending_interrupts || gbc->keys.interrupt) {
+		return 0;
+	}
+	return gbcc_scheduler_quiet_cycles(gbc, max);
+}
+
+/*
+ * Equivalent to n calls to gbcc_emulate_cycle(), given that the only state
+ * they would change is DIV and the time.
+ */
+void skip_cycles(struct gbcc_core *gbc, uint32_t n)
+{
+	struct cpu *cpu = &gbc->cpu;
+	struct gbcc_scheduler *sched = &gbc->scheduler;
+	uint32_t ticks = n << cpu->double_speed;
+	uint64_t last = gbcc_scheduler_next_dot(gbc) + 4 * (uint64_t)(n - 1);
+	cpu->interrupt.request = false;
+	cpu->clock = (cpu->clock + ticks) & 3u;
+	cpu->div_timer += ticks;
+	sched->now = last + 1 + cpu->double_speed;
+	sched->next_tick = last + 5;
+}
+
 uint8_t gbcc_fetch_instruction(struct gbcc_core *gbc)
 {
 	struct cpu *cpu = &gbc->cpu;
@@ -22,6 +22,15 @@
 
 struct gbcc_core;
 
+/* The last operation to set the flags, if they haven't been worked out yet */
+enum gbcc_flags_op {
+	GBCC_FLAGS_SYNCED,
+	GBCC_FLAGS_ADD,
+	GBCC_FLAGS_SUB,
+	GBCC_FLAGS_INC,
+	GBCC_FLAGS_DEC
+};
+
 struct cpu {
 	/* Registers */
 	struct {
@@ -76,6 +85,14 @@ struct cpu {
 		uint16_t sp;
 		uint16_t pc;
 	} reg;
+	/* Operands & result of the op in flags.op, for working out reg.f */
+	struct {
+		uint8_t op;
+		uint8_t a;
+		uint8_t b;
+		uint8_t carry;
+		uint8_t result;
+	} flags;
 
 	/* Non-Register state data */
 	uint8_t opcode;
@@ -111,6 +128,8 @@ struct cpu {
 		uint16_t addr;
 		uint8_t op1;
 		uint8_t op2;
+		uint8_t mod;	/* Decoded operand fields of the opcode */
+		uint8_t div;
 		uint8_t step;
 		bool running;
 		bool prefix_cb;
@@ -119,5 +138,6 @@ struct cpu {
 
 uint8_t gbcc_fetch_instruction(struct gbcc_core *gbc);
 void gbcc_emulate_cycle(struct gbcc_core *gbc);
+uint32_t gbcc_emulate_cycles(struct gbcc_core *gbc, uint32_t max);
 
 #endif /* GBCC_CPU_H */
@@ -23,27 +23,6 @@
 #define vfprintf(file, ...) {__android_log_vprint(ANDROID_LOG_DEBUG, "GBCC", __VA_ARGS__); vfprintf((stdout), __VA_ARGS__);}
 #endif
 
-/* Instruction sizes, in bytes. 0 means invalid instruction */
-static const uint8_t gbcc_op_sizes[0x100] = {
-           /* 0  1  2  3  4  5  6  7  8  9  A  B  C  D  E  F */
-/* 0x00 */    1, 3, 1, 1, 1, 1, 2, 1, 3, 1, 1, 1, 1, 1, 2, 1,
-/* 0x10 */    2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1,
-/* 0x20 */    2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1,
-/* 0x30 */    2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1,
-/* 0x40 */    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-/* 0x50 */    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-/* 0x60 */    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-/* 0x70 */    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-/* 0x80 */    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-/* 0x90 */    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-/* 0xA0 */    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-/* 0xB0 */    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-/* 0xC0 */    1, 1, 3, 3, 3, 1, 2, 1, 1, 1, 3, 1, 3, 3, 2, 1,
-/* 0xD0 */    1, 1, 3, 0, 3, 1, 2, 1, 1, 1, 3, 0, 3, 0, 2, 1,
-/* 0xE0 */    2, 1, 2, 0, 0, 1, 2, 1, 2, 1, 3, 0, 0, 0, 2, 1,
-/* 0xF0 */    2, 1, 2, 1, 0, 1, 2, 1, 2, 1, 3, 1, 0, 0, 2, 1
-};
-
 static const char* const op_dissassemblies[0x100] = {
 /* 0x00 */	"NOP",		"LD BC,d16",	"LD (BC),A",	"INC BC",
 /* 0x04 */	"INC B",	"DEC B",	"LD B,d8",	"RLCA",
@@ -220,6 +199,7 @@ void gbcc_print_registers(struct gbcc_core *gbc, bool debug)
 	if (debug) {
 		print_fn = gbcc_log_debug;
 	}
+	gbcc_sync_flags(cpu);
 	print_fn("Registers:\n");
 	print_fn("\ta: %u\t\taf: %04X\n", cpu->reg.a, cpu->reg.af);
 	print_fn("\tb: %u\t\tbc: %04X\n", cpu->reg.b, cpu->reg.bc);
@@ -13,26 +13,31 @@
 #include "camera.h"
 #include "save.h"
 
+static bool at_breakpoint(struct gbcc *gbc);
+static float target_speed(const struct gbcc *gbc);
+
 void *gbcc_emulation_loop(void *_gbc)
 {
 	struct gbcc *gbc = (struct gbcc *)_gbc;
 	gbcc_load(gbc);
-	bool is_camera = gbc->core.cart.mbc.type == CAMERA;
+	gbcc_rewind_initialise(&gbc->rewind);
 	while (!gbc->quit) {
-		for (int i = 1000; i > 0; i--) {
-			/* Only check for savestates, pause etc.
-			 * every 1000 cycles */
-			gbcc_emulate_cycle(&gbc->core);
-			if (gbc->core.error) {
-				gbcc_log_error("Invalid opcode: 0x%02X\n", gbc->core.cpu.opcode);
-				gbcc_print_registers(&gbc->core, false);
-				gbc->quit = true;
-				return 0;
-			}
-			gbcc_audio_update(gbc);
-			if (is_camera) {
-				gbcc_camera_clock(gbc);
-			}
+		/* Only check for savestates, pause etc.
+		 * every 1000 cycles */
+		enum gbcc_run_reason reason;
+		if (gbc->rewind.active && gbcc_rewind_step(&gbc->rewind, &gbc->core)) {
+			/* Show the frame we've stepped back to */
+			reason = gbcc_run_frame(gbc);
+		} else {
+			uint32_t ran;
+			reason = gbcc_run_until(gbc, 1000, 0, &ran);
+			gbcc_rewind_update(&gbc->rewind, &gbc->core, ran);
+		}
+		if (reason == GBCC_RUN_ERROR) {
+			gbcc_log_error("Invalid opcode: 0x%02X\n", gbc->core.cpu.opcode);
+			gbcc_print_registers(&gbc->core, false);
+			gbc->quit = true;
+			return 0;
 		}
 		if (gbc->autosave && gbc->core.cart.mbc.sram_changed) {
 			if (time(NULL) > gbc->core.cart.mbc.last_save_time) {
@@ -53,6 +58,119 @@ void *gbcc_emulation_loop(void *_gbc)
 			gbcc_save_state(gbc);
 		}
 	}
+	gbcc_pacer_print_stats(&gbc->pacer);
+	gbcc_rewind_print_stats(&gbc->rewind);
+	gbcc_rewind_destroy(&gbc->rewind);
 	gbcc_save(gbc);
 	return 0;
 }
+
+/*
+ * Run for up to max cycles, stopping early on any of the conditions in stop
+ * (see enum gbcc_run_stop), or straight away if the core hits an error. The
+ * number of cycles actually run is stored in ran, if it isn't NULL.
+ *
+ * Audio & the camera are clocked along with the core, and the pacer kept up
+ * to date, so callers only have to look at the result once per batch.
+ */
+enum gbcc_run_reason gbcc_run_until(struct gbcc *gbc, uint32_t max, uint8_t stop, uint32_t *ran)
+{
+	struct gbcc_core *core = &gbc->core;
+	bool is_camera = core->cart.mbc.type == CAMERA;
+	/*
+	 * The camera has to be clocked every cycle, and breakpoints could be
+	 * skipped over along with a busy-wait loop.
+	 */
+	bool single_step = is_camera || (stop & GBCC_STOP_BREAKPOINT);
+	bool breakpoint = at_breakpoint(gbc);
+	uint64_t frame = core->ppu.frame;
+	uint64_t sent = core->link_cable.sent;
+	enum gbcc_run_reason reason = GBCC_RUN_DONE;
+	uint32_t i = 0;
+
+	while (i < max) {
+		uint32_t n = 1;
+		if (!single_step) {
+			/*
+			 * Cycles may be skipped in bulk, but only up to the
+			 * end of the current audio block.
+			 */
+			n = gbcc_audio_cycles_until_block(gbc);
+			if (n > max - i) {
+				n = max - i;
+			}
+		}
+		n = gbcc_emulate_cycles(core, n);
+		i += n;
+		if (core->error) {
+			reason = GBCC_RUN_ERROR;
+			break;
+		}
+		gbcc_audio_update(gbc, n);
+		gbcc_pacer_update(&gbc->pacer, n, target_speed(gbc));
+		if (is_camera) {
+			gbcc_camera_clock(gbc);
+		}
+		if ((stop & GBCC_STOP_VBLANK) && core->ppu.frame != frame) {
+			reason = GBCC_RUN_VBLANK;
+			break;
+		}
+		if ((stop & GBCC_STOP_SERIAL) && core->link_cable.sent != sent) {
+			reason = GBCC_RUN_SERIAL;
+			break;
+		}
+		if (stop & GBCC_STOP_BREAKPOINT) {
+			/* Only stop on arriving at the breakpoint, not leaving it */
+			bool was_at_breakpoint = breakpoint;
+			breakpoint = at_breakpoint(gbc);
+			if (breakpoint && !was_at_breakpoint) {
+				reason = GBCC_RUN_BREAKPOINT;
+				break;
+			}
+		}
+	}
+	if (ran) {
+		*ran = i;
+	}
+	return reason;
+}
+
+enum gbcc_run_reason gbcc_run_cycles(struct gbcc *gbc, uint32_t cycles)
+{
+	return gbcc_run_until(gbc, cycles, 0, NULL);
+}
+
+/*
+ * Run up to the start of the next VBlank, or for a frame's worth of cycles if
+ * the LCD is off.
+ */
+enum gbcc_run_reason gbcc_run_frame(struct gbcc *gbc)
+{
+	return gbcc_run_until(gbc, GBC_FRAME_CLOCKS, GBCC_STOP_VBLANK, NULL);
+}
+
+/* Whether the CPU is about to execute the instruction at the breakpoint */
+bool at_breakpoint(struct gbcc *gbc)
+{
+	struct cpu *cpu = &gbc->core.cpu;
+	return !cpu->instruction.running && cpu->reg.pc == gbc->breakpoint;
+}
+
+/*
+ * How fast the pacer should run things, or 0 if something else is already
+ * pacing emulation (or nothing should be).
+ */
+float target_speed(const struct gbcc *gbc)
+{
+	const struct gbcc_core *core = &gbc->core;
+	if (core->sync_to_audio) {
+		return 0;
+	}
+	if (core->keys.turbo) {
+		return gbc->turbo_speed;
+	}
+	if (core->sync_to_video) {
+		return 0;
+	}
+	return 1;
+}
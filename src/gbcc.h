@@ -21,9 +21,27 @@
 #include "core.h"
 #include "camera.h"
 #include "menu.h"
+#include "pacer.h"
+#include "rewind.h"
 #include "window.h"
 #include "vram_window.h"
 
+/* Why gbcc_run_until() returned */
+enum gbcc_run_reason {
+	GBCC_RUN_DONE,		/* Ran all of the requested cycles */
+	GBCC_RUN_VBLANK,
+	GBCC_RUN_BREAKPOINT,
+	GBCC_RUN_SERIAL,
+	GBCC_RUN_ERROR
+};
+
+/* Conditions gbcc_run_until() can stop early on, OR'd together */
+enum gbcc_run_stop {
+	GBCC_STOP_VBLANK = 1u << 0u,
+	GBCC_STOP_BREAKPOINT = 1u << 1u,
+	GBCC_STOP_SERIAL = 1u << 2u
+};
+
 struct gbcc {
 	struct gbcc_core core;
 	struct gbcc_window window;
@@ -31,10 +49,13 @@ struct gbcc {
 	struct gbcc_audio audio;
 	struct gbcc_menu menu;
 	struct gbcc_camera_platform camera;
+	struct gbcc_pacer pacer;
+	struct gbcc_rewind rewind;
 	
 	char save_directory[4096];
 	char default_shader[32];
 	float turbo_speed;
+	uint16_t breakpoint;	/* Only checked with GBCC_STOP_BREAKPOINT */
 	bool quit;
 	bool pause;
 	int8_t save_state;
@@ -51,5 +72,8 @@ struct gbcc {
 };
 
 void *gbcc_emulation_loop(void *_gbc);
+enum gbcc_run_reason gbcc_run_until(struct gbcc *gbc, uint32_t max, uint8_t stop, uint32_t *ran);
+enum gbcc_run_reason gbcc_run_cycles(struct gbcc *gbc, uint32_t cycles);
+enum gbcc_run_reason gbcc_run_frame(struct gbcc *gbc);
 
 #endif /* GBCC_H */
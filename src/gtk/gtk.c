@@ -518,6 +518,7 @@ void change_palette(GtkWidget *widget, void *data)
 	struct gbcc *gbc = &gtk->gbc;
 	const gchar *name = gtk_menu_item_get_label(GTK_MENU_ITEM(widget));
 	gbc->core.ppu.palette = gbcc_get_palette(name);
+	gbcc_ppu_update_colours(&gbc->core);
 }
 
 void toggle_vram_display(GtkCheckMenuItem *widget, void *data)
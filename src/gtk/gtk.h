@@ -33,7 +33,7 @@ struct gbcc_gtk {
 	GtkWidget *gl_area;
 	GtkWidget *vram_gl_area;
 	GList *icons;
-	guint keymap[51];
+	guint keymap[54];
 	struct {
 		GtkWidget *bar;
 		GtkWidget *stop;
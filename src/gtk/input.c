@@ -11,7 +11,7 @@
 #include "input.h"
 #include <gdk/gdk.h>
 
-guint default_keymap[53] = {
+guint default_keymap[54] = {
 	GDK_KEY_z,
 	GDK_KEY_x,
 	GDK_KEY_Return,
@@ -65,5 +65,6 @@ guint default_keymap[53] = {
 	GDK_KEY_F7,
 	GDK_KEY_F8,
 	GDK_KEY_F9,
+	GDK_KEY_BackSpace,
 };
 
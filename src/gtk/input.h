@@ -13,6 +13,6 @@
 
 #include <gdk/gdk.h>
 
-extern guint default_keymap[53];
+extern guint default_keymap[54];
 
 #endif /* GBCC_GTK_INPUT_H */
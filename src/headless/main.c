@@ -21,12 +21,12 @@ int main(int argc, char **argv)
 		exit(EXIT_FAILURE);
 	}
 
+	/* Unlimited turbo, which also means no audio is generated */
 	gbc.core.keys.turbo = true;
+	gbc.turbo_speed = 0;
 	gbc.has_focus = true;
 
-	for (size_t cycles = 10000; cycles > 0; cycles--) {
-		gbcc_emulate_cycle(&gbc.core);
-	}
+	gbcc_run_cycles(&gbc, 10000);
 
 	exit(EXIT_SUCCESS);
 }
@@ -0,0 +1,187 @@
+/*
+ * Copyright (C) 2017-2020 Philip Jones
+ *
+ * Licensed under the MIT License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/licenses/MIT
+ *
+ */
+
+#include "core.h"
+#include "debug.h"
+#include "icache.h"
+#include "memory.h"
+#include "ops.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+static struct gbcc_icache_entry *lookup(struct gbcc_core *gbc, uint16_t addr);
+static struct gbcc_icache_entry *rom_bank(struct gbcc_core *gbc, const uint8_t *bank);
+static void decode(struct gbcc_icache_entry *entry, uint8_t opcode);
+
+struct gbcc_icache *gbcc_icache_create(size_t num_rom_banks)
+{
+	struct gbcc_icache *icache = calloc(1, sizeof(*icache));
+	if (!icache) {
+		return NULL;
+	}
+	icache->rom_banks = calloc(num_rom_banks, sizeof(*icache->rom_banks));
+	if (!icache->rom_banks) {
+		free(icache);
+		return NULL;
+	}
+	icache->num_rom_banks = num_rom_banks;
+	return icache;
+}
+
+void gbcc_icache_destroy(struct gbcc_icache *icache)
+{
+	if (!icache) {
+		return;
+	}
+	for (size_t i = 0; i < icache->num_rom_banks; i++) {
+		free(icache->rom_banks[i]);
+	}
+	free(icache->rom_banks);
+	free(icache);
+}
+
+/*
+ * Drop everything that depends on the contents of RAM, e.g. after loading a
+ * savestate. ROM can't change, so the decoded banks are kept.
+ */
+void gbcc_icache_flush(struct gbcc_icache *icache)
+{
+	gbcc_icache_flush_some(icache, 0xFFu);
+}
+
+/*
+ * As gbcc_icache_flush(), but only dropping the WRAM banks whose bits are set
+ * in wram_banks. Clearing every bank takes longer than the rest of loading a
+ * savestate, and most banks usually haven't changed.
+ */
+void gbcc_icache_flush_some(struct gbcc_icache *icache, uint8_t wram_banks)
+{
+	for (uint8_t i = 0; i < 8; i++) {
+		if (wram_banks & (1u << i)) {
+			memset(icache->wram[i], 0, sizeof(icache->wram[i]));
+		}
+	}
+	memset(icache->hram, 0, sizeof(icache->hram));
+	icache->rom0 = NULL;
+	icache->romx = NULL;
+}
+
+/* Called whenever the MBC changes which banks are mapped in */
+void gbcc_icache_remap_rom(struct gbcc_core *gbc)
+{
+	gbc->icache->rom0 = NULL;
+	gbc->icache->romx = NULL;
+}
+
+void gbcc_icache_invalidate_wram(struct gbcc_core *gbc, const uint8_t *byte)
+{
+	size_t idx = (size_t)(byte - gbc->memory.wram_bank[0]);
+	gbc->icache->wram[idx / WRAM0_SIZE][idx % WRAM0_SIZE].valid = false;
+}
+
+void gbcc_icache_invalidate_hram(struct gbcc_core *gbc, uint16_t addr)
+{
+	gbc->icache->hram[addr - HRAM_START].valid = false;
+}
+
+/*
+ * Equivalent to gbcc_fetch_instruction(), but returns the decoded
+ * instruction rather than just the opcode.
+ */
+const struct gbcc_icache_entry *gbcc_icache_fetch(struct gbcc_core *gbc)
+{
+	struct cpu *cpu = &gbc->cpu;
+	struct gbcc_icache_entry *entry = lookup(gbc, cpu->reg.pc);
+	if (!entry) {
+		entry = &gbc->icache->uncached;
+		decode(entry, gbcc_fetch_instruction(gbc));
+		return entry;
+	}
+	if (!entry->valid) {
+		decode(entry, gbcc_memory_read(gbc, cpu->reg.pc));
+	}
+	if (cpu->halt.skip) {
+		/* HALT bug; CPU fails to increment pc */
+		cpu->halt.skip = false;
+	} else {
+		cpu->reg.pc++;
+	}
+	return entry;
+}
+
+struct gbcc_icache_entry *lookup(struct gbcc_core *gbc, uint16_t addr)
+{
+	struct gbcc_icache *icache = gbc->icache;
+	if (addr < ROMX_END) {
+		/*
+		 * Game Genie codes patch ROM as it's read, and MBC6 isn't
+		 * mapped through the usual bank pointers.
+		 */
+		if (gbc->cheats.enabled || gbc->cart.mbc.type == MBC6) {
+			return NULL;
+		}
+		if (addr < ROM0_END) {
+			if (!icache->rom0) {
+				icache->rom0 = rom_bank(gbc, gbc->memory.rom0);
+				if (!icache->rom0) {
+					return NULL;
+				}
+			}
+			return &icache->rom0[addr - ROM0_START];
+		}
+		if (!icache->romx) {
+			icache->romx = rom_bank(gbc, gbc->memory.romx);
+			if (!icache->romx) {
+				return NULL;
+			}
+		}
+		return &icache->romx[addr - ROMX_START];
+	}
+	if (addr >= WRAM0_START && addr < WRAMX_END) {
+		const uint8_t *byte;
+		if (addr < WRAMX_START) {
+			byte = &gbc->memory.wram0[addr - WRAM0_START];
+		} else {
+			byte = &gbc->memory.wramx[addr - WRAMX_START];
+		}
+		size_t idx = (size_t)(byte - gbc->memory.wram_bank[0]);
+		return &icache->wram[idx / WRAM0_SIZE][idx % WRAM0_SIZE];
+	}
+	if (addr >= HRAM_START && addr < HRAM_END) {
+		return &icache->hram[addr - HRAM_START];
+	}
+	return NULL;
+}
+
+struct gbcc_icache_entry *rom_bank(struct gbcc_core *gbc, const uint8_t *bank)
+{
+	struct gbcc_icache *icache = gbc->icache;
+	size_t n = (size_t)(bank - gbc->cart.rom) / ROM0_SIZE;
+	if (n >= icache->num_rom_banks) {
+		gbcc_log_debug("Invalid rom bank %zu.\n", n);
+		return NULL;
+	}
+	if (!icache->rom_banks[n]) {
+		/* If this fails, we just carry on uncached */
+		icache->rom_banks[n] = calloc(ROM0_SIZE, sizeof(*icache->rom_banks[n]));
+	}
+	return icache->rom_banks[n];
+}
+
+void decode(struct gbcc_icache_entry *entry, uint8_t opcode)
+{
+	entry->handler = gbcc_ops[opcode];
+	entry->opcode = opcode;
+	entry->length = gbcc_op_sizes[opcode];
+	entry->mod = opcode & 0x07u;
+	entry->div = (opcode >> 3u) & 0x07u;
+	entry->valid = true;
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2017-2020 Philip Jones
+ *
+ * Licensed under the MIT License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/licenses/MIT
+ *
+ */
+
+#ifndef GBCC_ICACHE_H
+#define GBCC_ICACHE_H
+
+#include "constants.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+struct gbcc_core;
+
+/*
+ * Decoded-instruction cache.
+ *
+ * Instructions are decoded the first time they're executed from a given
+ * location, and the result is reused until that location changes. ROM is
+ * cached per physical bank, so bank switches only need to remap the current
+ * windows, while WRAM & HRAM entries are dropped whenever they're written to.
+ * Code anywhere else is just decoded each time.
+ *
+ * This deliberately stops short of translating whole blocks. Every memory
+ * access an instruction makes lands on its own M-cycle, with the PPU, timers
+ * and APU run in between, so a block that only settled its cycles on exit
+ * would change what the game can observe. The optional recompiler (see
+ * jit.h) only covers code that never touches memory for that reason.
+ */
+
+struct gbcc_icache_entry {
+	void (*handler)(struct gbcc_core *gbc);
+	uint8_t opcode;
+	uint8_t length;	/* In bytes, including the opcode */
+	uint8_t mod;	/* Operand selected by bits 0-2 */
+	uint8_t div;	/* Operand selected by bits 3-5 */
+	bool valid;
+};
+
+struct gbcc_icache {
+	struct gbcc_icache_entry **rom_banks;	/* Allocated on first use */
+	size_t num_rom_banks;
+	struct gbcc_icache_entry *rom0;		/* Currently mapped banks */
+	struct gbcc_icache_entry *romx;
+	struct gbcc_icache_entry wram[8][WRAM0_SIZE];
+	struct gbcc_icache_entry hram[HRAM_SIZE];
+	struct gbcc_icache_entry uncached;
+};
+
+struct gbcc_icache *gbcc_icache_create(size_t num_rom_banks);
+void gbcc_icache_destroy(struct gbcc_icache *icache);
+void gbcc_icache_flush(struct gbcc_icache *icache);
+void gbcc_icache_flush_some(struct gbcc_icache *icache, uint8_t wram_banks);
+void gbcc_icache_remap_rom(struct gbcc_core *gbc);
+void gbcc_icache_invalidate_wram(struct gbcc_core *gbc, const uint8_t *byte);
+void gbcc_icache_invalidate_hram(struct gbcc_core *gbc, uint16_t addr);
+const struct gbcc_icache_entry *gbcc_icache_fetch(struct gbcc_core *gbc);
+
+#endif /* GBCC_ICACHE_H */
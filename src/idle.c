@@ -0,0 +1,391 @@
+/*
+ * Copyright (C) 2017-2020 Philip Jones
+ *
+ * Licensed under the MIT License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/licenses/MIT
+ *
+ */
+
+#include "core.h"
+#include "bit_utils.h"
+#include "idle.h"
+#include "scheduler.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Registers & flags read or written by an instruction. The registers are
+ * numbered the same way as the operand fields of the opcodes, so that
+ * bit16(mod) is the register selected by mod (other than 6, which is (HL)).
+ */
+#define REG_B bit16(0)
+#define REG_C bit16(1)
+#define REG_D bit16(2)
+#define REG_E bit16(3)
+#define REG_H bit16(4)
+#define REG_L bit16(5)
+#define REG_A bit16(7)
+#define FLAG_Z bit16(8)
+#define FLAG_C bit16(9)
+
+struct loop_op {
+	uint16_t reads;
+	uint16_t writes;
+	uint16_t addr_regs;	/* Registers used to form a memory address */
+	uint16_t addr;
+	uint8_t length;
+	uint8_t cycles;
+	bool mem;
+};
+
+static uint8_t analyse(struct gbcc_core *gbc, uint16_t head, uint16_t branch);
+static bool describe(struct gbcc_core *gbc, uint16_t pc, struct loop_op *op);
+static void describe_alu(uint8_t opcode, struct loop_op *op);
+static bool peek(struct gbcc_core *gbc, uint16_t addr, uint8_t *val);
+static bool stable(struct gbcc_core *gbc, uint16_t addr);
+
+/* Called whenever a jump is taken, from the instruction at branch */
+void gbcc_idle_jump(struct gbcc_core *gbc, uint16_t branch, uint16_t head)
+{
+	struct gbcc_idle *idle = &gbc->idle;
+	uint64_t now = gbc->scheduler.now;
+	const uint8_t *page = gbc->memory.read_page[head >> 12u];
+
+	idle->armed = false;
+	if (head > branch || branch - head > GBCC_IDLE_MAX_LOOP_SIZE) {
+		return;
+	}
+	if (!page || gbc->cheats.enabled) {
+		idle->code = NULL;
+		return;
+	}
+	const uint8_t *code = &page[head & 0x0FFFu];
+	if (code != idle->code || branch != idle->branch) {
+		idle->code = code;
+		idle->branch = branch;
+		idle->length = analyse(gbc, head, branch);
+	} else if (idle->length > 0) {
+		uint64_t period = (16u * idle->length) >> gbc->cpu.double_speed;
+		if (now - idle->time == period && idle->next > now) {
+			idle->armed = true;
+		} else {
+			/*
+			 * Something else ran in between, so the registers
+			 * used for addresses may have changed.
+			 */
+			idle->length = analyse(gbc, head, branch);
+		}
+	}
+	idle->time = now;
+	idle->next = gbc->scheduler.next;
+}
+
+/*
+ * Number of cycles that can be skipped right now because the CPU is going
+ * round a busy-wait loop, rounded down to a whole number of iterations.
+ */
+uint32_t gbcc_idle_cycles(struct gbcc_core *gbc, uint32_t max)
+{
+	struct gbcc_idle *idle = &gbc->idle;
+	struct cpu *cpu = &gbc->cpu;
+	uint64_t now = gbc->scheduler.now;
+	if (!idle->armed) {
+		return 0;
+	}
+	idle->armed = false;
+	/* The loop must have gone round during the cycle that just finished */
+	if ((now | 3u) != (idle->time | 3u) || idle->next <= now) {
+		return 0;
+	}
+	/* Nothing else can be going on in the background */
+	if (cpu->ime_timer.timer > 0 || cpu->interrupt.running
+			|| cpu->dma.timer > 0 || cpu->dma.requested
+			|| cpu->dma.running || gbc->hdma.to_copy > 0) {
+		return 0;
+	}
+	if (gbc->pending_interrupts || gbc->keys.interrupt) {
+		return 0;
+	}
+	uint32_t period = (4u * idle->length) >> cpu->double_speed;
+	uint32_t n = gbcc_scheduler_quiet_cycles(gbc, max);
+	n -= n % period;
+	idle->time += 4 * (uint64_t)n;
+	return n;
+}
+
+/*
+ * Returns the length of one iteration of the loop in M-cycles, or 0 if it
+ * can't be skipped.
+ */
+uint8_t analyse(struct gbcc_core *gbc, uint16_t head, uint16_t branch)
+{
+	uint16_t reads = 0;
+	uint16_t writes = 0;
+	uint16_t addr_regs = 0;
+	uint8_t cycles = 0;
+	uint16_t pc = head;
+	struct loop_op op;
+
+	while (pc != branch) {
+		if ((uint16_t)(branch - pc) > GBCC_IDLE_MAX_LOOP_SIZE) {
+			return 0;
+		}
+		if (!describe(gbc, pc, &op)) {
+			return 0;
+		}
+		if (op.mem && !stable(gbc, op.addr)) {
+			return 0;
+		}
+		/* Only reads of values left over from last time count */
+		reads |= op.reads & ~writes;
+		writes |= op.writes;
+		addr_regs |= op.addr_regs;
+		cycles += op.cycles;
+		pc += op.length;
+	}
+
+	uint8_t opcode;
+	if (!peek(gbc, branch, &opcode)) {
+		return 0;
+	}
+	switch (opcode) {
+		case 0x18u:	/* JR */
+			cycles += 3;
+			break;
+		case 0x20u:	/* JR NZ */
+		case 0x28u:	/* JR Z */
+			reads |= FLAG_Z & ~writes;
+			cycles += 3;
+			break;
+		case 0x30u:	/* JR NC */
+		case 0x38u:	/* JR C */
+			reads |= FLAG_C & ~writes;
+			cycles += 3;
+			break;
+		case 0xC3u:	/* JP */
+			cycles += 4;
+			break;
+		case 0xC2u:	/* JP NZ */
+		case 0xCAu:	/* JP Z */
+			reads |= FLAG_Z & ~writes;
+			cycles += 4;
+			break;
+		case 0xD2u:	/* JP NC */
+		case 0xDAu:	/* JP C */
+			reads |= FLAG_C & ~writes;
+			cycles += 4;
+			break;
+		default:
+			return 0;
+	}
+
+	/*
+	 * Each iteration has to start from the same state as the last, so
+	 * it can't depend on anything it changes itself.
+	 */
+	if ((reads & writes) || (addr_regs & writes)) {
+		return 0;
+	}
+	return cycles;
+}
+
+/*
+ * Fill in op for the instruction at pc, if it's one that only reads memory
+ * and registers. Returns false for anything else.
+ */
+bool describe(struct gbcc_core *gbc, uint16_t pc, struct loop_op *op)
+{
+	struct cpu *cpu = &gbc->cpu;
+	uint8_t opcode;
+	uint8_t imm1 = 0;
+	uint8_t imm2 = 0;
+
+	*op = (struct loop_op){0};
+	if (!peek(gbc, pc, &opcode)) {
+		return false;
+	}
+	/* Immediate operands, if there are any */
+	peek(gbc, pc + 1, &imm1);
+	peek(gbc, pc + 2, &imm2);
+
+	uint8_t mod = opcode & 0x07u;
+	uint8_t div = (opcode >> 3u) & 0x07u;
+
+	if (opcode >= 0x40u && opcode < 0x80u) {
+		/* LD r, r' (but not stores or HALT) */
+		if (div == 6) {
+			return false;
+		}
+		op->length = 1;
+		op->writes = bit16(div);
+		if (mod == 6) {
+			op->mem = true;
+			op->addr = cpu->reg.hl;
+			op->addr_regs = REG_H | REG_L;
+			op->cycles = 2;
+		} else {
+			op->reads = bit16(mod);
+			op->cycles = 1;
+		}
+		return true;
+	}
+	if (opcode >= 0x80u && opcode < 0xC0u) {
+		/* ALU A, r */
+		describe_alu(opcode, op);
+		op->length = 1;
+		if (mod == 6) {
+			op->mem = true;
+			op->addr = cpu->reg.hl;
+			op->addr_regs = REG_H | REG_L;
+			op->cycles = 2;
+		} else {
+			op->reads |= bit16(mod);
+			op->cycles = 1;
+		}
+		return true;
+	}
+	if (opcode >= 0xC0u && mod == 6) {
+		/* ALU A, d8 */
+		describe_alu(opcode, op);
+		op->length = 2;
+		op->cycles = 2;
+		return true;
+	}
+	if (opcode < 0x40u && mod == 6 && div != 6) {
+		/* LD r, d8 */
+		op->writes = bit16(div);
+		op->length = 2;
+		op->cycles = 2;
+		return true;
+	}
+
+	switch (opcode) {
+		case 0x00u:	/* NOP */
+			op->length = 1;
+			op->cycles = 1;
+			return true;
+		case 0x0Au:	/* LD A, (BC) */
+			op->mem = true;
+			op->addr = cpu->reg.bc;
+			op->addr_regs = REG_B | REG_C;
+			op->writes = REG_A;
+			op->length = 1;
+			op->cycles = 2;
+			return true;
+		case 0x1Au:	/* LD A, (DE) */
+			op->mem = true;
+			op->addr = cpu->reg.de;
+			op->addr_regs = REG_D | REG_E;
+			op->writes = REG_A;
+			op->length = 1;
+			op->cycles = 2;
+			return true;
+		case 0x2Fu:	/* CPL */
+			op->reads = REG_A;
+			op->writes = REG_A;
+			op->length = 1;
+			op->cycles = 1;
+			return true;
+		case 0xF0u:	/* LDH A, (a8) */
+			op->mem = true;
+			op->addr = IOREG_START + imm1;
+			op->writes = REG_A;
+			op->length = 2;
+			op->cycles = 3;
+			return true;
+		case 0xF2u:	/* LDH A, (C) */
+			op->mem = true;
+			op->addr = IOREG_START + cpu->reg.c;
+			op->addr_regs = REG_C;
+			op->writes = REG_A;
+			op->length = 1;
+			op->cycles = 2;
+			return true;
+		case 0xFAu:	/* LD A, (a16) */
+			op->mem = true;
+			op->addr = cat_bytes(imm1, imm2);
+			op->writes = REG_A;
+			op->length = 3;
+			op->cycles = 4;
+			return true;
+		case 0xCBu:
+			/* BIT b, r */
+			if (imm1 < 0x40u || imm1 >= 0x80u) {
+				return false;
+			}
+			op->writes = FLAG_Z;
+			op->length = 2;
+			if ((imm1 & 0x07u) == 6) {
+				op->mem = true;
+				op->addr = cpu->reg.hl;
+				op->addr_regs = REG_H | REG_L;
+				op->cycles = 3;
+			} else {
+				op->reads = bit16(imm1 & 0x07u);
+				op->cycles = 2;
+			}
+			return true;
+	}
+	return false;
+}
+
+void describe_alu(uint8_t opcode, struct loop_op *op)
+{
+	uint8_t alu = (opcode >> 3u) & 0x07u;
+	op->reads = REG_A;
+	op->writes = FLAG_Z | FLAG_C;
+	/* ADC & SBC use the carry */
+	if (alu == 1 || alu == 3) {
+		op->reads |= FLAG_C;
+	}
+	/* CP leaves A alone */
+	if (alu != 7) {
+		op->writes |= REG_A;
+	}
+}
+
+/* Read without side effects, only from memory that's mapped directly */
+bool peek(struct gbcc_core *gbc, uint16_t addr, uint8_t *val)
+{
+	const uint8_t *page = gbc->memory.read_page[addr >> 12u];
+	if (!page) {
+		return false;
+	}
+	*val = page[addr & 0x0FFFu];
+	return true;
+}
+
+/*
+ * Whether a read from addr has no side effects, and always returns the same
+ * value until either the CPU writes to it, or the next scheduled event.
+ */
+bool stable(struct gbcc_core *gbc, uint16_t addr)
+{
+	if (addr < ROMX_END) {
+		return gbc->memory.read_page[addr >> 12u] != NULL;
+	}
+	if (addr >= VRAM_START && addr < VRAM_END) {
+		return true;
+	}
+	if (addr >= WRAM0_START && addr < ECHO_END) {
+		return true;
+	}
+	if (addr >= HRAM_START) {
+		/* HRAM & IE */
+		return true;
+	}
+	switch (addr) {
+		case IF:
+		case TIMA:
+		case TMA:
+		case TAC:
+		case LCDC:
+		case STAT:
+		case LY:
+		case LYC:
+			return true;
+	}
+	return false;
+}
@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2017-2020 Philip Jones
+ *
+ * Licensed under the MIT License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/licenses/MIT
+ *
+ */
+
+#ifndef GBCC_IDLE_H
+#define GBCC_IDLE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct gbcc_core;
+
+/* Longest loop body worth looking at, in bytes */
+#define GBCC_IDLE_MAX_LOOP_SIZE 16
+
+/*
+ * Busy-wait loop detection.
+ *
+ * Lots of games wait for LY, STAT or a flag in RAM by polling it in a tight
+ * loop, rather than using HALT. Whenever a backward jump is taken, the loop
+ * it closes is checked to see whether it only reads memory that can't change
+ * before the next scheduled event, and doesn't change any state the next
+ * iteration depends on. Once such a loop has been seen to go round with
+ * nothing else happening, every following iteration up to the next event
+ * would be identical, so they can be skipped in one go.
+ */
+
+struct gbcc_idle {
+	const uint8_t *code;	/* Location of the loop head in memory */
+	uint64_t time;		/* Time the loop last went round */
+	uint64_t next;		/* Next scheduler deadline at that time */
+	uint16_t branch;	/* Address of the jump closing the loop */
+	uint8_t length;		/* In M-cycles, or 0 if it can't be skipped */
+	bool armed;
+};
+
+void gbcc_idle_jump(struct gbcc_core *gbc, uint16_t branch, uint16_t head);
+uint32_t gbcc_idle_cycles(struct gbcc_core *gbc, uint32_t max);
+
+#endif /* GBCC_IDLE_H */
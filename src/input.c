@@ -56,7 +56,6 @@ void gbcc_input_process_key(struct gbcc *gbc, enum gbcc_key key, bool pressed)
 			break;
 		case GBCC_KEY_TURBO:
 			gbc->core.keys.turbo ^= pressed;
-			gbc->audio.index *= pressed;
 			break;
 		case GBCC_KEY_SCREENSHOT:
 			gbc->window.screenshot ^= pressed;
@@ -97,7 +96,6 @@ void gbcc_input_process_key(struct gbcc *gbc, enum gbcc_key key, bool pressed)
 			if (!pressed) {
 				break;
 			}
-			gbc->audio.index = 0;
 			if (gbc->core.sync_to_video) {
 				gbcc_window_show_message(gbc, "Vsync enabled", 1, true);
 			} else {
@@ -271,6 +269,15 @@ void gbcc_input_process_key(struct gbcc *gbc, enum gbcc_key key, bool pressed)
 			}
 			gbc->load_state = (int8_t)(key - GBCC_KEY_LOAD_STATE_1 + 1);
 			break;
+		case GBCC_KEY_REWIND:
+			if (gbc->rewind.budget == 0) {
+				if (pressed) {
+					gbcc_window_show_message(gbc, "Rewind disabled", 1, true);
+				}
+				break;
+			}
+			gbc->rewind.active = pressed;
+			break;
 	}
 }
 
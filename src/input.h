@@ -69,7 +69,8 @@ enum gbcc_key {
 	GBCC_KEY_LOAD_STATE_6,
 	GBCC_KEY_LOAD_STATE_7,
 	GBCC_KEY_LOAD_STATE_8,
-	GBCC_KEY_LOAD_STATE_9
+	GBCC_KEY_LOAD_STATE_9,
+	GBCC_KEY_REWIND
 };
 
 void gbcc_input_process_key(struct gbcc *gbc, enum gbcc_key key, bool pressed);
@@ -0,0 +1,35 @@
+/*
+ * Copyright (C) 2017-2020 Philip Jones
+ *
+ * Licensed under the MIT License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/licenses/MIT
+ *
+ */
+
+#include "core.h"
+#include "bit_utils.h"
+#include "interrupt.h"
+#include <stdint.h>
+
+/* Set the IF bit for interrupt n */
+void gbcc_interrupt_request(struct gbcc_core *gbc, uint8_t n)
+{
+	gbc->memory.ioreg[IF - IOREG_START] |= bit(n);
+	gbcc_interrupt_update(gbc);
+}
+
+/* Clear the IF bit for interrupt n, e.g. once it's been serviced */
+void gbcc_interrupt_clear(struct gbcc_core *gbc, uint8_t n)
+{
+	gbc->memory.ioreg[IF - IOREG_START] &= (uint8_t)~bit(n);
+	gbcc_interrupt_update(gbc);
+}
+
+/* Called whenever IE or IF have been written to directly */
+void gbcc_interrupt_update(struct gbcc_core *gbc)
+{
+	uint8_t ifreg = gbc->memory.ioreg[IF - IOREG_START];
+	gbc->pending_interrupts = gbc->memory.iereg & ifreg & 0x1Fu;
+}
@@ -0,0 +1,33 @@
+/*
+ * Copyright (C) 2017-2020 Philip Jones
+ *
+ * Licensed under the MIT License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/licenses/MIT
+ *
+ */
+
+#ifndef GBCC_INTERRUPT_H
+#define GBCC_INTERRUPT_H
+
+#include <stdint.h>
+
+struct gbcc_core;
+
+/*
+ * Interrupt controller.
+ *
+ * The CPU needs to know whether any interrupt is both requested & enabled on
+ * every cycle, so rather than reading IE & IF each time, the result is kept
+ * in gbc->pending_interrupts. Everything that changes either register must go
+ * through here (or the normal memory write path) to keep it up to date.
+ *
+ * Interrupts are numbered by their bit in IE & IF, 0 (VBlank) to 4 (Joypad).
+ */
+
+void gbcc_interrupt_request(struct gbcc_core *gbc, uint8_t n);
+void gbcc_interrupt_clear(struct gbcc_core *gbc, uint8_t n);
+void gbcc_interrupt_update(struct gbcc_core *gbc);
+
+#endif /* GBCC_INTERRUPT_H */
@@ -0,0 +1,790 @@
+/*
+ * Copyright (C) 2017-2020 Philip Jones
+ *
+ * Licensed under the MIT License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/licenses/MIT
+ *
+ */
+
+#include "core.h"
+#include "bit_utils.h"
+#include "constants.h"
+#include "debug.h"
+#include "idle.h"
+#include "jit.h"
+#include "ops.h"
+#include "scheduler.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+/* Executable memory shared by every block, flushed when it runs out */
+#define CODE_SIZE (4u * 1024u * 1024u)
+/* Most instructions translated into one block */
+#define MAX_BLOCK_OPS 16
+/* Upper bound on the native code for one block, at under 100 bytes per op */
+#define MAX_BLOCK_CODE 2048u
+/* Times a block has to be reached before it's translated */
+#define HOT_THRESHOLD 4
+
+/* Offset of a register in struct cpu, which the generated code is passed */
+#define REG(r) ((uint8_t)offsetof(struct cpu, reg.r))
+
+/* x86 registers, all of which can be clobbered by the generated code */
+#define EAX 0u
+#define ECX 1u
+#define EDX 2u
+#define ESI 6u
+#define RDI 7u
+
+/* Opcode extensions of the x86 group 1 (ALU) & group 2 (shift) ops */
+#define X86_OR 1u
+#define X86_AND 4u
+#define X86_XOR 6u
+#define X86_SHL 4u
+#define X86_SHR 5u
+
+/* Size of the code emitted by emit_exit() */
+#define EXIT_SIZE 12u
+
+struct emitter {
+	uint8_t *buf;
+	size_t len;
+};
+
+static struct gbcc_jit_block *find_block(struct gbcc_core *gbc);
+static struct gbcc_jit_block *rom_bank(struct gbcc_core *gbc, const uint8_t *bank);
+static void translate(struct gbcc_jit *jit, struct gbcc_jit_block *block, const uint8_t *code, size_t size, uint16_t pc);
+static uint8_t translate_op(struct emitter *e, const uint8_t *op);
+static uint8_t translate_alu(struct emitter *e, uint8_t alu, uint8_t src, const uint8_t *imm);
+static uint8_t translate_cb(struct emitter *e, uint8_t op);
+static uint8_t translate_jump(struct emitter *e, const uint8_t *op, uint16_t addr, uint16_t head, uint8_t cycles);
+static uint8_t reg8(uint8_t r);
+static uint8_t reg16(uint8_t opcode);
+static void flush(struct gbcc_jit *jit);
+static void emit(struct emitter *e, uint8_t byte);
+static void emit16(struct emitter *e, uint16_t val);
+static void emit32(struct emitter *e, uint32_t val);
+static void emit_rr(struct emitter *e, uint8_t op, uint8_t src, uint8_t dst);
+static void emit_mem(struct emitter *e, uint8_t reg, uint8_t off);
+static void emit_imm(struct emitter *e, uint8_t ext, uint8_t reg, uint32_t imm);
+static void emit_shift(struct emitter *e, uint8_t ext, uint8_t reg, uint8_t n);
+static void emit_setcc(struct emitter *e, uint8_t cc, uint8_t reg);
+static void emit_movzx(struct emitter *e, uint8_t reg);
+static void load8(struct emitter *e, uint8_t reg, uint8_t off);
+static void load16(struct emitter *e, uint8_t reg, uint8_t off);
+static void store8(struct emitter *e, uint8_t off, uint8_t reg);
+static void store16(struct emitter *e, uint8_t off, uint8_t reg);
+static void mem_imm8(struct emitter *e, uint8_t ext, uint8_t off, uint8_t imm);
+static void carry_in(struct emitter *e);
+static void flags_out(struct emitter *e, uint8_t take, uint8_t set, uint8_t keep);
+static void emit_exit(struct emitter *e, uint16_t pc, uint8_t cycles);
+
+struct gbcc_jit *gbcc_jit_create(size_t num_rom_banks)
+{
+	struct gbcc_jit *jit = calloc(1, sizeof(*jit));
+	if (!jit) {
+		return NULL;
+	}
+	jit->rom_banks = calloc(num_rom_banks, sizeof(*jit->rom_banks));
+	if (!jit->rom_banks) {
+		free(jit);
+		return NULL;
+	}
+	jit->code = mmap(NULL, CODE_SIZE, PROT_READ | PROT_EXEC,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (jit->code == MAP_FAILED) {
+		free(jit->rom_banks);
+		free(jit);
+		return NULL;
+	}
+	jit->num_rom_banks = num_rom_banks;
+	return jit;
+}
+
+void gbcc_jit_destroy(struct gbcc_jit *jit)
+{
+	if (!jit) {
+		return;
+	}
+	for (size_t i = 0; i < jit->num_rom_banks; i++) {
+		free(jit->rom_banks[i]);
+	}
+	free(jit->rom_banks);
+	munmap(jit->code, CODE_SIZE);
+	free(jit);
+}
+
+/*
+ * Run translated code for up to max cycles, returning how many were run, or
+ * 0 if the interpreter has to take the next instruction.
+ */
+uint32_t gbcc_jit_cycles(struct gbcc_core *gbc, uint32_t max)
+{
+	struct gbcc_jit *jit = gbc->jit;
+	struct cpu *cpu = &gbc->cpu;
+	if (!jit || jit->broken || max < 2 || cpu->instruction.running) {
+		return 0;
+	}
+	/* Only the next instruction can happen in the meantime */
+	if (cpu->halt.set || cpu->halt.skip || cpu->stop
+			|| cpu->ime_timer.timer > 0 || cpu->interrupt.running
+			|| cpu->dma.timer > 0 || cpu->dma.requested
+			|| cpu->dma.running || gbc->hdma.to_copy > 0) {
+		return 0;
+	}
+	if (gbc->pending_interrupts || gbc->keys.interrupt) {
+		return 0;
+	}
+	struct gbcc_jit_block *block = find_block(gbc);
+	if (!block) {
+		return 0;
+	}
+	/* In M-cycles, all of which have to pass before the next event */
+	uint32_t budget = (gbcc_scheduler_quiet_cycles(gbc, max) << cpu->double_speed) / 4;
+	uint32_t cycles = 0;
+	if (block->cycles > budget) {
+		return 0;
+	}
+	gbcc_sync_flags(cpu);
+	do {
+		cycles += block->code(cpu);
+		block = find_block(gbc);
+	} while (block && cycles + block->cycles <= budget);
+	return (4 * cycles) >> cpu->double_speed;
+}
+
+/*
+ * The translated block starting at pc, if there is one. Otherwise, this
+ * counts towards translating it.
+ */
+struct gbcc_jit_block *find_block(struct gbcc_core *gbc)
+{
+	struct gbcc_jit *jit = gbc->jit;
+	uint16_t pc = gbc->cpu.reg.pc;
+	if (pc >= ROMX_END) {
+		return NULL;
+	}
+	/*
+	 * Game Genie codes patch ROM as it's read, and MBC6 isn't mapped
+	 * through the usual bank pointers.
+	 */
+	if (gbc->cheats.enabled || gbc->cart.mbc.type == MBC6) {
+		return NULL;
+	}
+	const uint8_t *bank = pc < ROM0_END ? gbc->memory.rom0 : gbc->memory.romx;
+	struct gbcc_jit_block *blocks = rom_bank(gbc, bank);
+	if (!blocks) {
+		return NULL;
+	}
+	uint16_t offset = pc % ROM0_SIZE;
+	struct gbcc_jit_block *block = &blocks[offset];
+	if (block->code) {
+		return block;
+	}
+	if (block->failed || ++block->heat < HOT_THRESHOLD) {
+		return NULL;
+	}
+	translate(jit, block, bank + offset, ROM0_SIZE - offset, pc);
+	return block->code ? block : NULL;
+}
+
+struct gbcc_jit_block *rom_bank(struct gbcc_core *gbc, const uint8_t *bank)
+{
+	struct gbcc_jit *jit = gbc->jit;
+	size_t n = (size_t)(bank - gbc->cart.rom) / ROM0_SIZE;
+	if (n >= jit->num_rom_banks) {
+		return NULL;
+	}
+	if (!jit->rom_banks[n]) {
+		/* If this fails, we just carry on interpreting */
+		jit->rom_banks[n] = calloc(ROM0_SIZE, sizeof(*jit->rom_banks[n]));
+	}
+	return jit->rom_banks[n];
+}
+
+/*
+ * Translate the block at pc, where code points to its first byte and size is
+ * the number of bytes left in the bank from there.
+ */
+void translate(struct gbcc_jit *jit, struct gbcc_jit_block *block, const uint8_t *code, size_t size, uint16_t pc)
+{
+	if (jit->used + MAX_BLOCK_CODE > CODE_SIZE) {
+		flush(jit);
+	}
+	if (mprotect(jit->code, CODE_SIZE, PROT_READ | PROT_WRITE) != 0) {
+		gbcc_log_error("Failed to unprotect recompiler code, disabling it.\n");
+		jit->broken = true;
+		return;
+	}
+	struct emitter e = { .buf = jit->code + jit->used, .len = 0 };
+	uint8_t cycles = 0;
+	uint8_t jump = 0;
+	size_t i = 0;
+	for (int ops = 0; ops < MAX_BLOCK_OPS && i < size; ops++) {
+		const uint8_t *op = &code[i];
+		uint8_t length = op[0] == 0xCBu ? 2 : gbcc_op_sizes[op[0]];
+		if (length == 0 || i + length > size) {
+			break;
+		}
+		jump = translate_jump(&e, op, (uint16_t)(pc + i), pc, cycles);
+		if (jump) {
+			cycles += jump;
+			i += length;
+			break;
+		}
+		uint8_t n = translate_op(&e, op);
+		if (!n) {
+			break;
+		}
+		cycles += n;
+		i += length;
+	}
+	if (i > 0 && !jump) {
+		emit_exit(&e, (uint16_t)(pc + i), cycles);
+	}
+	if (mprotect(jit->code, CODE_SIZE, PROT_READ | PROT_EXEC) != 0) {
+		gbcc_log_error("Failed to protect recompiler code, disabling it.\n");
+		jit->broken = true;
+		return;
+	}
+	if (i == 0) {
+		block->failed = true;
+		return;
+	}
+	/* Casting between object & function pointers is fine on POSIX */
+	block->code = (uint32_t (*)(struct cpu *))(uintptr_t)e.buf;
+	block->cycles = cycles;
+	jit->used += (e.len + 15u) & ~(size_t)15u;
+}
+
+/*
+ * Emit a single instruction that doesn't jump, returning its length in
+ * M-cycles, or 0 if it has to be left to the interpreter.
+ */
+uint8_t translate_op(struct emitter *e, const uint8_t *op)
+{
+	uint8_t opcode = op[0];
+	uint8_t mod = opcode & 0x07u;
+	uint8_t div = (opcode >> 3u) & 0x07u;
+
+	if (opcode == 0x00u) {
+		/* NOP */
+		return 1;
+	}
+	if (opcode == 0xCBu) {
+		return translate_cb(e, op[1]);
+	}
+	if (opcode >= 0x40u && opcode < 0x80u) {
+		/* LD r, r'. 0x76 is HALT, and 0x52 prints the registers */
+		if (mod == 6 || div == 6 || opcode == 0x52u) {
+			return 0;
+		}
+		if (mod != div) {
+			load8(e, EAX, reg8(mod));
+			store8(e, reg8(div), EAX);
+		}
+		return 1;
+	}
+	if (opcode >= 0x80u && opcode < 0xC0u) {
+		if (mod == 6) {
+			return 0;
+		}
+		return translate_alu(e, div, reg8(mod), NULL);
+	}
+	if (opcode >= 0xC0u) {
+		if (mod == 6) {
+			return translate_alu(e, div, 0, &op[1]);
+		}
+		if (opcode == 0xF9u) {
+			/* LD SP, HL */
+			load16(e, EAX, REG(hl));
+			store16(e, REG(sp), EAX);
+			return 2;
+		}
+		return 0;
+	}
+
+	/* Everything else is below 0x40 */
+	switch (opcode & 0x0Fu) {
+		case 0x01:
+			/* LD rr, d16 */
+			emit(e, 0x66);
+			emit(e, 0xC7);
+			emit_mem(e, 0, reg16(opcode));
+			emit16(e, cat_bytes(op[1], op[2]));
+			return 3;
+		case 0x03:
+		case 0x0B:
+			/* INC rr & DEC rr, which don't touch the flags */
+			emit(e, 0x66);
+			emit(e, 0xFF);
+			emit_mem(e, (opcode & 0x08u) ? 1 : 0, reg16(opcode));
+			return 2;
+		case 0x09:
+			/* ADD HL, rr, with H & C from bits 11 & 15 */
+			load16(e, EAX, REG(hl));
+			load16(e, ECX, reg16(opcode));
+			emit_rr(e, 0x89, EAX, EDX);
+			emit_imm(e, X86_AND, EDX, 0x0FFFu);
+			emit_rr(e, 0x89, ECX, ESI);
+			emit_imm(e, X86_AND, ESI, 0x0FFFu);
+			emit_rr(e, 0x01, ESI, EDX);
+			emit_shift(e, X86_SHR, EDX, 7);
+			emit_imm(e, X86_AND, EDX, HF);
+			emit_rr(e, 0x01, ECX, EAX);
+			store16(e, REG(hl), EAX);
+			emit_shift(e, X86_SHR, EAX, 12);
+			emit_imm(e, X86_AND, EAX, CF);
+			emit_rr(e, 0x09, EDX, EAX);
+			load8(e, ECX, REG(f));
+			emit_imm(e, X86_AND, ECX, ZF);
+			emit_rr(e, 0x09, ECX, EAX);
+			store8(e, REG(f), EAX);
+			return 2;
+	}
+	switch (opcode) {
+		case 0x07:
+		case 0x0F:
+		case 0x17:
+		case 0x1F:
+			/* RLCA, RRCA, RLA & RRA, which always clear Z */
+			load8(e, EAX, REG(a));
+			if (opcode & 0x10u) {
+				carry_in(e);
+			}
+			emit(e, 0xD0);
+			emit(e, (uint8_t)(0xC0u | div << 3u | EAX));
+			emit_setcc(e, 0x92, ECX);
+			store8(e, REG(a), EAX);
+			emit_movzx(e, ECX);
+			emit_shift(e, X86_SHL, ECX, 4);
+			store8(e, REG(f), ECX);
+			return 1;
+		case 0x2F:
+			/* CPL */
+			emit(e, 0xF6);
+			emit_mem(e, 2, REG(a));
+			mem_imm8(e, X86_OR, REG(f), NF | HF);
+			return 1;
+		case 0x37:
+			/* SCF */
+			mem_imm8(e, X86_AND, REG(f), ZF);
+			mem_imm8(e, X86_OR, REG(f), CF);
+			return 1;
+		case 0x3F:
+			/* CCF */
+			mem_imm8(e, X86_AND, REG(f), ZF | CF);
+			mem_imm8(e, X86_XOR, REG(f), CF);
+			return 1;
+	}
+	if (div == 6) {
+		/* Anything on (HL) */
+		return 0;
+	}
+	switch (mod) {
+		case 4:
+		case 5:
+			/* INC r & DEC r, which keep C */
+			load8(e, EAX, reg8(div));
+			emit(e, 0xFE);
+			emit(e, (uint8_t)(0xC0u | (mod == 5 ? 0x08u : 0x00u) | EAX));
+			emit(e, 0x9F);
+			store8(e, reg8(div), EAX);
+			flags_out(e, ZF | HF, mod == 5 ? NF : 0, CF);
+			return 1;
+		case 6:
+			/* LD r, d8 */
+			emit(e, 0xC6);
+			emit_mem(e, 0, reg8(div));
+			emit(e, op[1]);
+			return 2;
+	}
+	return 0;
+}
+
+/* A, or A with src or *imm, for the ALU op numbered as in the opcode */
+uint8_t translate_alu(struct emitter *e, uint8_t alu, uint8_t src, const uint8_t *imm)
+{
+	/* ADD, ADC, SUB, SBC, AND, XOR, OR & CP */
+	static const uint8_t x86_ops[8] = {0x00, 0x10, 0x28, 0x18, 0x20, 0x30, 0x08, 0x38};
+	load8(e, EAX, REG(a));
+	if (imm) {
+		/* mov cl, imm */
+		emit(e, 0xB1);
+		emit(e, *imm);
+	} else {
+		load8(e, ECX, src);
+	}
+	if (alu == 1 || alu == 3) {
+		carry_in(e);
+	}
+	emit_rr(e, x86_ops[alu], ECX, EAX);
+	emit(e, 0x9F);
+	if (alu != 7) {
+		store8(e, REG(a), EAX);
+	}
+	switch (alu) {
+		case 0:
+		case 1:
+			flags_out(e, ZF | HF | CF, 0, 0);
+			break;
+		case 2:
+		case 3:
+		case 7:
+			flags_out(e, ZF | HF | CF, NF, 0);
+			break;
+		case 4:
+			flags_out(e, ZF, HF, 0);
+			break;
+		default:
+			flags_out(e, ZF, 0, 0);
+			break;
+	}
+	return imm ? 2 : 1;
+}
+
+/* CB-prefixed instructions on registers */
+uint8_t translate_cb(struct emitter *e, uint8_t op)
+{
+	/* RLC, RRC, RL, RR, SLA, SRA, SWAP & SRL, where SWAP is a rotate by 4 */
+	static const uint8_t x86_shifts[8] = {0, 1, 2, 3, 4, 7, 0, 5};
+	uint8_t r = reg8(op & 0x07u);
+	uint8_t n = (op >> 3u) & 0x07u;
+	if ((op & 0x07u) == 6) {
+		return 0;
+	}
+	switch (op >> 6u) {
+		case 0:
+			load8(e, EAX, r);
+			if (n == 2 || n == 3) {
+				carry_in(e);
+			}
+			if (n == 6) {
+				emit(e, 0xC0);
+				emit(e, (uint8_t)(0xC0u | EAX));
+				emit(e, 4);
+				emit_rr(e, 0x31, ECX, ECX);
+			} else {
+				emit(e, 0xD0);
+				emit(e, (uint8_t)(0xC0u | x86_shifts[n] << 3u | EAX));
+				emit_setcc(e, 0x92, ECX);
+			}
+			store8(e, r, EAX);
+			/* Rotates don't set ZF, so test the result */
+			emit_rr(e, 0x84, EAX, EAX);
+			emit_setcc(e, 0x94, EDX);
+			emit_movzx(e, ECX);
+			emit_shift(e, X86_SHL, ECX, 4);
+			emit_movzx(e, EDX);
+			emit_shift(e, X86_SHL, EDX, 7);
+			emit_rr(e, 0x09, EDX, ECX);
+			store8(e, REG(f), ECX);
+			return 2;
+		case 1:
+			/* BIT, which keeps C */
+			load8(e, EDX, REG(f));
+			emit_imm(e, X86_AND, EDX, CF);
+			emit_imm(e, X86_OR, EDX, HF);
+			emit(e, 0xF6);
+			emit_mem(e, 0, r);
+			emit(e, (uint8_t)(1u << n));
+			emit_setcc(e, 0x94, ECX);
+			emit_movzx(e, ECX);
+			emit_shift(e, X86_SHL, ECX, 7);
+			emit_rr(e, 0x09, ECX, EDX);
+			store8(e, REG(f), EDX);
+			return 2;
+		case 2:
+			/* RES */
+			mem_imm8(e, X86_AND, r, (uint8_t)~(1u << n));
+			return 2;
+		default:
+			/* SET */
+			mem_imm8(e, X86_OR, r, (uint8_t)(1u << n));
+			return 2;
+	}
+}
+
+/*
+ * Emit a jump ending the block, returning the M-cycles it takes if taken,
+ * or 0 if it isn't one that can be translated. cycles is the time spent in
+ * the block before it.
+ */
+uint8_t translate_jump(struct emitter *e, const uint8_t *op, uint16_t addr, uint16_t head, uint8_t cycles)
+{
+	uint16_t next;
+	uint16_t target;
+	uint8_t taken;
+	uint8_t not_taken;
+	bool cond;
+	switch (op[0]) {
+		case 0xE9:
+			/* JP HL */
+			load16(e, EAX, REG(hl));
+			store16(e, REG(pc), EAX);
+			emit(e, 0xB8);
+			emit32(e, cycles + 1u);
+			emit(e, 0xC3);
+			return 1;
+		case 0x18:
+		case 0x20:
+		case 0x28:
+		case 0x30:
+		case 0x38:
+			next = (uint16_t)(addr + 2);
+			target = (uint16_t)(next + (int8_t)op[1]);
+			taken = 3;
+			not_taken = 2;
+			cond = op[0] != 0x18u;
+			break;
+		case 0xC2:
+		case 0xC3:
+		case 0xCA:
+		case 0xD2:
+		case 0xDA:
+			next = (uint16_t)(addr + 3);
+			target = cat_bytes(op[1], op[2]);
+			taken = 4;
+			not_taken = 3;
+			cond = op[0] != 0xC3u;
+			break;
+		default:
+			return 0;
+	}
+	/*
+	 * Loops short enough to be busy-waits read memory somewhere before
+	 * the jump, so they have to go through the interpreter for idle.c to
+	 * spot them.
+	 */
+	if (target <= addr && addr - target <= GBCC_IDLE_MAX_LOOP_SIZE && target < head) {
+		return 0;
+	}
+	if (!cond) {
+		emit_exit(e, target, (uint8_t)(cycles + taken));
+		return taken;
+	}
+	/* NZ, Z, NC & C */
+	uint8_t cc = (op[0] >> 3u) & 0x03u;
+	emit(e, 0xF6);
+	emit_mem(e, 0, REG(f));
+	emit(e, cc < 2 ? ZF : CF);
+	emit(e, (cc & 1u) ? 0x75 : 0x74);
+	emit(e, EXIT_SIZE);
+	emit_exit(e, next, (uint8_t)(cycles + not_taken));
+	emit_exit(e, target, (uint8_t)(cycles + taken));
+	return taken;
+}
+
+/* Offset of the register selected by an operand field */
+uint8_t reg8(uint8_t r)
+{
+	switch (r) {
+		case 0:
+			return REG(b);
+		case 1:
+			return REG(c);
+		case 2:
+			return REG(d);
+		case 3:
+			return REG(e);
+		case 4:
+			return REG(h);
+		case 5:
+			return REG(l);
+		default:
+			return REG(a);
+	}
+}
+
+/* Offset of the register pair selected by bits 4-5 of an opcode */
+uint8_t reg16(uint8_t opcode)
+{
+	switch ((opcode >> 4u) & 0x03u) {
+		case 0:
+			return REG(bc);
+		case 1:
+			return REG(de);
+		case 2:
+			return REG(hl);
+		default:
+			return REG(sp);
+	}
+}
+
+/* Throw away every block, to make room for new ones */
+void flush(struct gbcc_jit *jit)
+{
+	for (size_t i = 0; i < jit->num_rom_banks; i++) {
+		if (jit->rom_banks[i]) {
+			memset(jit->rom_banks[i], 0, ROM0_SIZE * sizeof(*jit->rom_banks[i]));
+		}
+	}
+	jit->used = 0;
+}
+
+/*
+ * x86-64 encoding. The generated code is called as a function taking struct
+ * cpu * in rdi & returning the cycles taken in eax, and only ever refers to
+ * memory as [rdi + disp8].
+ */
+
+void emit(struct emitter *e, uint8_t byte)
+{
+	e->buf[e->len++] = byte;
+}
+
+void emit16(struct emitter *e, uint16_t val)
+{
+	emit(e, low_byte(val));
+	emit(e, high_byte(val));
+}
+
+void emit32(struct emitter *e, uint32_t val)
+{
+	emit16(e, (uint16_t)(val & 0xFFFFu));
+	emit16(e, (uint16_t)(val >> 16u));
+}
+
+/* op dst, src on 32-bit registers, or 8-bit ones for byte ops */
+void emit_rr(struct emitter *e, uint8_t op, uint8_t src, uint8_t dst)
+{
+	emit(e, op);
+	emit(e, (uint8_t)(0xC0u | src << 3u | dst));
+}
+
+/* ModRM & displacement for [rdi + off] */
+void emit_mem(struct emitter *e, uint8_t reg, uint8_t off)
+{
+	emit(e, (uint8_t)(0x40u | reg << 3u | RDI));
+	emit(e, off);
+}
+
+/* Group 1 op on a 32-bit register & imm32 */
+void emit_imm(struct emitter *e, uint8_t ext, uint8_t reg, uint32_t imm)
+{
+	emit(e, 0x81);
+	emit(e, (uint8_t)(0xC0u | ext << 3u | reg));
+	emit32(e, imm);
+}
+
+/* Group 2 op on a 32-bit register by n */
+void emit_shift(struct emitter *e, uint8_t ext, uint8_t reg, uint8_t n)
+{
+	emit(e, 0xC1);
+	emit(e, (uint8_t)(0xC0u | ext << 3u | reg));
+	emit(e, n);
+}
+
+/* setcc on the low byte of a register */
+void emit_setcc(struct emitter *e, uint8_t cc, uint8_t reg)
+{
+	emit(e, 0x0F);
+	emit(e, cc);
+	emit(e, (uint8_t)(0xC0u | reg));
+}
+
+/* Zero-extend the low byte of a register into the rest of it */
+void emit_movzx(struct emitter *e, uint8_t reg)
+{
+	emit(e, 0x0F);
+	emit(e, 0xB6);
+	emit(e, (uint8_t)(0xC0u | reg << 3u | reg));
+}
+
+/* movzx reg, byte [rdi + off] */
+void load8(struct emitter *e, uint8_t reg, uint8_t off)
+{
+	emit(e, 0x0F);
+	emit(e, 0xB6);
+	emit_mem(e, reg, off);
+}
+
+/* movzx reg, word [rdi + off] */
+void load16(struct emitter *e, uint8_t reg, uint8_t off)
+{
+	emit(e, 0x0F);
+	emit(e, 0xB7);
+	emit_mem(e, reg, off);
+}
+
+/* mov byte [rdi + off], reg */
+void store8(struct emitter *e, uint8_t off, uint8_t reg)
+{
+	emit(e, 0x88);
+	emit_mem(e, reg, off);
+}
+
+/* mov word [rdi + off], reg */
+void store16(struct emitter *e, uint8_t off, uint8_t reg)
+{
+	emit(e, 0x66);
+	emit(e, 0x89);
+	emit_mem(e, reg, off);
+}
+
+/* Group 1 op on byte [rdi + off] & imm8 */
+void mem_imm8(struct emitter *e, uint8_t ext, uint8_t off, uint8_t imm)
+{
+	emit(e, 0x80);
+	emit_mem(e, ext, off);
+	emit(e, imm);
+}
+
+/* Load the carry flag into CF, clobbering edx */
+void carry_in(struct emitter *e)
+{
+	load8(e, EDX, REG(f));
+	/* bt edx, 4 */
+	emit(e, 0x0F);
+	emit(e, 0xBA);
+	emit(e, (uint8_t)(0xE0u | EDX));
+	emit(e, 4);
+}
+
+/*
+ * Write reg.f from the x86 flags left in ah by lahf, taking the flags in take
+ * from the result, setting the ones in set, and keeping the old value of the
+ * ones in keep. x86 has Z & H one bit to the right of where they are here,
+ * and C in bit 0.
+ */
+void flags_out(struct emitter *e, uint8_t take, uint8_t set, uint8_t keep)
+{
+	/* movzx ecx, ah */
+	emit(e, 0x0F);
+	emit(e, 0xB6);
+	emit(e, 0xCC);
+	emit_rr(e, 0x89, ECX, EDX);
+	emit_imm(e, X86_AND, ECX, 0x50u);
+	emit_shift(e, X86_SHL, ECX, 1);
+	emit_imm(e, X86_AND, EDX, 0x01u);
+	emit_shift(e, X86_SHL, EDX, 4);
+	emit_rr(e, 0x09, EDX, ECX);
+	emit_imm(e, X86_AND, ECX, take);
+	if (keep) {
+		load8(e, EDX, REG(f));
+		emit_imm(e, X86_AND, EDX, keep);
+		emit_rr(e, 0x09, EDX, ECX);
+	}
+	if (set) {
+		emit_imm(e, X86_OR, ECX, set);
+	}
+	store8(e, REG(f), ECX);
+}
+
+/* Leave the block at pc, having taken the given number of M-cycles */
+void emit_exit(struct emitter *e, uint16_t pc, uint8_t cycles)
+{
+	emit(e, 0x66);
+	emit(e, 0xC7);
+	emit_mem(e, 0, REG(pc));
+	emit16(e, pc);
+	emit(e, 0xB8);
+	emit32(e, cycles);
+	emit(e, 0xC3);
+}
@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2017-2020 Philip Jones
+ *
+ * Licensed under the MIT License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/licenses/MIT
+ *
+ */
+
+#ifndef GBCC_JIT_H
+#define GBCC_JIT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct cpu;
+struct gbcc_core;
+
+/*
+ * Dynamic recompiler for code in ROM, built with -Djit=enabled on x86-64.
+ *
+ * Runs of instructions that only touch registers are translated to native
+ * code once they've been reached a few times, ending at the first jump or
+ * anything else. All the time a block takes is only accounted for once it
+ * exits, which nothing outside the CPU can tell apart from stepping through
+ * it, so long as no event falls due and no interrupt can be taken in the
+ * meantime. Blocks are only entered when that's the case, in the same way
+ * as busy-wait loops are skipped (see idle.h), and are chained one after
+ * another for as long as it stays true.
+ *
+ * Memory accesses, interrupts, HALT, STOP, EI & DI, and anything not in ROM
+ * are always left to the interpreter. Blocks are keyed on the physical ROM
+ * bank & address they start at, like the instruction cache, so they never
+ * need invalidating.
+ */
+
+struct gbcc_jit_block {
+	uint32_t (*code)(struct cpu *cpu);	/* Returns the M-cycles it ran for */
+	uint8_t cycles;		/* Longest path through the block, in M-cycles */
+	uint8_t heat;		/* Times reached before being translated */
+	bool failed;		/* Nothing here can be translated */
+};
+
+struct gbcc_jit {
+	struct gbcc_jit_block **rom_banks;	/* Allocated on first use */
+	size_t num_rom_banks;
+	uint8_t *code;		/* Executable, except while translating */
+	size_t used;
+	bool broken;		/* Couldn't change protection, so stay off */
+};
+
+struct gbcc_jit *gbcc_jit_create(size_t num_rom_banks);
+void gbcc_jit_destroy(struct gbcc_jit *jit);
+uint32_t gbcc_jit_cycles(struct gbcc_core *gbc, uint32_t max);
+
+#endif /* GBCC_JIT_H */
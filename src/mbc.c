@@ -11,7 +11,9 @@
 #include "core.h"
 #include "bit_utils.h"
 #include "debug.h"
+#include "icache.h"
 #include "mbc.h"
+#include "memory.h"
 #include "time_diff.h"
 #include <stdio.h>
 #include <string.h>
@@ -44,9 +46,67 @@ void set_mbc_banks(struct gbcc_core *gbc)
 	/* And finally update the actual banks */
 	gbc->memory.rom0 = gbc->cart.rom + mbc->rom0_bank * ROM0_SIZE;
 	gbc->memory.romx = gbc->cart.rom + mbc->romx_bank * ROMX_SIZE;
+	gbcc_icache_remap_rom(gbc);
 	if (gbc->cart.ram != NULL) {
 		gbc->memory.sram = gbc->cart.ram + mbc->sram_bank * SRAM_SIZE;
 	}
+	gbcc_memory_update_map(gbc);
+}
+
+/*
+ * Point mbc.read & mbc.write at the handlers for the cartridge's MBC. The
+ * type never changes once the ROM is loaded, so this only needs doing once,
+ * rather than switching on it for every access.
+ */
+void gbcc_mbc_bind(struct gbcc_core *gbc)
+{
+	struct gbcc_mbc *mbc = &gbc->cart.mbc;
+	switch (mbc->type) {
+		case NONE:
+			mbc->read = gbcc_mbc_none_read;
+			mbc->write = gbcc_mbc_none_write;
+			break;
+		case MBC1:
+			mbc->read = gbcc_mbc_mbc1_read;
+			mbc->write = gbcc_mbc_mbc1_write;
+			break;
+		case MBC2:
+			mbc->read = gbcc_mbc_mbc2_read;
+			mbc->write = gbcc_mbc_mbc2_write;
+			break;
+		case MBC3:
+			mbc->read = gbcc_mbc_mbc3_read;
+			mbc->write = gbcc_mbc_mbc3_write;
+			break;
+		case MBC5:
+			mbc->read = gbcc_mbc_mbc5_read;
+			mbc->write = gbcc_mbc_mbc5_write;
+			break;
+		case MBC6:
+			mbc->read = gbcc_mbc_mbc6_read;
+			mbc->write = gbcc_mbc_mbc6_write;
+			break;
+		case MBC7:
+			mbc->read = gbcc_mbc_mbc7_read;
+			mbc->write = gbcc_mbc_mbc7_write;
+			break;
+		case HUC1:
+			mbc->read = gbcc_mbc_huc1_read;
+			mbc->write = gbcc_mbc_huc1_write;
+			break;
+		case HUC3:
+			mbc->read = gbcc_mbc_huc3_read;
+			mbc->write = gbcc_mbc_huc3_write;
+			break;
+		case MMM01:
+			mbc->read = gbcc_mbc_mmm01_read;
+			mbc->write = gbcc_mbc_mmm01_write;
+			break;
+		case CAMERA:
+			mbc->read = gbcc_mbc_cam_read;
+			mbc->write = gbcc_mbc_cam_write;
+			break;
+	}
 }
 
 uint8_t gbcc_mbc_none_read(struct gbcc_core *gbc, uint16_t addr)
@@ -20,6 +20,9 @@ struct gbcc_core;
 
 struct gbcc_mbc {
 	enum MBC type;
+	/* Handlers for type, set by gbcc_mbc_bind() */
+	uint8_t (*read)(struct gbcc_core *gbc, uint16_t addr);
+	void (*write)(struct gbcc_core *gbc, uint16_t addr, uint8_t val);
 	uint16_t rom0_bank;
 	uint16_t romx_bank;
 	uint8_t sram_bank;
@@ -106,6 +109,7 @@ struct gbcc_mbc {
 	} camera;
 };
 
+void gbcc_mbc_bind(struct gbcc_core *gbc);
 uint8_t gbcc_mbc_none_read(struct gbcc_core *gbc, uint16_t addr);
 uint8_t gbcc_mbc_mbc1_read(struct gbcc_core *gbc, uint16_t addr);
 uint8_t gbcc_mbc_mbc2_read(struct gbcc_core *gbc, uint16_t addr);
@@ -14,11 +14,17 @@
 #include "debug.h"
 #include "gbcc.h"
 #include "hdma.h"
+#include "icache.h"
+#include "interrupt.h"
 #include "mbc.h"
 #include "memory.h"
 #include "ppu.h"
 #include "printer.h"
+#include "scheduler.h"
+#include "tile_cache.h"
+#include "timer.h"
 #include <stdio.h>
+#include <string.h>
 
 static const uint8_t ioreg_read_masks[0x80] = {
 /* 0xFF00 */	0x3F, 0xFF, 0x83, 0x00, 0xFF, 0xFF, 0xFF, 0x07,
@@ -98,6 +104,8 @@ static void ioreg_write(struct gbcc_core *gbc, uint16_t addr, uint8_t val);
 static uint8_t hram_read(struct gbcc_core *gbc, uint16_t addr);
 static void hram_write(struct gbcc_core *gbc, uint16_t addr, uint8_t val);
 
+static uint8_t *sram_page(struct gbcc_core *gbc, uint16_t offset);
+
 void gbcc_memory_increment(struct gbcc_core *gbc, uint16_t addr)
 {
 	gbcc_memory_write(gbc, addr, gbcc_memory_read(gbc, addr) + 1);
@@ -130,43 +138,13 @@ uint8_t gbcc_memory_read_force(struct gbcc_core *gbc, uint16_t addr) {
 
 uint8_t gbcc_memory_read(struct gbcc_core *gbc, uint16_t addr)
 {
+	const uint8_t *page = gbc->memory.read_page[addr >> 12u];
+	/* Game Genie codes can be toggled at any time, so aren't in the map */
+	if (page && !(addr < ROMX_END && gbc->cheats.enabled)) {
+		return page[addr & 0x0FFFu];
+	}
 	if (addr < ROMX_END || (addr >= SRAM_START && addr < SRAM_END)) {
-		uint8_t ret;
-		switch (gbc->cart.mbc.type) {
-			case NONE:
-				ret = gbcc_mbc_none_read(gbc, addr);
-				break;
-			case MBC1:
-				ret = gbcc_mbc_mbc1_read(gbc, addr);
-				break;
-			case MBC2:
-				ret = gbcc_mbc_mbc2_read(gbc, addr);
-				break;
-			case MBC3:
-				ret = gbcc_mbc_mbc3_read(gbc, addr);
-				break;
-			case MBC5:
-				ret = gbcc_mbc_mbc5_read(gbc, addr);
-				break;
-			case MBC6:
-				ret = gbcc_mbc_mbc6_read(gbc, addr);
-				break;
-			case MBC7:
-				ret = gbcc_mbc_mbc7_read(gbc, addr);
-				break;
-			case HUC1:
-				ret = gbcc_mbc_huc1_read(gbc, addr);
-				break;
-			case HUC3:
-				ret = gbcc_mbc_huc3_read(gbc, addr);
-				break;
-			case MMM01:
-				ret = gbcc_mbc_mmm01_read(gbc, addr);
-				break;
-			case CAMERA:
-				ret = gbcc_mbc_cam_read(gbc, addr);
-				break;
-		}
+		uint8_t ret = gbc->cart.mbc.read(gbc, addr);
 		if (addr < ROMX_END && gbc->cheats.enabled) {
 			return gbcc_cheats_gamegenie_read(gbc, addr, ret);
 		}
@@ -213,46 +191,23 @@ void gbcc_memory_write_force(struct gbcc_core *gbc, uint16_t addr, uint8_t val)
 
 void gbcc_memory_write(struct gbcc_core *gbc, uint16_t addr, uint8_t val)
 {
+	uint8_t *page = gbc->memory.write_page[addr >> 12u];
+	if (page) {
+		uint8_t *dest = &page[addr & 0x0FFFu];
+		*dest = val;
+		if (addr >= WRAM0_START) {
+			gbcc_icache_invalidate_wram(gbc, dest);
+		} else {
+			gbcc_tile_cache_invalidate(gbc, dest);
+		}
+		return;
+	}
 	if (addr < ROMX_END || (addr >= SRAM_START && addr < SRAM_END)) {
 		if (addr >= SRAM_START && addr < SRAM_END) {
 			gbc->cart.mbc.last_save_time = time(NULL);
 			gbc->cart.mbc.sram_changed = true;
 		}
-		switch (gbc->cart.mbc.type) {
-			case NONE:
-				gbcc_mbc_none_write(gbc, addr, val);
-				break;
-			case MBC1:
-				gbcc_mbc_mbc1_write(gbc, addr, val);
-				break;
-			case MBC2:
-				gbcc_mbc_mbc2_write(gbc, addr, val);
-				break;
-			case MBC3:
-				gbcc_mbc_mbc3_write(gbc, addr, val);
-				break;
-			case MBC5:
-				gbcc_mbc_mbc5_write(gbc, addr, val);
-				break;
-			case MBC6:
-				gbcc_mbc_mbc6_write(gbc, addr, val);
-				break;
-			case MBC7:
-				gbcc_mbc_mbc7_write(gbc, addr, val);
-				break;
-			case HUC1:
-				gbcc_mbc_huc1_write(gbc, addr, val);
-				break;
-			case HUC3:
-				gbcc_mbc_huc3_write(gbc, addr, val);
-				break;
-			case MMM01:
-				gbcc_mbc_mmm01_write(gbc, addr, val);
-				break;
-			case CAMERA:
-				gbcc_mbc_cam_write(gbc, addr, val);
-				break;
-		}
+		gbc->cart.mbc.write(gbc, addr, val);
 		return;
 	}
 	if (addr >= VRAM_START && addr < VRAM_END) {
@@ -271,11 +226,79 @@ void gbcc_memory_write(struct gbcc_core *gbc, uint16_t addr, uint8_t val)
 		hram_write(gbc, addr, val);
 	} else if (addr == IE) {
 		gbc->memory.iereg = val;
+		gbcc_interrupt_update(gbc);
 	} else {
 		gbcc_log_error("Writing to unknown memory address %04X.\n", addr);
 	}
 }
 
+/*
+ * Rebuild the page table used by gbcc_memory_read() & gbcc_memory_write().
+ * Must be called whenever any of the banked pointers above change, SRAM
+ * is enabled or disabled, or the ppu starts or stops drawing ahead.
+ *
+ * Only plain memory is mapped; ROM & SRAM writes, and anything in the
+ * 0xF000 - 0xFFFF page, always go through the full handlers.
+ */
+void gbcc_memory_update_map(struct gbcc_core *gbc)
+{
+	uint8_t **read = gbc->memory.read_page;
+	uint8_t **write = gbc->memory.write_page;
+	memset(gbc->memory.read_page, 0, sizeof(gbc->memory.read_page));
+	memset(gbc->memory.write_page, 0, sizeof(gbc->memory.write_page));
+
+	/* MBC6 splits ROMX into two separately banked halves */
+	if (gbc->cart.mbc.type != MBC6) {
+		for (uint8_t i = 0; i < 4; i++) {
+			read[0x0u + i] = gbc->memory.rom0 + i * 0x1000u;
+			read[0x4u + i] = gbc->memory.romx + i * 0x1000u;
+		}
+	}
+	for (uint8_t i = 0; i < 2; i++) {
+		read[0x8u + i] = gbc->memory.vram + i * 0x1000u;
+		/* The ppu needs to see VRAM writes while it's drawing ahead */
+		if (!gbc->ppu.line_drawn) {
+			write[0x8u + i] = gbc->memory.vram + i * 0x1000u;
+		}
+		read[0xAu + i] = sram_page(gbc, i * 0x1000u);
+	}
+	read[0xCu] = gbc->memory.wram0;
+	write[0xCu] = gbc->memory.wram0;
+	read[0xDu] = gbc->memory.wramx;
+	write[0xDu] = gbc->memory.wramx;
+	read[0xEu] = gbc->memory.wram0;
+	write[0xEu] = gbc->memory.wram0;
+}
+
+/*
+ * SRAM can only be read directly for the simple MBCs, and then only if the
+ * whole page lies within the cartridge's RAM.
+ */
+uint8_t *sram_page(struct gbcc_core *gbc, uint16_t offset)
+{
+	struct gbcc_mbc *mbc = &gbc->cart.mbc;
+	if (gbc->cart.ram == NULL || gbc->memory.sram == NULL) {
+		return NULL;
+	}
+	switch (mbc->type) {
+		case NONE:
+			break;
+		case MBC1:
+		case MBC5:
+			if (!mbc->sram_enable) {
+				return NULL;
+			}
+			break;
+		default:
+			return NULL;
+	}
+	uint8_t *page = gbc->memory.sram + offset;
+	if (page + 0x1000u > gbc->cart.ram + gbc->cart.ram_size) {
+		return NULL;
+	}
+	return page;
+}
+
 uint8_t vram_read(struct gbcc_core *gbc, uint16_t addr)
 {
 	return gbc->memory.vram[addr - VRAM_START];
@@ -283,7 +306,9 @@ uint8_t vram_read(struct gbcc_core *gbc, uint16_t addr)
 
 void vram_write(struct gbcc_core *gbc, uint16_t addr, uint8_t val)
 {
+	gbcc_ppu_mid_line_write(gbc);
 	gbc->memory.vram[addr - VRAM_START] = val;
+	gbcc_tile_cache_invalidate(gbc, &gbc->memory.vram[addr - VRAM_START]);
 }
 
 uint8_t wram_read(struct gbcc_core *gbc, uint16_t addr)
@@ -296,11 +321,14 @@ uint8_t wram_read(struct gbcc_core *gbc, uint16_t addr)
 
 void wram_write(struct gbcc_core *gbc, uint16_t addr, uint8_t val)
 {
+	uint8_t *dest;
 	if (addr < WRAMX_START) {
-		gbc->memory.wram0[addr - WRAM0_START] = val;
+		dest = &gbc->memory.wram0[addr - WRAM0_START];
 	} else {
-		gbc->memory.wramx[addr - WRAMX_START] = val;
+		dest = &gbc->memory.wramx[addr - WRAMX_START];
 	}
+	*dest = val;
+	gbcc_icache_invalidate_wram(gbc, dest);
 }
 
 uint8_t echo_read(struct gbcc_core *gbc, uint16_t addr)
@@ -369,6 +397,7 @@ uint8_t ioreg_read(struct gbcc_core *gbc, uint16_t addr)
 		 * When the wave channel is enabled, accessing any wave RAM
 		 * accesses the current byte.
 		 */
+		gbcc_apu_sync(gbc);
 		if (gbc->apu.ch3.enabled) {
 			return gbc->memory.ioreg[gbc->apu.wave.addr - IOREG_START];
 		}
@@ -451,8 +480,10 @@ void ioreg_write(struct gbcc_core *gbc, uint16_t addr, uint8_t val)
 	if (addr >= WAVE_START && addr < WAVE_END) {
 		/*
 		 * When the wave channel is enabled, accessing any wave RAM
-		 * accesses the current byte.
+		 * accesses the current byte. The channel has to be caught
+		 * up first either way, as it reads the RAM as it plays.
 		 */
+		gbcc_apu_sync(gbc);
 		if (gbc->apu.ch3.enabled) {
 			gbc->memory.ioreg[gbc->apu.wave.addr - IOREG_START] = val;
 		}
@@ -467,8 +498,23 @@ void ioreg_write(struct gbcc_core *gbc, uint16_t addr, uint8_t val)
 		return;
 	}
 
+	switch (addr) {
+		/* Registers the ppu reads while drawing */
+		case BGP:
+		case OBP0:
+		case OBP1:
+		case BGPD:
+		case OBPD:
+		case DMA:
+			gbcc_ppu_mid_line_write(gbc);
+			break;
+		default:
+			break;
+	}
+
 	switch (addr) {
 		case LY:
+			gbcc_ppu_wake(gbc);
 			*dest = 0;
 			break;
 		case JOYP:
@@ -476,10 +522,13 @@ void ioreg_write(struct gbcc_core *gbc, uint16_t addr, uint8_t val)
 			*dest |= val;
 			break;
 		case SC:
+			gbcc_link_cable_sync(gbc);
 			*dest = tmp | (val & mask);
 			if (gbc->link_cable.state == GBCC_LINK_CABLE_STATE_LOOPBACK) {
+				gbc->link_cable.sent += check_bit(val, 7);
 				*dest = clear_bit(*dest, 7);
-				gbcc_memory_set_bit(gbc, IF, 3);
+				gbcc_interrupt_request(gbc, 3);
+				gbcc_link_cable_schedule(gbc);
 				return;
 			}
 			if (check_bit(val, 1)) {
@@ -493,10 +542,12 @@ void ioreg_write(struct gbcc_core *gbc, uint16_t addr, uint8_t val)
 					 * Externally clocked transfer,
 					 * do nothing for now.
 					 */
+					gbcc_link_cable_schedule(gbc);
 					return;
 				}
 				//fprintf(stderr, "%c\n", gbc->memory.ioreg[SB - IOREG_START]);
 				//fprintf(stdout, "0x%02X\n", gbc->memory.ioreg[SB - IOREG_START]);
+				gbc->link_cable.sent++;
 				/*
 				 * If link_cable_loop is true, just receive SB.
 				 * This means the gameboy acts like it's
@@ -515,12 +566,25 @@ void ioreg_write(struct gbcc_core *gbc, uint16_t addr, uint8_t val)
 					default:
 						break;
 				}
+				gbcc_link_cable_schedule(gbc);
 				return;
 			}
+			gbcc_link_cable_schedule(gbc);
+			break;
+		case IF:
+			*dest = tmp | (uint8_t)(val & mask);
+			gbcc_interrupt_update(gbc);
 			break;
 		case DIV:
 			//printf("DIV reset from %04X\n", gbc->div_timer);
+			gbcc_timer_sync(gbc);
 			gbc->cpu.div_timer = 0;
+			gbcc_timer_schedule(gbc);
+			break;
+		case TAC:
+			gbcc_timer_sync(gbc);
+			*dest = tmp | (uint8_t)(val & mask);
+			gbcc_timer_schedule(gbc);
 			break;
 		case LCDC:
 			if (check_bit(val, 7)) {
@@ -530,7 +594,12 @@ void ioreg_write(struct gbcc_core *gbc, uint16_t addr, uint8_t val)
 			}
 			*dest = tmp | (uint8_t)(val & mask);
 			break;
+		case STAT:
+			gbcc_ppu_wake(gbc);
+			*dest = tmp | (uint8_t)(val & mask);
+			break;
 		case LYC:
+			gbcc_ppu_wake(gbc);
 			*dest = tmp | (uint8_t)(val & mask);
 			gbc->ppu.lyc = val;
 			break;
@@ -546,6 +615,7 @@ void ioreg_write(struct gbcc_core *gbc, uint16_t addr, uint8_t val)
 		case VBK:
 			*dest = tmp | (uint8_t)(val & mask);
 			gbc->memory.vram = gbc->memory.vram_bank[*dest];
+			gbcc_memory_update_map(gbc);
 			break;
 		case HDMA1:
 			if (val < 0x80u || (val >= 0xA0u && val < 0xE0u)) {
@@ -615,6 +685,7 @@ void ioreg_write(struct gbcc_core *gbc, uint16_t addr, uint8_t val)
 			{
 				uint8_t index = gbc->memory.ioreg[BGPI - IOREG_START];
 				gbc->ppu.bgp[index & 0x3Fu] = val;
+				gbcc_ppu_update_cgb_colour(gbc, false, index);
 				if (check_bit(index, 7)) {
 					index++;
 					if ((index & 0x7Fu) == 0x40u) {
@@ -628,6 +699,7 @@ void ioreg_write(struct gbcc_core *gbc, uint16_t addr, uint8_t val)
 			{
 				uint8_t index = gbc->memory.ioreg[OBPI - IOREG_START];
 				gbc->ppu.obp[index & 0x3Fu] = val;
+				gbcc_ppu_update_cgb_colour(gbc, true, index);
 				if (check_bit(index, 7)) {
 					index++;
 					if ((index & 0x7Fu) == 0x40u) {
@@ -637,12 +709,19 @@ void ioreg_write(struct gbcc_core *gbc, uint16_t addr, uint8_t val)
 				}
 			}
 			break;
+		case BGP:
+		case OBP0:
+		case OBP1:
+			*dest = tmp | (uint8_t)(val & mask);
+			gbcc_ppu_update_colours(gbc);
+			break;
 		case SVBK:
 			{
 				uint8_t bank = tmp | (val & mask);
 				bank += !bank;
 				*dest = bank;
 				gbc->memory.wramx = gbc->memory.wram_bank[bank];
+				gbcc_memory_update_map(gbc);
 			}
 			break;
 		default:
@@ -659,8 +738,13 @@ uint8_t hram_read(struct gbcc_core *gbc, uint16_t addr)
 void hram_write(struct gbcc_core *gbc, uint16_t addr, uint8_t val)
 {
 	gbc->memory.hram[addr - HRAM_START] = val;
+	gbcc_icache_invalidate_hram(gbc, addr);
 }
 
+/*
+ * The link cable clock is only brought up to date when something needs it;
+ * otherwise this is just called on the ticks where a bit is shifted out.
+ */
 void gbcc_link_cable_clock(struct gbcc_core *gbc)
 {
 	uint8_t sc = gbcc_memory_read_force(gbc, SC);
@@ -669,11 +753,6 @@ void gbcc_link_cable_clock(struct gbcc_core *gbc)
 	}
 	uint8_t sb = gbcc_memory_read_force(gbc, SB);
 
-	gbc->link_cable.clock++;
-	if (gbc->link_cable.clock < gbc->link_cable.divider) {
-		return;
-	}
-
 	gbc->link_cable.clock = 0;
 	sb <<= 1;
 	sb |= check_bit(gbc->link_cable.received, 7 - gbc->link_cable.current_bit);
@@ -684,6 +763,30 @@ void gbcc_link_cable_clock(struct gbcc_core *gbc)
 		gbc->link_cable.current_bit = 0;
 		uint8_t tmp = gbcc_memory_read_force(gbc, SC);
 		gbcc_memory_write_force(gbc, SC, clear_bit(tmp, 7));
-		gbcc_memory_set_bit(gbc, IF, 3);
+		gbcc_interrupt_request(gbc, 3);
+	}
+	gbcc_link_cable_schedule(gbc);
+}
+
+void gbcc_link_cable_sync(struct gbcc_core *gbc)
+{
+	if (!gbcc_scheduler_pending(gbc, GBCC_EVENT_SERIAL)) {
+		return;
+	}
+	uint32_t remaining = gbcc_scheduler_ticks_until(gbc, gbc->scheduler.deadline[GBCC_EVENT_SERIAL]);
+	gbc->link_cable.clock = gbc->link_cable.divider - remaining;
+}
+
+void gbcc_link_cable_schedule(struct gbcc_core *gbc)
+{
+	uint8_t sc = gbcc_memory_read_force(gbc, SC);
+	if (!check_bit(sc, 7) || !check_bit(sc, 0)) {
+		gbcc_scheduler_remove(gbc, GBCC_EVENT_SERIAL);
+		return;
+	}
+	uint32_t n = 1;
+	if (gbc->link_cable.clock + 1u < gbc->link_cable.divider) {
+		n = gbc->link_cable.divider - gbc->link_cable.clock;
 	}
+	gbcc_scheduler_add(gbc, GBCC_EVENT_SERIAL, gbcc_scheduler_tick_time(gbc, n));
 }
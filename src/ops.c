@@ -13,8 +13,11 @@
 #include "cheats.h"
 #include "cpu.h"
 #include "debug.h"
+#include "idle.h"
+#include "interrupt.h"
 #include "memory.h"
 #include "ops.h"
+#include "timer.h"
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -23,28 +26,121 @@
 
 static uint8_t READ_OPERAND_MOD(struct gbcc_core *gbc);
 static void WRITE_OPERAND_MOD(struct gbcc_core *gbc, uint8_t val);
-static void WRITE_OPERAND_DIV(struct gbcc_core *gbc, uint8_t offset, uint8_t val);
+static void WRITE_OPERAND_DIV(struct gbcc_core *gbc, uint8_t val);
 static bool mod_is_hl(struct cpu *cpu);
-static bool div_is_hl(struct cpu *cpu, uint8_t offset);
+static bool div_is_hl(struct cpu *cpu);
 static void done(struct cpu *cpu);
 
+/*
+ * Flags are evaluated lazily: arithmetic ops just record their operands and
+ * result in cpu->flags, and reg.f is only worked out when something actually
+ * reads it. Z and C, which are by far the most commonly read, can be found
+ * without working out the rest.
+ */
+
+static bool lazy_carry(const struct cpu *cpu)
+{
+	const uint8_t a = cpu->flags.a;
+	const uint8_t b = cpu->flags.b;
+	const uint8_t carry = cpu->flags.carry;
+	switch (cpu->flags.op) {
+		case GBCC_FLAGS_ADD:
+			return a + b + carry > 0xFF;
+		case GBCC_FLAGS_SUB:
+			return b + carry > a;
+		default:
+			/* INC & DEC leave it alone */
+			return carry;
+	}
+}
+
+void gbcc_sync_flags(struct cpu *cpu)
+{
+	const uint8_t a = cpu->flags.a;
+	const uint8_t b = cpu->flags.b;
+	const uint8_t carry = cpu->flags.carry;
+	uint8_t f = 0;
+	switch (cpu->flags.op) {
+		case GBCC_FLAGS_SYNCED:
+			return;
+		case GBCC_FLAGS_ADD:
+			if ((a & 0x0Fu) + (b & 0x0Fu) + carry > 0x0Fu) {
+				f |= HF;
+			}
+			break;
+		case GBCC_FLAGS_SUB:
+			f |= NF;
+			if ((b & 0x0Fu) + carry > (a & 0x0Fu)) {
+				f |= HF;
+			}
+			break;
+		case GBCC_FLAGS_INC:
+			if ((a & 0x0Fu) == 0x0Fu) {
+				f |= HF;
+			}
+			break;
+		case GBCC_FLAGS_DEC:
+			f |= NF;
+			if ((a & 0x0Fu) == 0) {
+				f |= HF;
+			}
+			break;
+	}
+	if (cpu->flags.result == 0) {
+		f |= ZF;
+	}
+	if (lazy_carry(cpu)) {
+		f |= CF;
+	}
+	cpu->reg.f = f;
+	cpu->flags.op = GBCC_FLAGS_SYNCED;
+}
+
+static void lazy_flags(struct cpu *cpu, uint8_t op, uint8_t a, uint8_t b, uint8_t carry, uint8_t result)
+{
+	cpu->flags.op = op;
+	cpu->flags.a = a;
+	cpu->flags.b = b;
+	cpu->flags.carry = carry;
+	cpu->flags.result = result;
+}
+
+/* For ops which overwrite all of the flags at once */
+static void set_flags(struct cpu *cpu, uint8_t f)
+{
+	cpu->reg.f = f;
+	cpu->flags.op = GBCC_FLAGS_SYNCED;
+}
+
 static uint8_t get_flag(struct cpu *cpu, uint8_t flag)
 {
+	if (cpu->flags.op != GBCC_FLAGS_SYNCED) {
+		if (flag == ZF) {
+			return cpu->flags.result == 0;
+		}
+		if (flag == CF) {
+			return lazy_carry(cpu);
+		}
+		gbcc_sync_flags(cpu);
+	}
 	return !!(cpu->reg.f & flag);
 }
 
 static void set_flag(struct cpu *cpu, uint8_t flag)
 {
+	gbcc_sync_flags(cpu);
 	cpu->reg.f |= flag;
 }
 
 static void clear_flag(struct cpu *cpu, uint8_t flag)
 {
+	gbcc_sync_flags(cpu);
 	cpu->reg.f &= (uint8_t)~flag;
 }
 
 static void toggle_flag(struct cpu *cpu, uint8_t flag)
 {
+	gbcc_sync_flags(cpu);
 	cpu->reg.f ^= flag;
 }
 
@@ -125,6 +221,28 @@ void (*const gbcc_ops[0x100])(struct gbcc_core *gbc) = {
 };
 
 
+/* Instruction sizes, in bytes. 0 means invalid instruction */
+const uint8_t gbcc_op_sizes[0x100] = {
+           /* 0  1  2  3  4  5  6  7  8  9  A  B  C  D  E  F */
+/* 0x00 */    1, 3, 1, 1, 1, 1, 2, 1, 3, 1, 1, 1, 1, 1, 2, 1,
+/* 0x10 */    2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1,
+/* 0x20 */    2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1,
+/* 0x30 */    2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1,
+/* 0x40 */    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+/* 0x50 */    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+/* 0x60 */    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+/* 0x70 */    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+/* 0x80 */    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+/* 0x90 */    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+/* 0xA0 */    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+/* 0xB0 */    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+/* 0xC0 */    1, 1, 3, 3, 3, 1, 2, 1, 1, 1, 3, 1, 3, 3, 2, 1,
+/* 0xD0 */    1, 1, 3, 0, 3, 1, 2, 1, 1, 1, 3, 0, 3, 0, 2, 1,
+/* 0xE0 */    2, 1, 2, 0, 0, 1, 2, 1, 2, 1, 3, 0, 0, 0, 2, 1,
+/* 0xF0 */    2, 1, 2, 1, 0, 1, 2, 1, 2, 1, 3, 1, 0, 0, 2, 1
+};
+
+
 void INTERRUPT(struct gbcc_core *gbc)
 {
 	struct cpu *cpu = &gbc->cpu;
@@ -137,9 +255,7 @@ void INTERRUPT(struct gbcc_core *gbc)
 		done(cpu);
 		return;
 	}
-	uint8_t iereg = gbcc_memory_read(gbc, IE);
-	uint8_t ifreg = gbcc_memory_read(gbc, IF);
-	uint8_t interrupt = (uint8_t)(iereg & ifreg) & 0x1Fu;
+	uint8_t interrupt = gbc->pending_interrupts;
 	if (!interrupt && cpu->instruction.step < 4) {
 		if (cpu->instruction.step < 3) {
 			cpu->interrupt.request = false;
@@ -194,7 +310,7 @@ void INTERRUPT(struct gbcc_core *gbc)
 	}
 	switch (cpu->interrupt.addr) {
 		case INT_VBLANK:
-			gbcc_memory_clear_bit(gbc, IF, 0);
+			gbcc_interrupt_clear(gbc, 0);
 			/*
 			 * The GameShark apparently hooks the vblank interrupt
 			 * & applies any codes. This is meant to take some cpu
@@ -205,16 +321,16 @@ void INTERRUPT(struct gbcc_core *gbc)
 			}
 			break;
 		case INT_LCDSTAT:
-			gbcc_memory_clear_bit(gbc, IF, 1);
+			gbcc_interrupt_clear(gbc, 1);
 			break;
 		case INT_TIMER:
-			gbcc_memory_clear_bit(gbc, IF, 2);
+			gbcc_interrupt_clear(gbc, 2);
 			break;
 		case INT_SERIAL:
-			gbcc_memory_clear_bit(gbc, IF, 3);
+			gbcc_interrupt_clear(gbc, 3);
 			break;
 		case INT_JOYPAD:
-			gbcc_memory_clear_bit(gbc, IF, 4);
+			gbcc_interrupt_clear(gbc, 4);
 			break;
 	}
 	cpu->reg.pc = cpu->interrupt.addr;
@@ -241,7 +357,12 @@ void STOP(struct gbcc_core *gbc)
 {
 	uint8_t key1 = gbcc_memory_read_force(gbc, KEY1);
 	if (gbc->mode == GBC && check_bit(key1, 0)) {
+		/* The DIV edge detectors change bit, and ticks change length */
+		gbcc_link_cable_sync(gbc);
+		gbcc_timer_sync(gbc);
 		gbc->cpu.double_speed = !gbc->cpu.double_speed;
+		gbcc_timer_schedule(gbc);
+		gbcc_link_cable_schedule(gbc);
 		key1 = gbc->cpu.double_speed * bit(7);
 		gbcc_memory_write_force(gbc, KEY1, key1);
 	} else {
@@ -254,9 +375,7 @@ void STOP(struct gbcc_core *gbc)
 void HALT(struct gbcc_core *gbc)
 {
 	struct cpu *cpu = &gbc->cpu;
-	uint8_t iereg = gbcc_memory_read(gbc, IE);
-	uint8_t ifreg = gbcc_memory_read(gbc, IF);
-	bool interrupt = (uint8_t)(iereg & ifreg) & 0x1Fu;
+	bool interrupt = gbc->pending_interrupts;
 	if (cpu->ime) {
 		/* HALT proceeds normally */
 		cpu->halt.set = true;
@@ -364,7 +483,7 @@ void LD_REG_REG(struct gbcc_core *gbc)
 		/* Use ld d,d as a debug statement */
 		gbcc_print_registers(gbc, true);
 	}
-	WRITE_OPERAND_DIV(gbc, 0x40u, READ_OPERAND_MOD(gbc));
+	WRITE_OPERAND_DIV(gbc, READ_OPERAND_MOD(gbc));
 	done(&gbc->cpu);
 }
 
@@ -376,7 +495,7 @@ void LD_REG_HL(struct gbcc_core *gbc)
 			YIELD
 		case 1:
 			cpu->instruction.op1 = READ_OPERAND_MOD(gbc);
-			WRITE_OPERAND_DIV(gbc, 0x40u, cpu->instruction.op1);
+			WRITE_OPERAND_DIV(gbc, cpu->instruction.op1);
 	}
 	done(cpu);
 }
@@ -389,12 +508,12 @@ void LD_d8(struct gbcc_core *gbc)
 			YIELD
 		case 1:
 			cpu->instruction.op1 = gbcc_fetch_instruction(gbc);
-			if (div_is_hl(cpu, 0x00u)) {
+			if (div_is_hl(cpu)) {
 				YIELD
 			}
 			/* Fall through */
 		case 2:
-			WRITE_OPERAND_DIV(gbc, 0x00u, cpu->instruction.op1);
+			WRITE_OPERAND_DIV(gbc, cpu->instruction.op1);
 	}
 	done(cpu);
 }
@@ -622,6 +741,7 @@ void POP(struct gbcc_core *gbc)
 			cpu->reg.af = tmp;
 			/* Lower 4 bits of AF are always 0 */
 			cpu->reg.af &= 0xFFF0u;
+			cpu->flags.op = GBCC_FLAGS_SYNCED;
 			break;
 		default:
 			gbcc_log_error("Impossible case in PUSH_POP\n");
@@ -649,6 +769,7 @@ void PUSH(struct gbcc_core *gbc)
 					cpu->instruction.op2 = cpu->reg.l;
 					break;
 				case 3:
+					gbcc_sync_flags(cpu);
 					cpu->instruction.op1 = cpu->reg.a;
 					cpu->instruction.op2 = cpu->reg.f;
 					break;
@@ -676,7 +797,7 @@ void ALU_OP(struct gbcc_core *gbc)
 	uint8_t *op1 = &(cpu->reg.a);
 	uint8_t op2;
 	uint8_t tmp;
-	uint8_t offset;
+	uint8_t carry;
 	
 	if (cpu->instruction.step == 0 && mod_is_hl(cpu)) {
 		YIELD
@@ -684,88 +805,47 @@ void ALU_OP(struct gbcc_core *gbc)
 
 	if (cpu->opcode < 0xC0u) {
 		op2 = READ_OPERAND_MOD(gbc);
-		offset = 0x80u;
 	} else {
 		op2 = gbcc_fetch_instruction(gbc);
-		offset = 0xC0u;
 	}
 
-	switch ((cpu->opcode - offset) / 0x08u) {
+	switch (cpu->instruction.div) {
 		case 0: /* ADD */
-			cond_flag(cpu, HF, (((*op1 & 0x0Fu) + (op2 & 0x0Fu)) & 0x10u) == 0x10u);
 			tmp = *op1;
 			*op1 += op2;
-			cond_flag(cpu, ZF, (*op1 == 0));
-			clear_flag(cpu, NF);
-			cond_flag(cpu, CF, *op1 < tmp);
+			lazy_flags(cpu, GBCC_FLAGS_ADD, tmp, op2, 0, *op1);
 			break;
 		case 1: /* ADC */
-			cond_flag(cpu, HF, (((*op1 & 0x0Fu) + (op2 & 0x0Fu) + get_flag(cpu, CF)) & 0x10u) == 0x10u);
-			*op1 += get_flag(cpu, CF);
-			if (*op1 == 0 && get_flag(cpu, CF)) {
-				set_flag(cpu, CF);
-			} else {
-				clear_flag(cpu, CF);
-			}
+			carry = get_flag(cpu, CF);
 			tmp = *op1;
-			*op1 += op2;
-			if (*op1 < tmp) {
-				set_flag(cpu, CF);
-			}
-			cond_flag(cpu, ZF, (*op1 == 0));
-			clear_flag(cpu, NF);
+			*op1 += op2 + carry;
+			lazy_flags(cpu, GBCC_FLAGS_ADD, tmp, op2, carry, *op1);
 			break;
 		case 2: /* SUB */
-			cond_flag(cpu, HF, ((*op1 & 0x0Fu) - (op2 & 0x0Fu)) > 0x0Fu);
 			tmp = *op1;
 			*op1 -= op2;
-			cond_flag(cpu, ZF, (*op1 == 0));
-			set_flag(cpu, NF);
-			cond_flag(cpu, CF, *op1 > tmp);
+			lazy_flags(cpu, GBCC_FLAGS_SUB, tmp, op2, 0, *op1);
 			break;
 		case 3: /* SBC */
-			cond_flag(cpu, HF, ((*op1 & 0x0Fu) - (op2 & 0x0Fu) - get_flag(cpu, CF)) > 0x0Fu);
-			*op1 -= get_flag(cpu, CF);
-			if (*op1 == 0xFF && get_flag(cpu, CF)) {
-				set_flag(cpu, CF);
-			} else {
-				clear_flag(cpu, CF);
-			}
+			carry = get_flag(cpu, CF);
 			tmp = *op1;
-			*op1 -= op2;
-			if (*op1 > tmp) {
-				set_flag(cpu, CF);
-			}
-			cond_flag(cpu, ZF, (*op1 == 0));
-			set_flag(cpu, NF);
+			*op1 -= op2 + carry;
+			lazy_flags(cpu, GBCC_FLAGS_SUB, tmp, op2, carry, *op1);
 			break;
 		case 4: /* AND */
 			*op1 &= op2;
-			cond_flag(cpu, ZF, (*op1 == 0));
-			clear_flag(cpu, NF);
-			set_flag(cpu, HF);
-			clear_flag(cpu, CF);
+			set_flags(cpu, (uint8_t)((*op1 == 0) * ZF) | HF);
 			break;
 		case 5: /* XOR */
 			*op1 ^= op2;
-			cond_flag(cpu, ZF, (*op1 == 0));
-			clear_flag(cpu, NF);
-			clear_flag(cpu, HF);
-			clear_flag(cpu, CF);
+			set_flags(cpu, (uint8_t)((*op1 == 0) * ZF));
 			break;
 		case 6: /* OR */
 			*op1 |= op2;
-			cond_flag(cpu, ZF, (*op1 == 0));
-			clear_flag(cpu, NF);
-			clear_flag(cpu, HF);
-			clear_flag(cpu, CF);
+			set_flags(cpu, (uint8_t)((*op1 == 0) * ZF));
 			break;
 		case 7: /* CP */
-			cond_flag(cpu, HF, ((*op1 & 0x0Fu) - (op2 & 0x0Fu)) > 0x0Fu);
-			tmp = *op1 - op2;
-			cond_flag(cpu, ZF, (tmp == 0));
-			set_flag(cpu, NF);
-			cond_flag(cpu, CF, tmp > *op1);
+			lazy_flags(cpu, GBCC_FLAGS_SUB, *op1, op2, 0, *op1 - op2);
 			break;
 		default:
 			gbcc_log_error("Impossible case in ALU_OP\n");
@@ -779,7 +859,7 @@ void INC_DEC_REG(struct gbcc_core *gbc)
 	struct cpu *cpu = &gbc->cpu;
 	uint8_t op;
 
-	switch (cpu->opcode / 0x08u) {
+	switch (cpu->instruction.div) {
 		case 0:
 			op = cpu->reg.b;
 			break;
@@ -811,20 +891,17 @@ void INC_DEC_REG(struct gbcc_core *gbc)
 
 	switch ((cpu->opcode % 0x08u) / 0x05u) {
 		case 0:	/* INC */
-			clear_flag(cpu, NF);
-			cond_flag(cpu, HF, (((op & 0x0Fu) + 1) & 0x10u) == 0x10u);
-			WRITE_OPERAND_DIV(gbc, 0x00u, ++op);
+			lazy_flags(cpu, GBCC_FLAGS_INC, op, 1, get_flag(cpu, CF), op + 1);
+			WRITE_OPERAND_DIV(gbc, ++op);
 			break;
 		case 1:	/* DEC */
-			set_flag(cpu, NF);
-			cond_flag(cpu, HF, (((op & 0x0Fu) - 1) & 0x10u) == 0x10u);
-			WRITE_OPERAND_DIV(gbc, 0x00u, --op);
+			lazy_flags(cpu, GBCC_FLAGS_DEC, op, 1, get_flag(cpu, CF), op - 1);
+			WRITE_OPERAND_DIV(gbc, --op);
 			break;
 		default:
 			gbcc_log_error("Impossible case in INC_DEC_8_BIT\n");
 			return;
 	}
-	cond_flag(cpu, ZF, (op == 0));
 	done(cpu);
 }
 
@@ -841,20 +918,17 @@ void INC_DEC_HL(struct gbcc_core *gbc)
 	uint8_t op = cpu->instruction.op1;
 	switch ((cpu->opcode % 0x08u) / 0x05u) {
 		case 0:	/* INC */
-			clear_flag(cpu, NF);
-			cond_flag(cpu, HF, (((op & 0x0Fu) + 1) & 0x10u) == 0x10u);
-			WRITE_OPERAND_DIV(gbc, 0x00u, ++op);
+			lazy_flags(cpu, GBCC_FLAGS_INC, op, 1, get_flag(cpu, CF), op + 1);
+			WRITE_OPERAND_DIV(gbc, ++op);
 			break;
 		case 1:	/* DEC */
-			set_flag(cpu, NF);
-			cond_flag(cpu, HF, (((op & 0x0Fu) - 1) & 0x10u) == 0x10u);
-			WRITE_OPERAND_DIV(gbc, 0x00u, --op);
+			lazy_flags(cpu, GBCC_FLAGS_DEC, op, 1, get_flag(cpu, CF), op - 1);
+			WRITE_OPERAND_DIV(gbc, --op);
 			break;
 		default:
 			gbcc_log_error("Impossible case in INC_DEC_8_BIT\n");
 			return;
 	}
-	cond_flag(cpu, ZF, (op == 0));
 	done(cpu);
 }
 
@@ -956,7 +1030,7 @@ void SHIFT_A(struct gbcc_core *gbc)
 	uint8_t *op = &(cpu->reg.a);
 	uint8_t tmp;
 
-	switch (cpu->opcode / 0x08u) {
+	switch (cpu->instruction.div) {
 		case 0:	/* RLC */
 			cond_flag(cpu, CF, (*op & 0x80u) >> 7u);
 			*op = (uint8_t)(*op << 1u) | (uint8_t)(*op >> 7u);
@@ -1000,7 +1074,9 @@ void JP(struct gbcc_core *gbc)
 			cpu->instruction.op2 = gbcc_fetch_instruction(gbc);
 			YIELD
 	}
-	cpu->reg.pc = cat_bytes(cpu->instruction.op1, cpu->instruction.op2);
+	uint16_t addr = cat_bytes(cpu->instruction.op1, cpu->instruction.op2);
+	gbcc_idle_jump(gbc, cpu->reg.pc - 3, addr);
+	cpu->reg.pc = addr;
 	done(cpu);
 }
 
@@ -1039,6 +1115,7 @@ void JP_COND(struct gbcc_core *gbc)
 					break;
 			}
 			if (jp) {
+				gbcc_idle_jump(gbc, cpu->reg.pc - 3, cpu->instruction.addr);
 				cpu->reg.pc = cpu->instruction.addr;
 				YIELD
 			} else {
@@ -1058,6 +1135,7 @@ void JR(struct gbcc_core *gbc)
 			cpu->instruction.op1 = gbcc_fetch_instruction(gbc);
 			YIELD
 		case 2:
+			gbcc_idle_jump(gbc, cpu->reg.pc - 2, cpu->reg.pc + (int8_t)cpu->instruction.op1);
 			cpu->reg.pc += (int8_t)cpu->instruction.op1;
 	}
 	done(cpu);
@@ -1066,6 +1144,7 @@ void JR(struct gbcc_core *gbc)
 void JR_COND(struct gbcc_core *gbc)
 {
 	struct cpu *cpu = &gbc->cpu;
+	bool jr = false;
 	switch (cpu->instruction.step) {
 		case 0:
 			YIELD
@@ -1078,33 +1157,26 @@ void JR_COND(struct gbcc_core *gbc)
 	}
 	switch ((cpu->opcode - 0x20u) / 0x08u) {
 		case 0:	/* JR NZ */
-			if (!get_flag(cpu, ZF)) {
-				cpu->reg.pc += (int8_t)cpu->instruction.op1;
-				YIELD
-			}
+			jr = !get_flag(cpu, ZF);
 			break;
 		case 1:	/* JR Z */
-			if (get_flag(cpu, ZF)) {
-				cpu->reg.pc += (int8_t)cpu->instruction.op1;
-				YIELD
-			}
+			jr = get_flag(cpu, ZF);
 			break;
 		case 2:	/* JR NC */
-			if (!get_flag(cpu, CF)) {
-				cpu->reg.pc += (int8_t)cpu->instruction.op1;
-				YIELD
-			}
+			jr = !get_flag(cpu, CF);
 			break;
 		case 3:	/* JR C */
-			if (get_flag(cpu, CF)) {
-				cpu->reg.pc += (int8_t)cpu->instruction.op1;
-				YIELD
-			}
+			jr = get_flag(cpu, CF);
 			break;
 		default:
 			gbcc_log_error("Impossible case in JR_COND\n");
 			return;
 	}
+	if (jr) {
+		gbcc_idle_jump(gbc, cpu->reg.pc - 2, cpu->reg.pc + (int8_t)cpu->instruction.op1);
+		cpu->reg.pc += (int8_t)cpu->instruction.op1;
+		YIELD
+	}
 	done(cpu);
 }
 
@@ -1278,6 +1350,8 @@ void PREFIX_CB(struct gbcc_core *gbc)
 			YIELD
 		case 1:
 			cpu->opcode = gbcc_fetch_instruction(gbc);
+			cpu->instruction.mod = cpu->opcode & 0x07u;
+			cpu->instruction.div = (cpu->opcode >> 3u) & 0x07u;
 			break;
 	}
 	switch (cpu->opcode / 0x40u) {
@@ -1313,7 +1387,7 @@ void CB_SHIFT_OP(struct gbcc_core *gbc)
 	uint8_t op = cpu->instruction.op1;
 	uint8_t tmp;
 
-	switch (cpu->opcode / 0x08u) {
+	switch (cpu->instruction.div) {
 		case 0:	/* RLC */
 			cond_flag(cpu, CF, check_bit(op, 7));
 			op = (uint8_t)(op << 1u) | (uint8_t)(op >> 7u);
@@ -1367,7 +1441,7 @@ void CB_BIT(struct gbcc_core *gbc)
 		YIELD
 	}
 	uint8_t op = READ_OPERAND_MOD(gbc);
-	uint8_t b = (cpu->opcode - 0x40u) / 0x08u;
+	uint8_t b = cpu->instruction.div;
 
 	cond_flag(cpu, ZF, !check_bit(op, b));
 	clear_flag(cpu, NF);
@@ -1389,7 +1463,7 @@ void CB_RES(struct gbcc_core *gbc)
 	} else {
 		cpu->instruction.op1 = READ_OPERAND_MOD(gbc);
 	}
-	uint8_t b = (cpu->opcode - 0x80u) / 0x08u;
+	uint8_t b = cpu->instruction.div;
 
 	WRITE_OPERAND_MOD(gbc, clear_bit(cpu->instruction.op1, b));
 	done(cpu);
@@ -1409,7 +1483,7 @@ void CB_SET(struct gbcc_core *gbc)
 	} else {
 		cpu->instruction.op1 = READ_OPERAND_MOD(gbc);
 	}
-	uint8_t b = (cpu->opcode - 0xC0u) / 0x08u;
+	uint8_t b = cpu->instruction.div;
 
 	WRITE_OPERAND_MOD(gbc, set_bit(cpu->instruction.op1, b));
 	done(cpu);
@@ -1421,7 +1495,7 @@ uint8_t READ_OPERAND_MOD(struct gbcc_core *gbc)
 {
 	struct cpu *cpu = &gbc->cpu;
 	uint8_t ret;
-	switch (cpu->opcode % 0x08u) {
+	switch (cpu->instruction.mod) {
 		case 0:
 			return cpu->reg.b;
 		case 1:
@@ -1447,7 +1521,7 @@ uint8_t READ_OPERAND_MOD(struct gbcc_core *gbc)
 void WRITE_OPERAND_MOD(struct gbcc_core *gbc, uint8_t val)
 {
 	struct cpu *cpu = &gbc->cpu;
-	switch (cpu->opcode % 0x08u) {
+	switch (cpu->instruction.mod) {
 		case 0:
 			cpu->reg.b = val;
 			break;
@@ -1475,10 +1549,10 @@ void WRITE_OPERAND_MOD(struct gbcc_core *gbc, uint8_t val)
 	}
 }
 
-void WRITE_OPERAND_DIV(struct gbcc_core *gbc, uint8_t offset, uint8_t val)
+void WRITE_OPERAND_DIV(struct gbcc_core *gbc, uint8_t val)
 {
 	struct cpu *cpu = &gbc->cpu;
-	switch ((cpu->opcode - offset) / 0x08u) {
+	switch (cpu->instruction.div) {
 		case 0:
 			cpu->reg.b = val;
 			break;
@@ -1508,12 +1582,12 @@ void WRITE_OPERAND_DIV(struct gbcc_core *gbc, uint8_t offset, uint8_t val)
 
 bool mod_is_hl(struct cpu *cpu)
 {
-	return (cpu->opcode % 0x08u) == 6;
+	return cpu->instruction.mod == 6;
 }
 
-bool div_is_hl(struct cpu *cpu, uint8_t offset)
+bool div_is_hl(struct cpu *cpu)
 {
-	return (cpu->opcode - offset) / 0x08u == 6;
+	return cpu->instruction.div == 6;
 }
 
 void done(struct cpu *cpu)
@@ -16,6 +16,9 @@
 
 extern void (*const gbcc_ops[0x100])(struct gbcc_core *gbc);
 extern const uint8_t gbcc_op_times[0x100];
+extern const uint8_t gbcc_op_sizes[0x100];
+
+void gbcc_sync_flags(struct cpu *cpu);
 
 /* Not really an opcode, but behaves like a cpu instruction */
 void INTERRUPT(struct gbcc_core *gbc);
@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2017-2020 Philip Jones
+ *
+ * Licensed under the MIT License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/licenses/MIT
+ *
+ */
+
+#include "pacer.h"
+#include "constants.h"
+#include "debug.h"
+#include "time_diff.h"
+#include <errno.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * Deadlines come every 16th of a frame (~1ms), rather than every frame, so
+ * that the audio ring is filled at a steady rate.
+ */
+#define SLICE_CLOCKS (GBC_FRAME_CLOCKS / 16)
+/*
+ * How long before the deadline at the end of each frame to stop sleeping &
+ * start spinning. Other deadlines don't spin at all.
+ */
+#define SPIN_TIME (SECOND / 10000)
+/*
+ * If we're ever this far behind (e.g. after being paused or stopped in a
+ * debugger), start again from now rather than racing to catch up.
+ */
+#define RESYNC_TIME (SECOND / 10)
+
+static uint64_t now(void);
+static void resync(struct gbcc_pacer *pacer, uint64_t time);
+static void sleep_until(uint64_t time, uint64_t spin);
+
+/*
+ * Called with the number of cycles just run, and the speed to run them at
+ * (1 for normal speed). A speed of 0 turns pacing off.
+ */
+void gbcc_pacer_update(struct gbcc_pacer *pacer, uint32_t cycles, float speed)
+{
+	if (speed <= 0) {
+		pacer->speed = 0;
+		return;
+	}
+	if (speed != pacer->speed) {
+		pacer->speed = speed;
+		resync(pacer, now());
+	}
+	pacer->pending += cycles;
+	if (pacer->pending < SLICE_CLOCKS) {
+		return;
+	}
+	/* Only spin when a frame's worth of cycles has just been crossed */
+	bool frame = (pacer->cycles + pacer->pending) / GBC_FRAME_CLOCKS
+		!= pacer->cycles / GBC_FRAME_CLOCKS;
+	pacer->cycles += pacer->pending;
+	pacer->pending = 0;
+
+	double seconds = (double)pacer->cycles / (GBC_CLOCK_FREQ * (double)speed);
+	uint64_t deadline = pacer->base + (uint64_t)(seconds * SECOND);
+	uint64_t time = now();
+	if (time > deadline + RESYNC_TIME) {
+		pacer->resyncs++;
+		resync(pacer, time);
+		return;
+	}
+	if (time < deadline) {
+		sleep_until(deadline, frame ? SPIN_TIME : 0);
+		time = now();
+	}
+	uint64_t late = time - deadline;
+	pacer->waits++;
+	pacer->jitter_sum += (double)late;
+	pacer->jitter_sum_sq += (double)late * (double)late;
+	if (late > pacer->jitter_max) {
+		pacer->jitter_max = late;
+	}
+}
+
+void gbcc_pacer_print_stats(const struct gbcc_pacer *pacer)
+{
+	if (pacer->waits == 0) {
+		return;
+	}
+	double mean = pacer->jitter_sum / (double)pacer->waits;
+	double var = pacer->jitter_sum_sq / (double)pacer->waits - mean * mean;
+	gbcc_log_info("Frame pacing: %llu waits, %llu resyncs, "
+			"lateness mean %.1fus, sd %.1fus, max %.1fus\n",
+			(unsigned long long)pacer->waits,
+			(unsigned long long)pacer->resyncs,
+			mean / 1000,
+			sqrt(var > 0 ? var : 0) / 1000,
+			(double)pacer->jitter_max / 1000);
+}
+
+uint64_t now(void)
+{
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return (uint64_t)time.tv_sec * SECOND + (uint64_t)time.tv_nsec;
+}
+
+void resync(struct gbcc_pacer *pacer, uint64_t time)
+{
+	pacer->base = time;
+	pacer->cycles = 0;
+}
+
+void sleep_until(uint64_t time, uint64_t spin)
+{
+	if (time > spin) {
+		uint64_t wake = time - spin;
+		struct timespec ts = {
+			.tv_sec = (time_t)(wake / SECOND),
+			.tv_nsec = (long)(wake % SECOND)
+		};
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+			/* Interrupted by a signal, so go back to sleep */
+		}
+	}
+	while (now() < time) {
+		/* Spin */
+	}
+}
@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) 2017-2020 Philip Jones
+ *
+ * Licensed under the MIT License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/licenses/MIT
+ *
+ */
+
+#ifndef GBCC_PACER_H
+#define GBCC_PACER_H
+
+#include <stdint.h>
+
+/*
+ * Keeps emulation running at a given multiple of real Game Boy speed, when
+ * nothing else (Vsync or the sound card) is doing so.
+ *
+ * Every slice of emulated time has an absolute deadline on CLOCK_MONOTONIC,
+ * worked out from the total number of cycles run since the pacer was last
+ * resynced, so rounding & oversleeping never accumulate. Most waits just
+ * sleep until their deadline. The one at the end of each frame sleeps until
+ * just before it, and then spins for the rest, as sleeps tend to overshoot
+ * by about that much.
+ *
+ * How late each wait finished is recorded, for gbcc_pacer_print_stats().
+ */
+
+struct gbcc_pacer {
+	uint64_t base;		/* Time of the last resync, in ns */
+	uint64_t cycles;	/* Cycles run since then */
+	uint32_t pending;	/* Cycles run since the last wait */
+	float speed;		/* Speed the base is for, or 0 when not pacing */
+
+	/* Lateness of each wait, in ns */
+	uint64_t waits;
+	uint64_t resyncs;	/* Times we fell too far behind to catch up */
+	uint64_t jitter_max;
+	double jitter_sum;
+	double jitter_sum_sq;
+};
+
+void gbcc_pacer_update(struct gbcc_pacer *pacer, uint32_t cycles, float speed);
+void gbcc_pacer_print_stats(const struct gbcc_pacer *pacer);
+
+#endif /* GBCC_PACER_H */
@@ -13,9 +13,12 @@
 #include "colour.h"
 #include "debug.h"
 #include "gbcc.h"
+#include "interrupt.h"
 #include "memory.h"
 #include "palettes.h"
 #include "ppu.h"
+#include "scheduler.h"
+#include "tile_cache.h"
 #include <stdio.h>
 #include <string.h>
 
@@ -35,38 +38,71 @@
 #define ATTR_COLOUR0 (bit(1))
 #define ATTR_PRIORITY (bit(2))
 
-enum palette_flag { BACKGROUND, SPRITE_1, SPRITE_2 };
-
+/*
+ * Packed pixels (see gbcc_core.packed_frames) are either a raw 15-bit GBC
+ * colour, or 1 + an index into the 12 DMG shades, which go background, OBP0
+ * then OBP1, so that 0 is black in either mode, like an undrawn RGBA frame.
+ * The top bit is only set for blank pixels, which are always white.
+ */
+#define PACKED_BLANK 0x8000u
+static const uint32_t packed_shades[3][4] = {
+	{1, 2, 3, 4},
+	{5, 6, 7, 8},
+	{9, 10, 11, 12}
+};
+
+static void start_line(struct gbcc_core *gbc);
+static void draw_pixel(struct gbcc_core *gbc);
+static void skip_line(struct gbcc_core *gbc);
+static bool skip_next_frame(struct gbcc_core *gbc);
+static bool can_draw_line(struct gbcc_core *gbc);
 static void draw_background_pixel(struct gbcc_core *gbc);
 static void draw_window_pixel(struct gbcc_core *gbc);
 static void draw_sprite_pixel(struct gbcc_core *gbc);
 static void composite_line(struct gbcc_core *gbc);
 static uint8_t get_video_mode(uint8_t stat);
 static uint8_t set_video_mode(uint8_t stat, uint8_t mode);
-static uint32_t get_palette_colour(struct gbcc_core *gbc, uint8_t palette, uint8_t n, enum palette_flag pf);
+static void update_dmg_colours(uint32_t colours[4], const uint32_t shades[4], uint8_t palette);
+static uint32_t cgb_colour(const uint8_t *data);
+static uint32_t packed_cgb_colour(const uint8_t *data);
 static void load_bg_tile(struct gbcc_core *gbc);
 static void load_window_tile(struct gbcc_core *gbc);
 static void load_sprite_tile(struct gbcc_core *gbc, int n);
-static uint8_t get_tile_pixel(uint8_t hi, uint8_t lo, uint8_t x, bool flip);
+static void load_tile_row(struct gbcc_core *gbc, struct tile *t, uint8_t bank, uint16_t offset);
 
 void gbcc_disable_lcd(struct gbcc_core *gbc)
 {
 	struct ppu *ppu = &gbc->ppu;
 	if (gbc->mode == GBC) {
-		memset(ppu->screen.sdl, 0xFFu, GBC_SCREEN_SIZE * sizeof(*ppu->screen.buffer_0));
+		memset(ppu->screen->gbc, 0xFFu, GBC_SCREEN_SIZE * sizeof(*ppu->screen->gbc));
+		gbcc_screen_publish(ppu->screen);
 	} else {
-		uint32_t colour = get_palette_colour(gbc, 0, 0, BACKGROUND);
-		for (int y = 0; y < GBC_SCREEN_HEIGHT; y++) {
-			for (int x = 0; x < GBC_SCREEN_WIDTH; x++) {
-				ppu->screen.sdl[y * GBC_SCREEN_WIDTH + x] = colour;
+		/* Show a blank frame, and start the next one blank too */
+		uint32_t colour = ppu->palette.background[0];
+		for (int i = 0; i < 2; i++) {
+			if (gbc->packed_frames) {
+				uint16_t *pixels = (uint16_t *)ppu->screen->gbc;
+				for (size_t j = 0; j < GBC_SCREEN_SIZE; j++) {
+					pixels[j] = (uint16_t)packed_shades[0][0];
+				}
+			} else {
+				for (int y = 0; y < GBC_SCREEN_HEIGHT; y++) {
+					for (int x = 0; x < GBC_SCREEN_WIDTH; x++) {
+						ppu->screen->gbc[y * GBC_SCREEN_WIDTH + x] = colour;
+					}
+				}
 			}
-		}
-		for (int y = 0; y < GBC_SCREEN_HEIGHT; y++) {
-			for (int x = 0; x < GBC_SCREEN_WIDTH; x++) {
-				ppu->screen.gbc[y * GBC_SCREEN_WIDTH + x] = colour;
+			if (i == 0) {
+				gbcc_screen_publish(ppu->screen);
 			}
 		}
 	}
+	gbcc_ppu_wake(gbc);
+	gbcc_scheduler_remove(gbc, GBCC_EVENT_PPU);
+	if (ppu->line_drawn) {
+		ppu->line_drawn = false;
+		gbcc_memory_update_map(gbc);
+	}
 	ppu->lcd_disable = true;
 	ppu->ly = 0;
 	gbcc_memory_write_force(gbc, LY, 0);
@@ -93,6 +129,175 @@ void gbcc_enable_lcd(struct gbcc_core *gbc)
 	 * (Currently, it skips the first line of the first frame)
 	 */
 	ppu->clock = 248;
+	gbcc_ppu_schedule(gbc);
+}
+
+/*
+ * Most dots don't do anything other than count, so rather than being clocked
+ * every dot, the ppu skips ahead to the next dot on which something can
+ * happen. While it's asleep, ppu->clock holds the value for that dot.
+ */
+void gbcc_ppu_schedule(struct gbcc_core *gbc)
+{
+	struct ppu *ppu = &gbc->ppu;
+	if (ppu->lcd_disable) {
+		return;
+	}
+	uint8_t stat = gbcc_memory_read_force(gbc, STAT);
+	uint32_t wake;
+	switch (get_video_mode(stat)) {
+		case GBC_LCD_MODE_OAM_VRAM_READ:
+			/*
+			 * Idle until the next pixel, or if they've all been
+			 * drawn, until HBLANK.
+			 */
+			wake = ppu->clock;
+			if (ppu->x < GBC_SCREEN_WIDTH) {
+				if (ppu->next_dot > wake) {
+					wake = ppu->next_dot;
+				}
+			} else if (ppu->hblank_dot > wake) {
+				wake = ppu->hblank_dot;
+			}
+			break;
+		case GBC_LCD_MODE_VBLANK:
+			wake = 455;
+			break;
+		default:
+			if (ppu->clock == 0) {
+				wake = 0;
+			} else if (ppu->clock <= 81) {
+				wake = 81;
+			} else {
+				wake = 455;
+			}
+			break;
+	}
+	/* LY resets to 0 early on line 153 */
+	if (ppu->ly == 153 && ppu->clock <= 9 && wake > 9) {
+		wake = 9;
+	}
+	uint64_t when = gbcc_scheduler_next_dot(gbc) + 4u * (wake - ppu->clock);
+	ppu->clock = wake;
+	gbcc_scheduler_add(gbc, GBCC_EVENT_PPU, when);
+}
+
+/*
+ * Bring the ppu back up to date and clock it every dot again, e.g. when a
+ * register affecting the STAT interrupt is written.
+ */
+void gbcc_ppu_wake(struct gbcc_core *gbc)
+{
+	struct ppu *ppu = &gbc->ppu;
+	if (!gbcc_scheduler_pending(gbc, GBCC_EVENT_PPU)) {
+		return;
+	}
+	uint64_t next_dot = gbcc_scheduler_next_dot(gbc);
+	ppu->clock -= (uint32_t)((gbc->scheduler.deadline[GBCC_EVENT_PPU] - next_dot) / 4);
+	gbcc_scheduler_add(gbc, GBCC_EVENT_PPU, next_dot);
+}
+
+/*
+ * Lines are normally drawn all at once as soon as mode 3 starts, as nothing
+ * the ppu reads while drawing usually changes partway through a line. This
+ * must be called before anything which could change that, i.e. writes to
+ * VRAM, the palettes or DMA. If the current line was drawn ahead of time, it's
+ * redrawn up to the current dot, and the rest of it is drawn a dot at a time.
+ */
+void gbcc_ppu_mid_line_write(struct gbcc_core *gbc)
+{
+	struct ppu *ppu = &gbc->ppu;
+	if (!ppu->line_drawn) {
+		return;
+	}
+	gbcc_ppu_wake(gbc);
+	ppu->line_drawn = false;
+	gbcc_memory_update_map(gbc);
+
+	memset(ppu->bg_line.attr, 0, sizeof(ppu->bg_line.attr));
+	memset(ppu->window_line.attr, 0, sizeof(ppu->window_line.attr));
+	memset(ppu->sprite_line.attr, 0, sizeof(ppu->sprite_line.attr));
+	for (int i = 0; i < ppu->n_sprites; i++) {
+		ppu->sprites[i].loaded = false;
+	}
+	ppu->window_ly = ppu->line_window_ly;
+	start_line(gbc);
+	/* ppu->clock is now the next dot to be run */
+	while (ppu->x < GBC_SCREEN_WIDTH && ppu->next_dot < ppu->clock) {
+		draw_pixel(gbc);
+	}
+}
+
+/*
+ * Recalculate the final colour of every palette entry, from either the DMG
+ * palette registers & current shades, or the GBC palette data.
+ */
+void gbcc_ppu_update_colours(struct gbcc_core *gbc)
+{
+	struct ppu *ppu = &gbc->ppu;
+	const uint8_t *ioreg = gbc->memory.ioreg;
+	if (gbc->mode == DMG) {
+		bool packed = gbc->packed_frames;
+		update_dmg_colours(ppu->bg_colours[0],
+				packed ? packed_shades[0] : ppu->palette.background,
+				ioreg[BGP - IOREG_START]);
+		update_dmg_colours(ppu->ob_colours[0],
+				packed ? packed_shades[1] : ppu->palette.sprite2,
+				ioreg[OBP0 - IOREG_START]);
+		update_dmg_colours(ppu->ob_colours[1],
+				packed ? packed_shades[2] : ppu->palette.sprite1,
+				ioreg[OBP1 - IOREG_START]);
+		return;
+	}
+	for (uint8_t i = 0; i < 64; i += 2) {
+		gbcc_ppu_update_cgb_colour(gbc, false, i);
+		gbcc_ppu_update_cgb_colour(gbc, true, i);
+	}
+}
+
+/* Called after byte index of the GBC background or sprite palettes changes */
+void gbcc_ppu_update_cgb_colour(struct gbcc_core *gbc, bool sprite, uint8_t index)
+{
+	struct ppu *ppu = &gbc->ppu;
+	if (gbc->mode == DMG) {
+		return;
+	}
+	index &= 0x3Eu;
+	uint32_t (*convert)(const uint8_t *) = gbc->packed_frames ? packed_cgb_colour : cgb_colour;
+	if (sprite) {
+		ppu->ob_colours[index / 8][(index % 8) / 2] = convert(&ppu->obp[index]);
+	} else {
+		ppu->bg_colours[index / 8][(index % 8) / 2] = convert(&ppu->bgp[index]);
+	}
+}
+
+/* The RGBA colours of the 12 DMG shades indexed by packed pixels */
+void gbcc_ppu_packed_shades(const struct gbcc_core *gbc, uint32_t shades[12])
+{
+	const struct palette *palette = &gbc->ppu.palette;
+	for (uint8_t n = 0; n < 4; n++) {
+		shades[n] = palette->background[n];
+		shades[4 + n] = palette->sprite2[n];
+		shades[8 + n] = palette->sprite1[n];
+	}
+}
+
+/* Convert a packed frame to RGBA, for when the shaders can't do it */
+void gbcc_ppu_unpack_frame(const struct gbcc_core *gbc, const uint16_t *packed, uint32_t *rgba)
+{
+	uint32_t shades[12];
+	gbcc_ppu_packed_shades(gbc, shades);
+	for (size_t i = 0; i < GBC_SCREEN_SIZE; i++) {
+		uint16_t pixel = packed[i];
+		if (pixel & PACKED_BLANK) {
+			rgba[i] = 0xFFFFFFFFu;
+		} else if (gbc->mode == DMG) {
+			rgba[i] = pixel ? shades[MIN(pixel, 12) - 1] : 0;
+		} else {
+			uint8_t data[2] = {(uint8_t)(pixel & 0xFFu), (uint8_t)(pixel >> 8u)};
+			rgba[i] = cgb_colour(data);
+		}
+	}
 }
 
 ANDROID_INLINE
@@ -167,36 +372,42 @@ void gbcc_ppu_clock(struct gbcc_core *gbc)
 
 		/* Start the actual rendering of this line */
 		stat = set_video_mode(stat, GBC_LCD_MODE_OAM_VRAM_READ);
-		ppu->x = 0;
-		load_bg_tile(gbc);
-		/*
-		 * Rendering at the beginning of a scanline pauses if
-		 * SCX % 8 != 0, while the ppu discards offscreen pixels
-		 */
-		/*
-		 * TODO: As far as I can tell, the magic number here should be
-		 * 89, as mode 3 begins at 81 dots, with an 8 dot pause while
-		 * the first background tile is fetched. This breaks Mooneye's
-		 * intr_2_mode0 test however, which suggests that mode 3 is not
-		 * taking long enough.
-		 */
-		ppu->next_dot = 94 + ppu->scx % 8;
-		ppu->bg_tile.x = ppu->scx % 8;
-		ppu->window_tile.x = 0;
+		ppu->line_window_ly = ppu->window_ly;
+		start_line(gbc);
+		if (can_draw_line(gbc)) {
+			/*
+			 * Draw the whole line now, rather than waking up for
+			 * every pixel. VRAM writes are sent through
+			 * gbcc_ppu_mid_line_write() until it's finished.
+			 */
+			if (ppu->skip_frame) {
+				skip_line(gbc);
+			} else {
+				while (ppu->x < GBC_SCREEN_WIDTH) {
+					draw_pixel(gbc);
+				}
+			}
+			ppu->line_drawn = true;
+			gbcc_memory_update_map(gbc);
+		}
 	}
 	if (get_video_mode(stat) == GBC_LCD_MODE_OAM_VRAM_READ) {
 		if (ppu->x == 160) {
-			stat = set_video_mode(stat, GBC_LCD_MODE_HBLANK);
-			composite_line(gbc);
-			if (gbc->hdma.hblank && gbc->hdma.length > 0) {
-				gbc->hdma.to_copy = 0x10u;
+			if (ppu->clock >= ppu->hblank_dot) {
+				stat = set_video_mode(stat, GBC_LCD_MODE_HBLANK);
+				if (!ppu->skip_frame) {
+					composite_line(gbc);
+				}
+				if (ppu->line_drawn) {
+					ppu->line_drawn = false;
+					gbcc_memory_update_map(gbc);
+				}
+				if (gbc->hdma.hblank && gbc->hdma.length > 0) {
+					gbc->hdma.to_copy = 0x10u;
+				}
 			}
 		} else if (ppu->clock == ppu->next_dot) {
-			draw_background_pixel(gbc);
-			draw_window_pixel(gbc);
-			draw_sprite_pixel(gbc);
-			ppu->x++;
-			ppu->next_dot++;
+			draw_pixel(gbc);
 		}
 	}
 	
@@ -225,18 +436,23 @@ void gbcc_ppu_clock(struct gbcc_core *gbc)
 	
 	/* VBLANK interrupt flag */
 	if (ppu->ly == 144 && ppu->clock == 0) {
-		gbcc_memory_set_bit(gbc, IF, 0);
+		gbcc_interrupt_request(gbc, 0);
 		stat = set_video_mode(stat, GBC_LCD_MODE_VBLANK);
 
+		/*
+		 * The hand-off itself never waits; this only paces emulation
+		 * to the display when asked to.
+		 */
 		if (gbc->sync_to_video && !gbc->keys.turbo) {
 			sem_wait(&ppu->vsync_semaphore);
 		}
 
-		uint32_t *tmp = ppu->screen.gbc;
-		ppu->screen.gbc = ppu->screen.sdl;
-		ppu->screen.sdl = tmp;
+		if (!ppu->skip_frame) {
+			gbcc_screen_publish(ppu->screen);
+		}
 
 		ppu->frame++;
+		ppu->skip_frame = skip_next_frame(gbc);
 
 		/*
 		 * Apparently, the window "remembers" how many lines it drew
@@ -285,13 +501,112 @@ void gbcc_ppu_clock(struct gbcc_core *gbc)
 	if (mode_interrupt || (check_bit(stat, 2) && check_bit(stat, 6)) /* LY = LYC */) {
 		if (!ppu->last_stat) {
 			ppu->last_stat = true;
-			gbcc_memory_set_bit(gbc, IF, 1);
+			gbcc_interrupt_request(gbc, 1);
 		}
 	} else {
 		ppu->last_stat = false;
 	}
 	gbcc_memory_write_force(gbc, LY, ppu->ly);
 	gbcc_memory_write_force(gbc, STAT, stat);
+	gbcc_ppu_schedule(gbc);
+}
+
+/* Set up for drawing the first pixel of the line, at the start of mode 3 */
+void start_line(struct gbcc_core *gbc)
+{
+	struct ppu *ppu = &gbc->ppu;
+	ppu->x = 0;
+	load_bg_tile(gbc);
+	/*
+	 * Rendering at the beginning of a scanline pauses if
+	 * SCX % 8 != 0, while the ppu discards offscreen pixels
+	 */
+	/*
+	 * TODO: As far as I can tell, the magic number here should be
+	 * 89, as mode 3 begins at 81 dots, with an 8 dot pause while
+	 * the first background tile is fetched. This breaks Mooneye's
+	 * intr_2_mode0 test however, which suggests that mode 3 is not
+	 * taking long enough.
+	 */
+	ppu->next_dot = 94 + ppu->scx % 8;
+	ppu->bg_tile.x = ppu->scx % 8;
+	ppu->window_tile.x = 0;
+}
+
+/* Draw the pixel at ppu->x, on dot ppu->next_dot */
+void draw_pixel(struct gbcc_core *gbc)
+{
+	struct ppu *ppu = &gbc->ppu;
+	ppu->hblank_dot = ppu->next_dot + 1;
+	draw_background_pixel(gbc);
+	draw_window_pixel(gbc);
+	draw_sprite_pixel(gbc);
+	ppu->x++;
+	ppu->next_dot++;
+}
+
+/*
+ * Run through the line without drawing it, for frames that won't be shown.
+ * Only the parts of drawing that affect timing or later lines are kept: each
+ * sprite delays the rest of the line when it's first reached, and the window
+ * counts the lines it's been drawn on.
+ */
+void skip_line(struct gbcc_core *gbc)
+{
+	struct ppu *ppu = &gbc->ppu;
+	bool window = ppu->ly >= ppu->wy && check_bit(ppu->lcdc, 5)
+		&& (gbc->mode == GBC || check_bit(ppu->lcdc, 0));
+	/* See draw_window_pixel() */
+	if (window && ppu->wx < GBC_SCREEN_WIDTH + 7) {
+		ppu->window_ly++;
+	}
+	if (ppu->n_sprites == 0 || !check_bit(ppu->lcdc, 1)) {
+		ppu->next_dot += GBC_SCREEN_WIDTH - ppu->x;
+		ppu->hblank_dot = ppu->next_dot;
+		ppu->x = GBC_SCREEN_WIDTH;
+		return;
+	}
+	while (ppu->x < GBC_SCREEN_WIDTH) {
+		ppu->hblank_dot = ppu->next_dot + 1;
+		draw_sprite_pixel(gbc);
+		ppu->x++;
+		ppu->next_dot++;
+	}
+}
+
+/*
+ * Called at the start of each frame in turbo mode, to decide whether it's
+ * worth drawing. With automatic frame skip, a frame is only drawn once the
+ * renderer has taken the previous one, as otherwise it would just be replaced
+ * unseen.
+ */
+bool skip_next_frame(struct gbcc_core *gbc)
+{
+	struct ppu *ppu = &gbc->ppu;
+	if (!gbc->keys.turbo || gbc->frame_skip == 0) {
+		ppu->frames_skipped = 0;
+		return false;
+	}
+	if (gbc->frame_skip == GBCC_FRAME_SKIP_AUTO) {
+		return gbcc_screen_pending(ppu->screen);
+	}
+	if (ppu->frames_skipped < gbc->frame_skip) {
+		ppu->frames_skipped++;
+		return true;
+	}
+	ppu->frames_skipped = 0;
+	return false;
+}
+
+/*
+ * Whether the line can be drawn in one go. OAM DMA changes whether sprites are
+ * drawn without any writes the ppu would see, so lines where it's running are
+ * always drawn a dot at a time.
+ */
+bool can_draw_line(struct gbcc_core *gbc)
+{
+	const struct cpu *cpu = &gbc->cpu;
+	return !(cpu->dma.timer > 0 || cpu->dma.requested || cpu->dma.running);
 }
 
 /* TODO: GBC BG-to-OAM Priority */
@@ -303,14 +618,10 @@ void draw_background_pixel(struct gbcc_core *gbc)
 		load_bg_tile(gbc);
 	}
 
-	uint8_t colour = get_tile_pixel(t->hi, t->lo, t->x, check_bit(t->attr, 5));
-	uint8_t palette;
-	if (gbc->mode == DMG) {
-		palette = gbcc_memory_read_force(gbc, BGP);
-	} else {
-		palette = t->attr & 0x07u;
-	}
-	ppu->bg_line.colour[ppu->x] = get_palette_colour(gbc, palette, colour, BACKGROUND);
+	uint8_t colour = t->pixels[t->x];
+	/* DMG tiles have no attributes, so this is always 0 */
+	uint8_t palette = t->attr & 0x07u;
+	ppu->bg_line.colour[ppu->x] = ppu->bg_colours[palette][colour];
 
 	uint8_t attr = ATTR_DRAWN;
 	if (colour == 0) {
@@ -347,14 +658,10 @@ void draw_window_pixel(struct gbcc_core *gbc)
 		}
 	}
 
-	uint8_t colour = get_tile_pixel(t->hi, t->lo, t->x, check_bit(t->attr, 5));
-	uint8_t palette;
-	if (gbc->mode == DMG) {
-		palette = gbcc_memory_read_force(gbc, BGP);
-	} else {
-		palette = t->attr & 0x07u;
-	}
-	ppu->window_line.colour[ppu->x] = get_palette_colour(gbc, palette, colour, BACKGROUND);
+	uint8_t colour = t->pixels[t->x];
+	/* DMG tiles have no attributes, so this is always 0 */
+	uint8_t palette = t->attr & 0x07u;
+	ppu->window_line.colour[ppu->x] = ppu->bg_colours[palette][colour];
 	uint8_t attr = ATTR_DRAWN;
 	if (colour == 0) {
 		attr |= ATTR_COLOUR0;
@@ -403,26 +710,18 @@ void draw_sprite_pixel(struct gbcc_core *gbc)
 			ppu->next_dot += 11 - MIN(5, (ppu->x + ppu->scx) % 8);
 		}
 		uint8_t x = ppu->x + 8 - s->x;
-		uint8_t colour = get_tile_pixel(s->tile.hi, s->tile.lo, x, check_bit(s->tile.attr, 5));
+		uint8_t colour = s->tile.pixels[x];
 		/* Colour 0 is transparent */
 		if (!colour) {
 			continue;
 		}
 		uint8_t palette;
-		enum palette_flag pf;
 		if (gbc->mode == DMG) {
-			if (check_bit(s->tile.attr, 4)) {
-				palette = gbcc_memory_read_force(gbc, OBP1);
-				pf = SPRITE_1;
-			} else {
-				palette = gbcc_memory_read_force(gbc, OBP0);
-				pf = SPRITE_2;
-			}
+			palette = check_bit(s->tile.attr, 4);
 		} else {
 			palette = s->tile.attr & 0x07u;
-			pf = SPRITE_1;
 		}
-		ppu->sprite_line.colour[ppu->x] = get_palette_colour(gbc, palette, colour, pf);
+		ppu->sprite_line.colour[ppu->x] = ppu->ob_colours[palette][colour];
 		uint8_t attr = ATTR_DRAWN;
 		if (check_bit(s->tile.attr, 7)) {
 			attr |= ATTR_PRIORITY;
@@ -443,7 +742,9 @@ void composite_line(struct gbcc_core *gbc)
 	 */
 	struct ppu *ppu = &gbc->ppu;
 	uint8_t ly = ppu->ly;
-	uint32_t *line = &ppu->screen.gbc[ly * GBC_SCREEN_WIDTH];
+	/* Packed lines are composited as normal, then narrowed */
+	uint32_t packed_line[GBC_SCREEN_WIDTH];
+	uint32_t *line = gbc->packed_frames ? packed_line : &ppu->screen->gbc[ly * GBC_SCREEN_WIDTH];
 
 	if (!gbc->hide_background) {
 		memcpy(line, ppu->bg_line.colour, GBC_SCREEN_WIDTH * sizeof(line[0]));
@@ -485,6 +786,12 @@ void composite_line(struct gbcc_core *gbc)
 			line[x] = ppu->sprite_line.colour[x];
 		}
 	}
+	if (gbc->packed_frames) {
+		uint16_t *out = (uint16_t *)ppu->screen->gbc + ly * GBC_SCREEN_WIDTH;
+		for (uint8_t x = 0; x < GBC_SCREEN_WIDTH; x++) {
+			out[x] = (uint16_t)line[x];
+		}
+	}
 }
 
 uint8_t get_video_mode(uint8_t stat)
@@ -499,35 +806,18 @@ uint8_t set_video_mode(uint8_t stat, uint8_t mode)
 	return stat;
 }
 
-uint32_t get_palette_colour(struct gbcc_core *gbc, uint8_t palette, uint8_t n, enum palette_flag pf)
+void update_dmg_colours(uint32_t colours[4], const uint32_t shades[4], uint8_t palette)
 {
-	struct ppu *ppu = &gbc->ppu;
-	if (gbc->mode == DMG) {
-		uint8_t colours[4] = {
-			(palette & 0x03u) >> 0u,
-			(palette & 0x0Cu) >> 2u,
-			(palette & 0x30u) >> 4u,
-			(palette & 0xC0u) >> 6u
-		};
-		switch (pf) {
-			case BACKGROUND:
-				return ppu->palette.background[colours[n]];
-			case SPRITE_1:
-				return ppu->palette.sprite1[colours[n]];
-			case SPRITE_2:
-				return ppu->palette.sprite2[colours[n]];
-		}
+	for (uint8_t n = 0; n < 4; n++) {
+		colours[n] = shades[(palette >> (2 * n)) & 0x03u];
 	}
-	uint8_t index = palette * 8;
-	uint8_t lo;
-	uint8_t hi;
-	if (pf == BACKGROUND) {
-		lo = ppu->bgp[index + 2 * n];
-		hi = ppu->bgp[index + 2 * n + 1];
-	} else {
-		lo = ppu->obp[index + 2 * n];
-		hi = ppu->obp[index + 2 * n + 1];
-	} 
+}
+
+/* Convert a little-endian 15-bit GBC colour to RGBA */
+uint32_t cgb_colour(const uint8_t *data)
+{
+	uint8_t lo = data[0];
+	uint8_t hi = data[1];
 	uint8_t r = lo & 0x1Fu;
 	uint8_t g = ((lo & 0xE0u) >> 5u) | (uint8_t)((hi & 0x03u) << 3u);
 	uint8_t b = (hi & 0x7Cu) >> 2u;
@@ -540,6 +830,12 @@ uint32_t get_palette_colour(struct gbcc_core *gbc, uint8_t palette, uint8_t n, e
 	return res;
 }
 
+/* A GBC colour as a packed pixel, which is just the colour itself */
+uint32_t packed_cgb_colour(const uint8_t *data)
+{
+	return (uint32_t)data[0] | ((uint32_t)(data[1] & 0x7Fu) << 8u);
+}
+
 void load_bg_tile(struct gbcc_core *gbc)
 {
 	struct ppu *ppu = &gbc->ppu;
@@ -563,19 +859,13 @@ void load_bg_tile(struct gbcc_core *gbc)
 		} else {
 			tile_addr = (uint16_t)(0x9000 + 16 * (int8_t)tile);
 		}
-		ppu->bg_tile.lo = gbcc_memory_read_force(gbc, tile_addr + line_offset);
-		ppu->bg_tile.hi = gbcc_memory_read_force(gbc, tile_addr + line_offset + 1);
 		ppu->bg_tile.attr = 0;
+		load_tile_row(gbc, &ppu->bg_tile, 0, tile_addr - VRAM_START + line_offset);
 	} else {
 		uint8_t tile = gbc->memory.vram_bank[0][map + 32 * ty + tx - VRAM_START];
 		ppu->bg_tile.attr = gbc->memory.vram_bank[1][map + 32 * ty + tx - VRAM_START];
-		uint8_t *vbk;
+		uint8_t bank = check_bit(ppu->bg_tile.attr, 3);
 		uint16_t tile_addr;
-		if (check_bit(ppu->bg_tile.attr, 3)) {
-			vbk = gbc->memory.vram_bank[1];
-		} else {
-			vbk = gbc->memory.vram_bank[0];
-		}
 		if (check_bit(ppu->lcdc, 4)) {
 			tile_addr = 16 * tile;
 		} else {
@@ -583,11 +873,9 @@ void load_bg_tile(struct gbcc_core *gbc)
 		}
 		/* Check for Y-flip */
 		if (check_bit(ppu->bg_tile.attr, 6)) {
-			ppu->bg_tile.lo = vbk[tile_addr + (14 - line_offset)];
-			ppu->bg_tile.hi = vbk[tile_addr + (14 - line_offset) + 1];
+			load_tile_row(gbc, &ppu->bg_tile, bank, tile_addr + (14 - line_offset));
 		} else {
-			ppu->bg_tile.lo = vbk[tile_addr + line_offset];
-			ppu->bg_tile.hi = vbk[tile_addr + line_offset + 1];
+			load_tile_row(gbc, &ppu->bg_tile, bank, tile_addr + line_offset);
 		}
 	}
 }
@@ -615,19 +903,13 @@ void load_window_tile(struct gbcc_core *gbc)
 		} else {
 			tile_addr = (uint16_t)(0x9000 + 16 * (int8_t)tile);
 		}
-		ppu->window_tile.lo = gbcc_memory_read_force(gbc, tile_addr + line_offset);
-		ppu->window_tile.hi = gbcc_memory_read_force(gbc, tile_addr + line_offset + 1);
 		ppu->window_tile.attr = 0;
+		load_tile_row(gbc, &ppu->window_tile, 0, tile_addr - VRAM_START + line_offset);
 	} else {
 		uint8_t tile = gbc->memory.vram_bank[0][map + 32 * ty + tx - VRAM_START];
 		ppu->window_tile.attr = gbc->memory.vram_bank[1][map + 32 * ty + tx - VRAM_START];
-		uint8_t *vbk;
+		uint8_t bank = check_bit(ppu->window_tile.attr, 3);
 		uint16_t tile_addr;
-		if (check_bit(ppu->window_tile.attr, 3)) {
-			vbk = gbc->memory.vram_bank[1];
-		} else {
-			vbk = gbc->memory.vram_bank[0];
-		}
 		if (check_bit(ppu->lcdc, 4)) {
 			tile_addr = 16 * tile;
 		} else {
@@ -635,11 +917,9 @@ void load_window_tile(struct gbcc_core *gbc)
 		}
 		/* Check for Y-flip */
 		if (check_bit(ppu->window_tile.attr, 6)) {
-			ppu->window_tile.lo = vbk[tile_addr + (14 - line_offset)];
-			ppu->window_tile.hi = vbk[tile_addr + (14 - line_offset) + 1];
+			load_tile_row(gbc, &ppu->window_tile, bank, tile_addr + (14 - line_offset));
 		} else {
-			ppu->window_tile.lo = vbk[tile_addr + line_offset];
-			ppu->window_tile.hi = vbk[tile_addr + line_offset + 1];
+			load_tile_row(gbc, &ppu->window_tile, bank, tile_addr + line_offset);
 		}
 	}
 }
@@ -661,11 +941,9 @@ void load_sprite_tile(struct gbcc_core *gbc, int n)
 	t->attr = gbcc_memory_read_force(gbc, ppu->sprites[n].address + 3);
 	bool yflip = check_bit(t->attr, 6);
 	uint8_t sprite_line = sy - ly;
-	uint8_t *vram_bank;
-	if (gbc->mode == DMG) {
-		vram_bank = gbc->memory.vram_bank[0];
-	} else {
-		vram_bank = gbc->memory.vram_bank[check_bit(t->attr, 3)];
+	uint8_t bank = 0;
+	if (gbc->mode != DMG) {
+		bank = check_bit(t->attr, 3);
 	}
 	if (double_size) {
 		/* 
@@ -687,16 +965,14 @@ void load_sprite_tile(struct gbcc_core *gbc, int n)
 	} else {
 		sprite_line = 16 - sprite_line;
 	}
-	t->lo = vram_bank[16 * tile + 2 * sprite_line];
-	t->hi = vram_bank[16 * tile + 2 * sprite_line + 1];
+	load_tile_row(gbc, t, bank, 16 * tile + 2 * sprite_line);
 	t->x = 0;
 	ppu->sprites[n].loaded = true;
 }
 
-uint8_t get_tile_pixel(uint8_t hi, uint8_t lo, uint8_t x, bool flip)
+/* Fetch the row starting at offset in the given VRAM bank, flipped by t->attr */
+void load_tile_row(struct gbcc_core *gbc, struct tile *t, uint8_t bank, uint16_t offset)
 {
-	if (!flip) {
-		x = 7 - x;
-	}
-	return (uint8_t)(check_bit(hi, x) << 1u) | check_bit(lo, x);
+	const uint8_t *row = gbcc_tile_cache_row(gbc, bank, offset, check_bit(t->attr, 5));
+	memcpy(t->pixels, row, sizeof(t->pixels));
 }
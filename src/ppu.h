@@ -13,10 +13,14 @@
 
 #include "constants.h"
 #include "palettes.h"
+#include "screen.h"
 #include <semaphore.h>
 #include <stdbool.h>
 #include <stdint.h>
 
+/* Skip frames whenever the renderer hasn't yet picked up the last one */
+#define GBCC_FRAME_SKIP_AUTO -1
+
 struct gbcc_core;
 
 struct line_buffer {
@@ -25,8 +29,7 @@ struct line_buffer {
 };
 
 struct tile {
-	uint8_t hi;
-	uint8_t lo;
+	uint8_t pixels[8];	/* Colour indices of the current row */
 	uint8_t x;
 	uint8_t attr;
 };
@@ -46,15 +49,13 @@ struct ppu {
 	uint8_t bgp[64]; 	/* 8 x 8-byte palettes */
 	uint8_t obp[64]; 	/* 8 x 8-byte palettes */
 	struct palette palette;
+	/* Final colour of each palette entry, updated as the palettes change */
+	uint32_t bg_colours[8][4];
+	uint32_t ob_colours[8][4];	/* DMG uses 0 & 1 for OBP0 & OBP1 */
 	struct line_buffer bg_line;
 	struct line_buffer window_line;
 	struct line_buffer sprite_line;
-	struct {
-		uint32_t *buffer_0;
-		uint32_t *buffer_1;
-		uint32_t *gbc;
-		uint32_t *sdl;
-	} screen;
+	struct gbcc_screen *screen;
 	sem_t vsync_semaphore;
 
 	/* Copies of IOREG data */
@@ -70,7 +71,12 @@ struct ppu {
 	bool last_stat;
 	uint8_t x;
 	uint8_t window_ly;
+	uint8_t line_window_ly;	/* window_ly at the start of mode 3 */
 	uint16_t next_dot;
+	uint16_t hblank_dot;	/* Dot mode 3 ends on, once x reaches 160 */
+	bool line_drawn;	/* Line was drawn in one go at the start of mode 3 */
+	bool skip_frame;	/* Frame won't be shown, so only its timing is run */
+	uint8_t frames_skipped;	/* In a row, for a fixed frame skip */
 	uint8_t n_sprites;
 	struct sprite sprites[10];
 	struct tile bg_tile;
@@ -78,6 +84,13 @@ struct ppu {
 };
 
 void gbcc_ppu_clock(struct gbcc_core *gbc);
+void gbcc_ppu_schedule(struct gbcc_core *gbc);
+void gbcc_ppu_wake(struct gbcc_core *gbc);
+void gbcc_ppu_mid_line_write(struct gbcc_core *gbc);
+void gbcc_ppu_update_colours(struct gbcc_core *gbc);
+void gbcc_ppu_update_cgb_colour(struct gbcc_core *gbc, bool sprite, uint8_t index);
+void gbcc_ppu_packed_shades(const struct gbcc_core *gbc, uint32_t shades[12]);
+void gbcc_ppu_unpack_frame(const struct gbcc_core *gbc, const uint16_t *packed, uint32_t *rgba);
 void gbcc_disable_lcd(struct gbcc_core *gbc);
 void gbcc_enable_lcd(struct gbcc_core *gbc);
 
@@ -8,10 +8,10 @@
  *
  */
 
-#include "../bit_utils.h"
 #include "../debug.h"
 #include "../printer.h"
 #include "../printer_platform.h"
+#include "../tile_decode.h"
 #include "../audio.h"
 
 #include <pthread.h>
@@ -68,10 +68,10 @@ bool print_strip(struct printer *p)
 		uint8_t ty = (uint8_t)((line + p->print_line) / 8);
 		for (uint8_t tx = 0; tx < PRINTER_WIDTH_TILES; tx++) {
 			uint16_t idx = ty * PRINTER_WIDTH_TILES * 16 + tx * 16 + (uint8_t)(line + p->print_line - ty * 8) * 2;
-			uint8_t lo = p->image_buffer.data[idx];
-			uint8_t hi = p->image_buffer.data[idx + 1];
+			uint8_t pixels[8];
+			gbcc_tile_decode_row(p->image_buffer.data[idx], p->image_buffer.data[idx + 1], pixels);
 			for (uint8_t x = 0; x < 8; x++) {
-				switch (gbcc_printer_get_palette_colour(p, (uint8_t)(check_bit(hi, 7 - x) << 1u) | check_bit(lo, 7 - x))) {
+				switch (gbcc_printer_get_palette_colour(p, pixels[x])) {
 					case 0:
 						printf("█");
 						break;
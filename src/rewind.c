@@ -0,0 +1,454 @@
+/*
+ * Copyright (C) 2017-2020 Philip Jones
+ *
+ * Licensed under the MIT License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/licenses/MIT
+ *
+ */
+
+#include "rewind.h"
+#include "constants.h"
+#include "debug.h"
+#include "state.h"
+#include "time_diff.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Frames between snapshots, which is also how far each step goes back */
+#define INTERVAL 2
+/* Snapshots between keyframes, each of which costs a full state's worth */
+#define KEYFRAME_INTERVAL 60
+/* Enough for ~9 minutes at 2 frames per snapshot */
+#define MAX_ENTRIES 8192
+
+/*
+ * Encoded snapshots are a series of blocks, each starting with a control
+ * byte c:
+ * 	0x00 - 0x7F: c + 1 literal bytes follow
+ * 	0x80 - 0xFE: the next byte, repeated c - 0x80 + MIN_RUN times
+ * 	0xFF: a 16-bit little-endian count, & then the byte to repeat
+ */
+#define MAX_LITERAL 128
+#define MIN_RUN 3
+#define MAX_SHORT_RUN (0xFE - 0x80 + MIN_RUN)
+#define MAX_RUN 0xFFFF
+/* Worst case, everything is literals */
+#define ENCODED_SIZE(size) ((size) + (size) / MAX_LITERAL + 1)
+
+static bool reserve(struct gbcc_rewind *rewind, size_t size);
+static void capture(struct gbcc_rewind *rewind, struct gbcc_core *core);
+static void store(struct gbcc_rewind *rewind, size_t length, size_t size, bool keyframe);
+static bool restore(struct gbcc_rewind *rewind, struct gbcc_core *core, size_t idx);
+static void drop_oldest(struct gbcc_rewind *rewind);
+static void drop_newest(struct gbcc_rewind *rewind);
+static size_t ring_used(const struct gbcc_rewind *rewind);
+static void xor_into(uint8_t *dst, const uint8_t *src, size_t size);
+static size_t run_length(const uint8_t *src, size_t size);
+static size_t encode(uint8_t *dst, const uint8_t *src, size_t size);
+static size_t encode_literal(uint8_t *dst, const uint8_t *src, size_t size);
+static bool decode_xor(uint8_t *dst, size_t size, const uint8_t *src, size_t length);
+
+bool gbcc_rewind_initialise(struct gbcc_rewind *rewind)
+{
+	if (rewind->budget == 0) {
+		return true;
+	}
+	rewind->ring = malloc(rewind->budget);
+	rewind->entries = calloc(MAX_ENTRIES, sizeof(*rewind->entries));
+	if (!rewind->ring || !rewind->entries) {
+		gbcc_log_error("Failed to allocate %zu bytes for rewind, "
+				"turning it off.\n", rewind->budget);
+		gbcc_rewind_destroy(rewind);
+		rewind->budget = 0;
+		return false;
+	}
+	rewind->tail = 0;
+	rewind->first = 0;
+	rewind->count = 0;
+	rewind->clock = 0;
+	rewind->need_keyframe = true;
+	return true;
+}
+
+void gbcc_rewind_destroy(struct gbcc_rewind *rewind)
+{
+	free(rewind->ring);
+	free(rewind->entries);
+	free(rewind->state);
+	free(rewind->keyframe);
+	free(rewind->packed);
+	rewind->ring = NULL;
+	rewind->entries = NULL;
+	rewind->state = NULL;
+	rewind->keyframe = NULL;
+	rewind->packed = NULL;
+	rewind->capacity = 0;
+	rewind->count = 0;
+}
+
+/* Called with the number of cycles just run forward */
+void gbcc_rewind_update(struct gbcc_rewind *rewind, struct gbcc_core *core, uint32_t cycles)
+{
+	if (!rewind->ring) {
+		return;
+	}
+	rewind->clock += cycles;
+	if (rewind->clock < INTERVAL * GBC_FRAME_CLOCKS) {
+		return;
+	}
+	rewind->clock = 0;
+	capture(rewind, core);
+}
+
+/*
+ * Go back to the newest snapshot, & forget it so that the next step goes
+ * further back. The oldest snapshot is kept, so rewinding stops there.
+ *
+ * Returns false if there was nothing to go back to.
+ */
+bool gbcc_rewind_step(struct gbcc_rewind *rewind, struct gbcc_core *core)
+{
+	if (rewind->count == 0) {
+		return false;
+	}
+	size_t newest = (rewind->first + rewind->count - 1) % MAX_ENTRIES;
+	if (!restore(rewind, core, newest)) {
+		gbcc_log_error("Failed to restore rewind snapshot.\n");
+		return false;
+	}
+	if (rewind->count > 1) {
+		drop_newest(rewind);
+	}
+	/* The keyframe we were encoding against may have just gone */
+	rewind->need_keyframe = true;
+	rewind->clock = 0;
+	return true;
+}
+
+void gbcc_rewind_print_stats(const struct gbcc_rewind *rewind)
+{
+	if (rewind->captures == 0) {
+		return;
+	}
+	double captures = (double)rewind->captures;
+	size_t memory = rewind->budget
+		+ MAX_ENTRIES * sizeof(*rewind->entries)
+		+ 2 * rewind->capacity
+		+ ENCODED_SIZE(rewind->capacity);
+	gbcc_log_info("Rewind: %llu snapshots, %llu keyframes, "
+			"%.1fKiB state encoded to %.1fKiB mean, "
+			"capture mean %.1fus, max %.1fus\n",
+			(unsigned long long)rewind->captures,
+			(unsigned long long)rewind->keyframes,
+			(double)rewind->state_bytes / captures / 1024,
+			(double)rewind->encoded_bytes / captures / 1024,
+			(double)rewind->time_sum / captures / 1000,
+			(double)rewind->time_max / 1000);
+	gbcc_log_info("Rewind: %zu snapshots (%.1fs) held, "
+			"ring peak %.2f of %.2fMiB, %.2fMiB in total\n",
+			rewind->count,
+			(double)(rewind->count * INTERVAL * GBC_FRAME_CLOCKS) / GBC_CLOCK_FREQ,
+			(double)rewind->peak_used / (1024 * 1024),
+			(double)rewind->budget / (1024 * 1024),
+			(double)memory / (1024 * 1024));
+}
+
+/* Make sure the scratch buffers can hold a state of the given size */
+bool reserve(struct gbcc_rewind *rewind, size_t size)
+{
+	if (size <= rewind->capacity) {
+		return true;
+	}
+	uint8_t *state = realloc(rewind->state, size);
+	if (state) {
+		rewind->state = state;
+	}
+	uint8_t *keyframe = realloc(rewind->keyframe, size);
+	if (keyframe) {
+		rewind->keyframe = keyframe;
+	}
+	uint8_t *packed = realloc(rewind->packed, ENCODED_SIZE(size));
+	if (packed) {
+		rewind->packed = packed;
+	}
+	if (!state || !keyframe || !packed) {
+		gbcc_log_error("Failed to allocate rewind buffers.\n");
+		return false;
+	}
+	rewind->capacity = size;
+	/* Whatever the keyframe was, it's not the same size any more */
+	rewind->keyframe_size = 0;
+	return true;
+}
+
+void capture(struct gbcc_rewind *rewind, struct gbcc_core *core)
+{
+	struct timespec start;
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	size_t size = gbcc_state_size(core);
+	if (!reserve(rewind, size)) {
+		return;
+	}
+	if (gbcc_state_save_to(core, rewind->state, size) != size) {
+		gbcc_log_error("Failed to take rewind snapshot.\n");
+		return;
+	}
+	bool keyframe = rewind->need_keyframe
+		|| rewind->since_keyframe >= KEYFRAME_INTERVAL
+		|| size != rewind->keyframe_size;
+	if (keyframe) {
+		memcpy(rewind->keyframe, rewind->state, size);
+		rewind->keyframe_size = size;
+		rewind->since_keyframe = 0;
+		rewind->need_keyframe = false;
+		rewind->keyframes++;
+	} else {
+		xor_into(rewind->state, rewind->keyframe, size);
+		rewind->since_keyframe++;
+	}
+	size_t length = encode(rewind->packed, rewind->state, size);
+	store(rewind, length, size, keyframe);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	uint64_t time = gbcc_time_diff(&end, &start);
+	rewind->captures++;
+	rewind->state_bytes += size;
+	rewind->encoded_bytes += length;
+	rewind->time_sum += time;
+	if (time > rewind->time_max) {
+		rewind->time_max = time;
+	}
+	size_t used = ring_used(rewind);
+	if (used > rewind->peak_used) {
+		rewind->peak_used = used;
+	}
+}
+
+/* Copy the encoded snapshot in packed to the ring, making room for it */
+void store(struct gbcc_rewind *rewind, size_t length, size_t size, bool keyframe)
+{
+	if (length > rewind->budget) {
+		gbcc_log_error("Rewind snapshot of %zu bytes doesn't fit in "
+				"%zu.\n", length, rewind->budget);
+		rewind->need_keyframe = true;
+		return;
+	}
+	size_t pos = rewind->tail;
+	if (pos + length > rewind->budget) {
+		/*
+		 * Wrap round to the start. Everything after the tail is older
+		 * than everything before it, so has to go first.
+		 */
+		while (rewind->count > 0 && rewind->entries[rewind->first].offset >= rewind->tail) {
+			drop_oldest(rewind);
+		}
+		pos = 0;
+	}
+	while (rewind->count > 0) {
+		const struct gbcc_rewind_entry *oldest = &rewind->entries[rewind->first];
+		bool overlaps = oldest->offset < pos + length
+			&& pos < oldest->offset + oldest->length;
+		if (!overlaps && rewind->count < MAX_ENTRIES) {
+			break;
+		}
+		drop_oldest(rewind);
+	}
+	if (!keyframe && rewind->count == 0) {
+		/* The keyframe this was against has just been dropped */
+		rewind->need_keyframe = true;
+		return;
+	}
+	memcpy(&rewind->ring[pos], rewind->packed, length);
+	struct gbcc_rewind_entry *entry = &rewind->entries[(rewind->first + rewind->count) % MAX_ENTRIES];
+	entry->offset = pos;
+	entry->length = (uint32_t)length;
+	entry->size = (uint32_t)size;
+	entry->keyframe = keyframe;
+	rewind->count++;
+	rewind->tail = pos + length;
+}
+
+/* Decode the snapshot in entry idx into state, & load it */
+bool restore(struct gbcc_rewind *rewind, struct gbcc_core *core, size_t idx)
+{
+	const struct gbcc_rewind_entry *entry = &rewind->entries[idx];
+	/* The oldest entry is always a keyframe, so this always finds one */
+	size_t k = idx;
+	while (!rewind->entries[k].keyframe) {
+		k = (k + MAX_ENTRIES - 1) % MAX_ENTRIES;
+	}
+	const struct gbcc_rewind_entry *key = &rewind->entries[k];
+	if (key->size != entry->size || entry->size > rewind->capacity) {
+		return false;
+	}
+	memset(rewind->state, 0, entry->size);
+	if (!decode_xor(rewind->state, key->size, &rewind->ring[key->offset], key->length)) {
+		return false;
+	}
+	if (k != idx && !decode_xor(rewind->state, entry->size, &rewind->ring[entry->offset], entry->length)) {
+		return false;
+	}
+	return gbcc_state_load_from(core, rewind->state, entry->size);
+}
+
+/* Drop the oldest keyframe, along with all the snapshots that depend on it */
+void drop_oldest(struct gbcc_rewind *rewind)
+{
+	do {
+		rewind->first = (rewind->first + 1) % MAX_ENTRIES;
+		rewind->count--;
+	} while (rewind->count > 0 && !rewind->entries[rewind->first].keyframe);
+	if (rewind->count == 0) {
+		rewind->tail = 0;
+	}
+}
+
+void drop_newest(struct gbcc_rewind *rewind)
+{
+	rewind->count--;
+	if (rewind->count == 0) {
+		rewind->tail = 0;
+		return;
+	}
+	const struct gbcc_rewind_entry *newest = &rewind->entries[(rewind->first + rewind->count - 1) % MAX_ENTRIES];
+	rewind->tail = newest->offset + newest->length;
+}
+
+/* Bytes of the ring in use, including any gap left at the end by a wrap */
+size_t ring_used(const struct gbcc_rewind *rewind)
+{
+	if (rewind->count == 0) {
+		return 0;
+	}
+	size_t head = rewind->entries[rewind->first].offset;
+	if (head < rewind->tail) {
+		return rewind->tail - head;
+	}
+	return rewind->budget - head + rewind->tail;
+}
+
+/*
+ * This & run_length() work a word at a time, as they're most of the cost of
+ * a snapshot, and the compiler won't do it for us at -O2.
+ */
+void xor_into(uint8_t *dst, const uint8_t *src, size_t size)
+{
+	size_t i = 0;
+	for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+		uint64_t a;
+		uint64_t b;
+		memcpy(&a, &dst[i], sizeof(a));
+		memcpy(&b, &src[i], sizeof(b));
+		a ^= b;
+		memcpy(&dst[i], &a, sizeof(a));
+	}
+	for (; i < size; i++) {
+		dst[i] ^= src[i];
+	}
+}
+
+/* How many of the first size bytes of src are the same as the first */
+size_t run_length(const uint8_t *src, size_t size)
+{
+	uint64_t pattern = src[0] * 0x0101010101010101ull;
+	size_t n = 1;
+	while (n + sizeof(uint64_t) <= size) {
+		uint64_t word;
+		memcpy(&word, &src[n], sizeof(word));
+		if (word != pattern) {
+			break;
+		}
+		n += sizeof(uint64_t);
+	}
+	while (n < size && src[n] == src[0]) {
+		n++;
+	}
+	return n;
+}
+
+/* Returns the encoded length, which is at most ENCODED_SIZE(size) */
+size_t encode(uint8_t *dst, const uint8_t *src, size_t size)
+{
+	size_t out = 0;
+	size_t literal = 0;	/* Start of the bytes not yet written */
+	size_t i = 0;
+	while (i < size) {
+		size_t left = size - i;
+		size_t run = run_length(&src[i], left < MAX_RUN ? left : MAX_RUN);
+		if (run < MIN_RUN) {
+			i += run;
+			continue;
+		}
+		out += encode_literal(&dst[out], &src[literal], i - literal);
+		if (run <= MAX_SHORT_RUN) {
+			dst[out++] = (uint8_t)(0x80 + run - MIN_RUN);
+		} else {
+			dst[out++] = 0xFF;
+			dst[out++] = (uint8_t)(run & 0xFFu);
+			dst[out++] = (uint8_t)(run >> 8u);
+		}
+		dst[out++] = src[i];
+		i += run;
+		literal = i;
+	}
+	out += encode_literal(&dst[out], &src[literal], size - literal);
+	return out;
+}
+
+size_t encode_literal(uint8_t *dst, const uint8_t *src, size_t size)
+{
+	size_t out = 0;
+	while (size > 0) {
+		size_t n = size < MAX_LITERAL ? size : MAX_LITERAL;
+		dst[out++] = (uint8_t)(n - 1);
+		memcpy(&dst[out], src, n);
+		out += n;
+		src += n;
+		size -= n;
+	}
+	return out;
+}
+
+/* XOR the decoded bytes into dst, which must be exactly size bytes long */
+bool decode_xor(uint8_t *dst, size_t size, const uint8_t *src, size_t length)
+{
+	size_t in = 0;
+	size_t out = 0;
+	while (in < length) {
+		uint8_t c = src[in++];
+		if (c < 0x80) {
+			size_t n = c + 1u;
+			if (in + n > length || out + n > size) {
+				return false;
+			}
+			xor_into(&dst[out], &src[in], n);
+			in += n;
+			out += n;
+			continue;
+		}
+		size_t n = c - 0x80u + MIN_RUN;
+		if (c == 0xFF) {
+			if (in + 2 > length) {
+				return false;
+			}
+			n = src[in] | (size_t)src[in + 1] << 8u;
+			in += 2;
+		}
+		if (in + 1 > length || out + n > size) {
+			return false;
+		}
+		uint8_t byte = src[in++];
+		if (byte != 0) {
+			for (size_t i = 0; i < n; i++) {
+				dst[out + i] ^= byte;
+			}
+		}
+		out += n;
+	}
+	return out == size;
+}
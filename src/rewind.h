@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2017-2020 Philip Jones
+ *
+ * Licensed under the MIT License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/licenses/MIT
+ *
+ */
+
+#ifndef GBCC_REWIND_H
+#define GBCC_REWIND_H
+
+#include "core.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Rewind history.
+ *
+ * Every few frames, a savestate is taken & stored in a ring of fixed size,
+ * so memory use never grows past the budget, and the oldest snapshots are
+ * dropped to make room. Most snapshots are stored as the XOR of the state
+ * with the last keyframe, which is almost all zeroes, and then run-length
+ * encoded. Keyframes are the same against a state of all zeroes.
+ *
+ * Stepping back restores the newest snapshot, by decoding its keyframe and
+ * XORing in its delta, and then drops it, so holding the rewind key walks
+ * back through the history.
+ */
+
+/* Largest budget that can be asked for, in MiB */
+#define GBCC_REWIND_MAX_MIB 4096
+
+struct gbcc_rewind_entry {
+	size_t offset;		/* Of the encoded snapshot in the ring */
+	uint32_t length;	/* Of the encoded snapshot */
+	uint32_t size;		/* Of the state it decodes to */
+	bool keyframe;
+};
+
+struct gbcc_rewind {
+	size_t budget;		/* Bytes for the ring, or 0 to turn rewind off */
+	bool active;		/* Stepping back rather than running forward */
+
+	uint8_t *ring;
+	size_t tail;		/* Where the next snapshot goes */
+	struct gbcc_rewind_entry *entries;
+	size_t first;		/* Index of the oldest entry */
+	size_t count;
+
+	/* Scratch space, all capacity bytes long */
+	uint8_t *state;
+	uint8_t *keyframe;	/* The last keyframe, decoded */
+	uint8_t *packed;	/* Encoded snapshots are built here */
+	size_t capacity;
+	size_t keyframe_size;
+	uint32_t since_keyframe;
+	bool need_keyframe;
+	uint32_t clock;		/* Cycles since the last snapshot */
+
+	/* Stats */
+	uint64_t captures;
+	uint64_t keyframes;
+	uint64_t encoded_bytes;
+	uint64_t state_bytes;
+	uint64_t time_sum;	/* Time spent taking snapshots, in ns */
+	uint64_t time_max;
+	size_t peak_used;	/* Most of the ring ever in use */
+};
+
+bool gbcc_rewind_initialise(struct gbcc_rewind *rewind);
+void gbcc_rewind_destroy(struct gbcc_rewind *rewind);
+void gbcc_rewind_update(struct gbcc_rewind *rewind, struct gbcc_core *core, uint32_t cycles);
+bool gbcc_rewind_step(struct gbcc_rewind *rewind, struct gbcc_core *core);
+void gbcc_rewind_print_stats(const struct gbcc_rewind *rewind);
+
+#endif /* GBCC_REWIND_H */
@@ -10,8 +10,9 @@
 
 #include "core.h"
 #include "debug.h"
-#include "memory.h"
 #include "save.h"
+#include "state.h"
+#include "state_legacy.h"
 #include <errno.h>
 #include <inttypes.h>
 #include <stdio.h>
@@ -30,7 +31,6 @@
 static void get_save_basename(struct gbcc *gbc, char savename[MAX_NAME_LEN]);
 static void strip_ext(char *fname);
 static const char *gbcc_basename(const char *fname);
-static bool read_v7_struct(struct gbcc_core *gbc, FILE *f);
 
 void gbcc_save(struct gbcc *gbc)
 {
@@ -161,13 +161,24 @@ void gbcc_save_state(struct gbcc *gbc)
 		free(fname);
 		return;
 	}
-	fwrite(core, sizeof(struct gbcc_core), 1, sav);
-	if (core->cart.ram_size > 0) {
-		fwrite(core->cart.ram, 1, core->cart.ram_size, sav);
+	size_t size = gbcc_state_size(core);
+	uint8_t *data = malloc(size);
+	bool saved = false;
+	if (data) {
+		size = gbcc_state_save_to(core, data, size);
+		saved = size > 0 && fwrite(data, 1, size, sav) == size;
+		free(data);
+	}
+	if (fclose(sav) != 0) {
+		saved = false;
+	}
+	if (saved) {
+		snprintf(tmp, MAX_NAME_LEN, "Saved state %d", gbc->save_state);
+		gbcc_log_info("Saved state %s\n", fname);
+	} else {
+		snprintf(tmp, MAX_NAME_LEN, "Failed to save state %d", gbc->save_state);
+		gbcc_log_error("Error writing %s\n", fname);
 	}
-	fclose(sav);
-	snprintf(tmp, MAX_NAME_LEN, "Saved state %d", gbc->save_state);
-	gbcc_log_info("Saved state %s\n", fname);
 	gbcc_window_show_message(gbc, tmp, 2, true);
 	gbc->save_state = 0;
 	gbc->load_state = 0;
@@ -201,48 +212,19 @@ void gbcc_load_state(struct gbcc *gbc)
 		free(fname);
 		return;
 	}
-	uint32_t old_version = 0;
-	if (fread(&old_version, 4, 1, sav) != 1) {
-		gbcc_log_error("Couldn't read save state version.\n");
-		fclose(sav);
-		free(tmp);
-		free(fname);
-		return;
-	}
-	rewind(sav);
-	/* Hardcoded check, should be updated when updating the core version */
-	if (old_version != 7 && old_version != core->version) {
-		gbcc_log_error("Save state %d version mismatch, tried "
-				"to load v%u (current version is v%u).\n",
-				gbc->load_state,
-				old_version,
-				core->version);
-		snprintf(tmp, MAX_NAME_LEN, "Save state %d version "
-				"mismatch:\n have v%u, loaded v%u",
-				gbc->load_state,
-				core->version,
-				old_version);
-		gbcc_window_show_message(gbc, tmp, 2, true);
-		gbc->save_state = 0;
-		gbc->load_state = 0;
-		fclose(sav);
-		free(tmp);
-		free(fname);
-		return;
-	}
-
-	struct gbcc_core *tmp_core = calloc(1, sizeof(*tmp_core));
-	bool read_success = false;
 
-	/* Hardcoded check, should be updated when updating the core version */
-	if (old_version == 7 && gbc->core.version == 8) {
-		read_success = read_v7_struct(tmp_core, sav);
-	} else {
-		read_success = (fread(tmp_core, sizeof(struct gbcc_core), 1, sav) == 1);
+	uint8_t *data = NULL;
+	long size = -1;
+	if (fseek(sav, 0, SEEK_END) == 0) {
+		size = ftell(sav);
+		rewind(sav);
+	}
+	if (size > 0) {
+		data = malloc((size_t)size);
 	}
-	if (!read_success) {
+	if (!data || fread(data, 1, (size_t)size, sav) != (size_t)size) {
 		gbcc_log_error("Error reading %s: %s\n", fname, strerror(errno));
-		free(tmp_core);
+		free(data);
 		fclose(sav);
 		gbc->save_state = 0;
 		gbc->load_state = 0;
@@ -250,99 +232,25 @@ void gbcc_load_state(struct gbcc *gbc)
 		free(fname);
 		return;
 	}
-
-	/*
-	 * Load the sram data from the savestate if there is any, and then we
-	 * can safely close the file
-	 * */
-	if (core->cart.ram_size > 0) {
-		if (fread(core->cart.ram, 1, core->cart.ram_size, sav) != core->cart.ram_size) {
-			gbcc_log_error("Error reading %s: %s\n", fname, strerror(errno));
-			free(tmp_core);
-			fclose(sav);
-			gbc->save_state = 0;
-			gbc->load_state = 0;
-			free(tmp);
-			free(fname);
-			return;
-		}
-	}
 	fclose(sav);
 
-	/*
-	 * Now that we've loaded the struct, we need to make sure all pointers
-	 * are updated to be correct. This is done roughly in order of
-	 * definition within "core.h"
-	 */
-
-	/* cpu */
-	/* No pointers */
-
-	/* apu */
-	/* No pointers */
-
-	/* ppu */
-	tmp_core->ppu.screen.buffer_0 = core->ppu.screen.buffer_0;
-	tmp_core->ppu.screen.buffer_1 = core->ppu.screen.buffer_1;
-	tmp_core->ppu.screen.gbc = core->ppu.screen.gbc;
-	tmp_core->ppu.screen.sdl = core->ppu.screen.sdl;
-
-	/* cart */
-	/* No pointers in the mbc */
-	tmp_core->cart.filename = core->cart.filename;
-	tmp_core->cart.rom = core->cart.rom;
-	tmp_core->cart.ram = core->cart.ram;
-
-	/* memory */
-	/*
-	 * We first need to work out which banks the wram & vram are set to.
-	 * This can safely be done before the rest of memory is initialised as
-	 * the io registers are an array in the struct, so we've already loaded
-	 * them.
-	 */
-	uint8_t wram_bank;
-	uint8_t vram_bank;
-	switch (tmp_core->mode) {
-		case DMG:
-			wram_bank = 1;
-			vram_bank = 0;
-			break;
-		case GBC:
-			wram_bank = gbcc_memory_read(tmp_core, SVBK) & 0x07u;
-			vram_bank = gbcc_memory_read(tmp_core, VBK) & 0x01u;
-			break;
-	}
-
-	tmp_core->memory.rom0 = core->cart.rom;
-	tmp_core->memory.romx = core->cart.rom + tmp_core->cart.mbc.romx_bank * ROMX_SIZE;
-	tmp_core->memory.vram = core->memory.vram_bank[vram_bank];
-	if (tmp_core->cart.ram != NULL) {
-		tmp_core->memory.sram = core->cart.ram + tmp_core->cart.mbc.sram_bank * SRAM_SIZE;
+	uint32_t old_version = gbcc_state_legacy_version(data, (size_t)size);
+	if (gbcc_state_load_from(core, data, (size_t)size)) {
+		snprintf(tmp, MAX_NAME_LEN, "Loaded state %d", gbc->load_state);
+		gbcc_log_info("Loaded state %s\n", fname);
+	} else if (old_version != 0 && old_version < GBCC_STATE_LEGACY_MIN_VERSION) {
+		snprintf(tmp, MAX_NAME_LEN, "Save state %d version "
+				"mismatch:\n loaded v%u",
+				gbc->load_state,
+				old_version);
 	} else {
-		tmp_core->memory.sram = NULL;
+		snprintf(tmp, MAX_NAME_LEN, "Couldn't load state %d", gbc->load_state);
 	}
-	tmp_core->memory.wram0 = core->memory.wram_bank[0];
-	tmp_core->memory.wramx = core->memory.wram_bank[wram_bank];
-	tmp_core->memory.echo = core->memory.wram0;
-
-	/* printer */
-	/* No pointers */
-
-	/* Reset some things that shouldn't be saved */
-	memset(&tmp_core->keys, 0, sizeof(tmp_core->keys));
-	tmp_core->sync_to_video = core->sync_to_video;
-	tmp_core->error_msg = NULL;
-
-	/* Perform the actual switch */
-	*core = *tmp_core;
-	free(tmp_core);
-
-	snprintf(tmp, MAX_NAME_LEN, "Loaded state %d", gbc->load_state);
 	gbcc_window_show_message(gbc, tmp, 2, true);
-	gbcc_log_info("Loaded state %s\n", fname);
 
 	gbc->save_state = 0;
 	gbc->load_state = 0;
+	free(data);
 	free(tmp);
 	free(fname);
 }
@@ -418,24 +326,3 @@ const char *gbcc_basename(const char *fname)
 	const char *ret = strrchr(fname, PATH_SEP);
 	return ret ? ret + 1 : fname;
 }
-
-/*
- * In-place conversion from the previous core struct version to this one.
- * This is a dirty hack, but the alternative is trusting users to not rely on
- * savestates when upgrading.
- * Proper serialisation of the core struct would be nice....
- * WARNING: This needs to be updated when changing the core version.
- */
-bool read_v7_struct(struct gbcc_core *gbc, FILE *f)
-{
-	/*
-	 * v8 added cheats - luckily we can just ignore the lost values this
-	 * time, as they don't matter, and re-zero the cheats struct.
-	 */
-	size_t old_size = sizeof(*gbc) - sizeof(gbc->cheats);
-	bool success = fread(gbc, old_size, 1, f) == 1;
-	memset(&gbc->cheats, 0, sizeof(gbc->cheats));
-	gbc->version = GBCC_SAVE_STATE_VERSION;
-	gbc->initialised = true;
-	return success;
-}
@@ -0,0 +1,233 @@
+/*
+ * Copyright (C) 2017-2020 Philip Jones
+ *
+ * Licensed under the MIT License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/licenses/MIT
+ *
+ */
+
+#include "core.h"
+#include "apu.h"
+#include "memory.h"
+#include "ppu.h"
+#include "scheduler.h"
+#include "timer.h"
+#include <stdint.h>
+#include <string.h>
+
+static void (*const handlers[GBCC_EVENT_NUM_EVENTS])(struct gbcc_core *gbc) = {
+	[GBCC_EVENT_PPU] = gbcc_ppu_clock,
+	[GBCC_EVENT_TIMA] = gbcc_timer_tima_clock,
+	[GBCC_EVENT_APU_SEQUENCER] = gbcc_timer_sequencer_clock,
+	[GBCC_EVENT_SERIAL] = gbcc_link_cable_clock
+};
+
+static bool before(const struct gbcc_scheduler *sched, uint8_t a, uint8_t b);
+static void swap(struct gbcc_scheduler *sched, uint8_t i, uint8_t j);
+static void sift_up(struct gbcc_scheduler *sched, uint8_t i);
+static void sift_down(struct gbcc_scheduler *sched, uint8_t i);
+static void update_next(struct gbcc_scheduler *sched);
+static uint64_t count_slots(const struct gbcc_core *gbc, uint64_t t);
+
+void gbcc_scheduler_reset(struct gbcc_core *gbc)
+{
+	struct gbcc_scheduler *sched = &gbc->scheduler;
+	memset(sched, 0, sizeof(*sched));
+	/* The next cycle starts with the dot at time 4 */
+	sched->next = UINT64_MAX;
+	sched->next_tick = 5;
+	gbcc_ppu_schedule(gbc);
+	gbcc_timer_schedule(gbc);
+	gbcc_link_cable_schedule(gbc);
+	gbcc_apu_schedule(gbc);
+}
+
+/*
+ * Bring all lazily-updated state up to date, e.g. before the core is
+ * written out to a savestate. The edge detectors lose their predictions, so
+ * the scheduler must be reset before emulation continues.
+ */
+void gbcc_scheduler_sync(struct gbcc_core *gbc)
+{
+	gbcc_ppu_wake(gbc);
+	gbcc_apu_sync(gbc);
+	gbcc_timer_sync(gbc);
+	gbcc_link_cable_sync(gbc);
+}
+
+void gbcc_scheduler_add(struct gbcc_core *gbc, enum gbcc_event event, uint64_t when)
+{
+	struct gbcc_scheduler *sched = &gbc->scheduler;
+	if (gbcc_scheduler_pending(gbc, event)) {
+		uint64_t old = sched->deadline[event];
+		sched->deadline[event] = when;
+		if (when < old) {
+			sift_up(sched, sched->index[event]);
+		} else {
+			sift_down(sched, sched->index[event]);
+		}
+	} else {
+		sched->deadline[event] = when;
+		sched->heap[sched->size] = (uint8_t)event;
+		sched->index[event] = sched->size;
+		sched->size++;
+		sift_up(sched, sched->index[event]);
+	}
+	update_next(sched);
+}
+
+void gbcc_scheduler_remove(struct gbcc_core *gbc, enum gbcc_event event)
+{
+	struct gbcc_scheduler *sched = &gbc->scheduler;
+	if (!gbcc_scheduler_pending(gbc, event)) {
+		return;
+	}
+	uint8_t i = sched->index[event];
+	sched->size--;
+	if (i != sched->size) {
+		swap(sched, i, sched->size);
+		sift_up(sched, i);
+		sift_down(sched, sched->index[sched->heap[i]]);
+	}
+	update_next(sched);
+}
+
+bool gbcc_scheduler_pending(const struct gbcc_core *gbc, enum gbcc_event event)
+{
+	const struct gbcc_scheduler *sched = &gbc->scheduler;
+	uint8_t i = sched->index[event];
+	return i < sched->size && sched->heap[i] == event;
+}
+
+/* Run every event that has fallen due; handlers reschedule themselves. */
+void gbcc_scheduler_dispatch(struct gbcc_core *gbc)
+{
+	struct gbcc_scheduler *sched = &gbc->scheduler;
+	while (sched->next <= sched->now) {
+		enum gbcc_event event = sched->heap[0];
+		gbcc_scheduler_remove(gbc, event);
+		handlers[event](gbc);
+	}
+}
+
+/* Time of the next dot-clock slot */
+uint64_t gbcc_scheduler_next_dot(const struct gbcc_core *gbc)
+{
+	return (gbc->scheduler.now | 3u) + 1;
+}
+
+/* Time of the nth DIV tick from now, counting the next pending one as 1 */
+uint64_t gbcc_scheduler_tick_time(const struct gbcc_core *gbc, uint32_t n)
+{
+	uint64_t t = gbc->scheduler.next_tick;
+	if (n <= 1) {
+		return t;
+	}
+	if (gbc->cpu.double_speed) {
+		uint64_t idx = 2 * (t >> 2u) + (t & 3u) - 1 + (n - 1);
+		return 4 * (idx >> 1u) + 1 + (idx & 1u);
+	}
+	return (t | 3u) + 2 + 4 * (uint64_t)(n - 2);
+}
+
+/*
+ * Number of DIV ticks from the next pending one up to and including the one
+ * at the given time.
+ */
+uint32_t gbcc_scheduler_ticks_until(const struct gbcc_core *gbc, uint64_t when)
+{
+	uint64_t t = gbc->scheduler.next_tick;
+	if (when < t) {
+		return 0;
+	}
+	return (uint32_t)(1 + count_slots(gbc, when) - count_slots(gbc, t));
+}
+
+/*
+ * Number of whole cycles, starting with the next, in which no event falls
+ * due, up to a maximum of max.
+ */
+uint32_t gbcc_scheduler_quiet_cycles(const struct gbcc_core *gbc, uint32_t max)
+{
+	const struct gbcc_scheduler *sched = &gbc->scheduler;
+	/* The last CPU tick of each cycle must be before the next event */
+	uint64_t start = gbcc_scheduler_next_dot(gbc) + 1 + gbc->cpu.double_speed;
+	if (sched->next <= start) {
+		return 0;
+	}
+	uint64_t n = (sched->next - start - 1) / 4 + 1;
+	if (n > max) {
+		return max;
+	}
+	return (uint32_t)n;
+}
+
+/* Number of DIV tick slots at or before the given time */
+uint64_t count_slots(const struct gbcc_core *gbc, uint64_t t)
+{
+	uint64_t slots = (t >> 2u) + ((t & 3u) >= 1);
+	if (gbc->cpu.double_speed) {
+		slots += (t >> 2u) + ((t & 3u) >= 2);
+	}
+	return slots;
+}
+
+bool before(const struct gbcc_scheduler *sched, uint8_t a, uint8_t b)
+{
+	if (sched->deadline[a] != sched->deadline[b]) {
+		return sched->deadline[a] < sched->deadline[b];
+	}
+	return a < b;
+}
+
+void swap(struct gbcc_scheduler *sched, uint8_t i, uint8_t j)
+{
+	uint8_t tmp = sched->heap[i];
+	sched->heap[i] = sched->heap[j];
+	sched->heap[j] = tmp;
+	sched->index[sched->heap[i]] = i;
+	sched->index[sched->heap[j]] = j;
+}
+
+void sift_up(struct gbcc_scheduler *sched, uint8_t i)
+{
+	while (i > 0) {
+		uint8_t parent = (i - 1) / 2;
+		if (!before(sched, sched->heap[i], sched->heap[parent])) {
+			break;
+		}
+		swap(sched, i, parent);
+		i = parent;
+	}
+}
+
+void sift_down(struct gbcc_scheduler *sched, uint8_t i)
+{
+	while (true) {
+		uint8_t left = 2 * i + 1;
+		uint8_t right = 2 * i + 2;
+		uint8_t min = i;
+		if (left < sched->size && before(sched, sched->heap[left], sched->heap[min])) {
+			min = left;
+		}
+		if (right < sched->size && before(sched, sched->heap[right], sched->heap[min])) {
+			min = right;
+		}
+		if (min == i) {
+			break;
+		}
+		swap(sched, i, min);
+		i = min;
+	}
+}
+
+void update_next(struct gbcc_scheduler *sched)
+{
+	if (sched->size == 0) {
+		sched->next = UINT64_MAX;
+	} else {
+		sched->next = sched->deadline[sched->heap[0]];
+	}
+}
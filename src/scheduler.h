@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2017-2020 Philip Jones
+ *
+ * Licensed under the MIT License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/licenses/MIT
+ *
+ */
+
+#ifndef GBCC_SCHEDULER_H
+#define GBCC_SCHEDULER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Central event scheduler.
+ *
+ * Time is measured in quarter-cycles of the 4MHz master clock, so that the
+ * different points at which work happens inside a single call to
+ * gbcc_emulate_cycle() can be told apart:
+ *
+ * 	4n + 0	Dot-clock work (PPU), before the CPU runs.
+ * 	4n + 1	First CPU clock & DIV tick of the cycle.
+ * 	4n + 2	Second CPU clock & DIV tick (double speed only).
+ *
+ * Events that fall due at the same time are run in the order of the enum
+ * below, which matches the order the subsystems used to be clocked in.
+ */
+
+struct gbcc_core;
+
+enum gbcc_event {
+	GBCC_EVENT_PPU,
+	GBCC_EVENT_TIMA,
+	GBCC_EVENT_APU_SEQUENCER,
+	GBCC_EVENT_SERIAL,
+	GBCC_EVENT_NUM_EVENTS
+};
+
+struct gbcc_scheduler {
+	uint64_t now;
+	uint64_t next;		/* Earliest pending deadline */
+	uint64_t next_tick;	/* Time of the next DIV tick */
+	uint64_t deadline[GBCC_EVENT_NUM_EVENTS];
+	uint8_t heap[GBCC_EVENT_NUM_EVENTS];
+	uint8_t index[GBCC_EVENT_NUM_EVENTS];
+	uint8_t size;
+};
+
+void gbcc_scheduler_reset(struct gbcc_core *gbc);
+void gbcc_scheduler_sync(struct gbcc_core *gbc);
+void gbcc_scheduler_add(struct gbcc_core *gbc, enum gbcc_event event, uint64_t when);
+void gbcc_scheduler_remove(struct gbcc_core *gbc, enum gbcc_event event);
+bool gbcc_scheduler_pending(const struct gbcc_core *gbc, enum gbcc_event event);
+void gbcc_scheduler_dispatch(struct gbcc_core *gbc);
+uint64_t gbcc_scheduler_next_dot(const struct gbcc_core *gbc);
+uint64_t gbcc_scheduler_tick_time(const struct gbcc_core *gbc, uint32_t n);
+uint32_t gbcc_scheduler_ticks_until(const struct gbcc_core *gbc, uint64_t when);
+uint32_t gbcc_scheduler_quiet_cycles(const struct gbcc_core *gbc, uint32_t max);
+
+#endif /* GBCC_SCHEDULER_H */
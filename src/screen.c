@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2017-2020 Philip Jones
+ *
+ * Licensed under the MIT License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/licenses/MIT
+ *
+ */
+
+#include "constants.h"
+#include "screen.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* Set in screen.ready when the middle buffer hasn't been shown yet */
+#define FRESH 0x04u
+#define INDEX 0x03u
+
+struct gbcc_screen *gbcc_screen_create(void)
+{
+	struct gbcc_screen *screen = calloc(1, sizeof(*screen));
+	if (!screen) {
+		return NULL;
+	}
+	for (int i = 0; i < 3; i++) {
+		screen->buffer[i] = calloc(GBC_SCREEN_SIZE, sizeof(*screen->buffer[i]));
+		if (!screen->buffer[i]) {
+			gbcc_screen_destroy(screen);
+			return NULL;
+		}
+	}
+	screen->drawing = 0;
+	screen->showing = 1;
+	atomic_init(&screen->ready, 2);
+	screen->gbc = screen->buffer[screen->drawing];
+	screen->sdl = screen->buffer[screen->showing];
+	return screen;
+}
+
+void gbcc_screen_destroy(struct gbcc_screen *screen)
+{
+	if (!screen) {
+		return;
+	}
+	for (int i = 0; i < 3; i++) {
+		free(screen->buffer[i]);
+	}
+	free(screen);
+}
+
+/*
+ * Called from the emulation thread once a frame is finished. Drawing then
+ * carries on in whichever buffer was in the middle, as the renderer either
+ * never took it or has already finished with it.
+ */
+void gbcc_screen_publish(struct gbcc_screen *screen)
+{
+	uint_fast8_t old = atomic_exchange(&screen->ready, screen->drawing | FRESH);
+	screen->drawing = old & INDEX;
+	screen->gbc = screen->buffer[screen->drawing];
+}
+
+/*
+ * Called from the render thread to get the newest finished frame, which
+ * stays valid until the next call.
+ */
+const uint32_t *gbcc_screen_acquire(struct gbcc_screen *screen)
+{
+	if (atomic_load(&screen->ready) & FRESH) {
+		uint_fast8_t old = atomic_exchange(&screen->ready, screen->showing);
+		screen->showing = old & INDEX;
+		screen->sdl = screen->buffer[screen->showing];
+	}
+	return screen->sdl;
+}
+
+/* Whether the last published frame is still waiting for the renderer */
+bool gbcc_screen_pending(struct gbcc_screen *screen)
+{
+	return atomic_load(&screen->ready) & FRESH;
+}
@@ -0,0 +1,43 @@
+/*
+ * Copyright (C) 2017-2020 Philip Jones
+ *
+ * Licensed under the MIT License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/licenses/MIT
+ *
+ */
+
+#ifndef GBCC_SCREEN_H
+#define GBCC_SCREEN_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Hand-off of finished frames from the ppu to the renderer.
+ *
+ * There are three buffers: one the ppu is drawing into, one the renderer is
+ * showing, and the newest finished frame in between. Each side trades its
+ * own buffer for the one in the middle with a single atomic exchange, so
+ * neither ever has to wait for the other, and the renderer never sees a
+ * frame that's still being drawn.
+ */
+
+struct gbcc_screen {
+	uint32_t *buffer[3];
+	uint32_t *gbc;		/* Being drawn by the ppu */
+	uint32_t *sdl;		/* Being shown by the renderer */
+	uint8_t drawing;	/* Index of gbc */
+	uint8_t showing;	/* Index of sdl */
+	atomic_uint_fast8_t ready;	/* Index of the middle buffer, plus a flag if it's new */
+};
+
+struct gbcc_screen *gbcc_screen_create(void);
+void gbcc_screen_destroy(struct gbcc_screen *screen);
+void gbcc_screen_publish(struct gbcc_screen *screen);
+const uint32_t *gbcc_screen_acquire(struct gbcc_screen *screen);
+bool gbcc_screen_pending(struct gbcc_screen *screen);
+
+#endif /* GBCC_SCREEN_H */
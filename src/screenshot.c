@@ -111,9 +111,9 @@ void gbcc_screenshot(struct gbcc *gbc)
 			if (win->raw_screenshot) {
 				uint32_t idx = y * width + x;
 				uint32_t pixel = win->buffer[idx];
-				*row++ = (pixel & 0x000000FFu) >> 0u;
-				*row++ = (pixel & 0x0000FF00u) >> 8u;
+				*row++ = (pixel & 0xFF000000u) >> 24u;
 				*row++ = (pixel & 0x00FF0000u) >> 16u;
+				*row++ = (pixel & 0x0000FF00u) >> 8u;
 			} else {
 				uint32_t idx = 4 * ((height - y - 1) * width + x);
 				*row++ = buffer[idx++];
@@ -30,7 +30,7 @@
 
 #define HEADER_BYTES 8
 
-static const SDL_Scancode keymap[36] = {
+static const SDL_Scancode keymap[37] = {
 	SDL_SCANCODE_Z,		/* A */
 	SDL_SCANCODE_X, 	/* B */
 	SDL_SCANCODE_RETURN,	/* Start */
@@ -66,7 +66,8 @@ static const SDL_Scancode keymap[36] = {
 	SDL_SCANCODE_F6,
 	SDL_SCANCODE_F7,
 	SDL_SCANCODE_F8,
-	SDL_SCANCODE_F9
+	SDL_SCANCODE_F9,
+	SDL_SCANCODE_BACKSPACE	/* Rewind */
 };
 
 static const SDL_GameControllerButton buttonmap[8] = {
@@ -354,13 +355,15 @@ void gbcc_sdl_process_input(struct gbcc_sdl *sdl)
 			case 33:
 			case 34:
 			case 35:
-			case 36:
 				if (state[SDL_SCANCODE_LSHIFT]) {
 					emulator_key = GBCC_KEY_SAVE_STATE_1 + (uint8_t)(key - 27);
 				} else {
 					emulator_key = GBCC_KEY_LOAD_STATE_1 + (uint8_t)(key - 27);
 				}
 				break;
+			case 36:
+				emulator_key = GBCC_KEY_REWIND;
+				break;
 			default:
 				continue;
 		}
@@ -0,0 +1,1113 @@
+/*
+ * Copyright (C) 2017-2020 Philip Jones
+ *
+ * Licensed under the MIT License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/licenses/MIT
+ *
+ */
+
+#include "state.h"
+#include "core.h"
+#include "debug.h"
+#include "icache.h"
+#include "interrupt.h"
+#include "memory.h"
+#include "nelem.h"
+#include "ops.h"
+#include "ppu.h"
+#include "scheduler.h"
+#include "state_legacy.h"
+#include "tile_cache.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MAGIC "GBCS"
+/*
+ * Only needs bumping if the layout of the header or sections themselves
+ * changes, not when a section gains fields.
+ */
+#define FORMAT_VERSION 1
+#define HEADER_SIZE 8		/* Magic & format version */
+#define SECTION_HEADER_SIZE 12	/* Tag, version & length */
+
+/* With no buffer, a writer just counts bytes */
+struct writer {
+	uint8_t *buf;
+	size_t size;
+	size_t pos;
+	bool overflow;
+};
+
+/* Reads past the end of the data give zeroes */
+struct reader {
+	const uint8_t *data;
+	size_t size;
+	size_t pos;
+};
+
+struct section {
+	char tag[5];
+	uint32_t version;
+	/* Whether the section applies to this core, or NULL for always */
+	bool (*present)(const struct gbcc_core *gbc);
+	/* Whether the section's data fits this core, or NULL for any */
+	bool (*check)(const struct gbcc_core *gbc, struct reader r);
+	void (*save)(struct writer *w, const struct gbcc_core *gbc);
+	void (*load)(struct reader *r, struct gbcc_core *gbc, uint32_t version);
+	bool optional;	/* Can be missing from states that it applies to */
+};
+
+static void put_bytes(struct writer *w, const void *bytes, size_t n);
+static void put_u8(struct writer *w, uint8_t val);
+static void put_u16(struct writer *w, uint16_t val);
+static void put_u32(struct writer *w, uint32_t val);
+static void put_u64(struct writer *w, uint64_t val);
+static void patch_u32(struct writer *w, size_t pos, uint32_t val);
+static void get_bytes(struct reader *r, void *bytes, size_t n);
+static uint8_t get_u8(struct reader *r);
+static bool get_bool(struct reader *r);
+static uint16_t get_u16(struct reader *r);
+static uint32_t get_u32(struct reader *r);
+static uint64_t get_u64(struct reader *r);
+
+static void write_state(struct writer *w, const struct gbcc_core *gbc);
+static const struct section *find_section(const uint8_t *tag);
+static void rebuild(struct gbcc_core *gbc);
+static bool load_legacy(struct gbcc_core *gbc, const uint8_t *data, size_t size);
+
+static void save_cpu(struct writer *w, const struct gbcc_core *gbc);
+static void load_cpu(struct reader *r, struct gbcc_core *gbc, uint32_t version);
+static void save_apu(struct writer *w, const struct gbcc_core *gbc);
+static void load_apu(struct reader *r, struct gbcc_core *gbc, uint32_t version);
+static void save_ppu(struct writer *w, const struct gbcc_core *gbc);
+static void load_ppu(struct reader *r, struct gbcc_core *gbc, uint32_t version);
+static void save_hdma(struct writer *w, const struct gbcc_core *gbc);
+static void load_hdma(struct reader *r, struct gbcc_core *gbc, uint32_t version);
+static bool check_memory(const struct gbcc_core *gbc, struct reader r);
+static void save_memory(struct writer *w, const struct gbcc_core *gbc);
+static void load_memory(struct reader *r, struct gbcc_core *gbc, uint32_t version);
+static void save_mbc(struct writer *w, const struct gbcc_core *gbc);
+static void load_mbc(struct reader *r, struct gbcc_core *gbc, uint32_t version);
+static bool has_rtc(const struct gbcc_core *gbc);
+static void save_rtc(struct writer *w, const struct gbcc_core *gbc);
+static void load_rtc(struct reader *r, struct gbcc_core *gbc, uint32_t version);
+static bool has_mbc7(const struct gbcc_core *gbc);
+static void save_mbc7(struct writer *w, const struct gbcc_core *gbc);
+static void load_mbc7(struct reader *r, struct gbcc_core *gbc, uint32_t version);
+static bool has_camera(const struct gbcc_core *gbc);
+static void save_camera(struct writer *w, const struct gbcc_core *gbc);
+static void load_camera(struct reader *r, struct gbcc_core *gbc, uint32_t version);
+static bool has_sram(const struct gbcc_core *gbc);
+static bool check_sram(const struct gbcc_core *gbc, struct reader r);
+static void save_sram(struct writer *w, const struct gbcc_core *gbc);
+static void load_sram(struct reader *r, struct gbcc_core *gbc, uint32_t version);
+static void save_link_cable(struct writer *w, const struct gbcc_core *gbc);
+static void load_link_cable(struct reader *r, struct gbcc_core *gbc, uint32_t version);
+static bool has_printer(const struct gbcc_core *gbc);
+static void save_printer(struct writer *w, const struct gbcc_core *gbc);
+static void load_printer(struct reader *r, struct gbcc_core *gbc, uint32_t version);
+
+static const struct section sections[] = {
+	{"CPU ", 1, NULL, NULL, save_cpu, load_cpu, false},
+	{"APU ", 1, NULL, NULL, save_apu, load_apu, false},
+	{"PPU ", 1, NULL, NULL, save_ppu, load_ppu, false},
+	{"HDMA", 1, NULL, NULL, save_hdma, load_hdma, false},
+	{"MEM ", 1, NULL, check_memory, save_memory, load_memory, false},
+	{"MBC ", 1, NULL, NULL, save_mbc, load_mbc, false},
+	{"RTC ", 1, has_rtc, NULL, save_rtc, load_rtc, false},
+	{"MBC7", 1, has_mbc7, NULL, save_mbc7, load_mbc7, false},
+	{"CAM ", 1, has_camera, NULL, save_camera, load_camera, false},
+	{"SRAM", 1, has_sram, check_sram, save_sram, load_sram, false},
+	{"LINK", 1, NULL, NULL, save_link_cable, load_link_cable, false},
+	{"PRNT", 1, has_printer, NULL, save_printer, load_printer, true}
+};
+
+/* Exact number of bytes gbcc_state_save_to() will currently need */
+size_t gbcc_state_size(const struct gbcc_core *gbc)
+{
+	struct writer count = {0};
+	write_state(&count, gbc);
+	return count.pos;
+}
+
+/*
+ * Save the state to buf, returning the number of bytes written, or 0 if it
+ * wouldn't fit in size.
+ */
+size_t gbcc_state_save_to(struct gbcc_core *gbc, uint8_t *buf, size_t size)
+{
+	struct writer w = {.buf = buf, .size = size};
+
+	gbcc_scheduler_sync(gbc);
+	gbcc_sync_flags(&gbc->cpu);
+	write_state(&w, gbc);
+	gbcc_scheduler_reset(gbc);
+
+	if (w.overflow) {
+		gbcc_log_error("Save state needs %zu bytes, only have %zu.\n", w.pos, size);
+		return 0;
+	}
+	return w.pos;
+}
+
+/*
+ * The whole state is checked before any of it is loaded, so a bad state
+ * leaves the core untouched.
+ */
+bool gbcc_state_load_from(struct gbcc_core *gbc, const uint8_t *data, size_t size)
+{
+	if (gbcc_state_legacy_version(data, size) != 0) {
+		return load_legacy(gbc, data, size);
+	}
+	if (size < HEADER_SIZE || memcmp(data, MAGIC, 4) != 0) {
+		gbcc_log_error("Not a save state, or from an old version of gbcc.\n");
+		return false;
+	}
+	struct reader header = {.data = data + 4, .size = 4};
+	uint32_t version = get_u32(&header);
+	if (version != FORMAT_VERSION) {
+		gbcc_log_error("Save state format v%u not supported "
+				"(current version is v%u).\n",
+				version, FORMAT_VERSION);
+		return false;
+	}
+
+	bool seen[N_ELEM(sections)] = {0};
+	size_t pos = HEADER_SIZE;
+	while (pos < size) {
+		if (size - pos < SECTION_HEADER_SIZE) {
+			gbcc_log_error("Save state truncated.\n");
+			return false;
+		}
+		struct reader r = {.data = data + pos + 4, .size = 8};
+		uint32_t section_version = get_u32(&r);
+		uint32_t length = get_u32(&r);
+		if (length > size - pos - SECTION_HEADER_SIZE) {
+			gbcc_log_error("Save state truncated.\n");
+			return false;
+		}
+		const struct section *s = find_section(data + pos);
+		if (!s) {
+			gbcc_log_debug("Skipping unknown save state section %.4s.\n", data + pos);
+		} else if (section_version > s->version) {
+			gbcc_log_error("Save state section %s is v%u, but only "
+					"up to v%u is supported.\n",
+					s->tag, section_version, s->version);
+			return false;
+		} else {
+			r = (struct reader){
+				.data = data + pos + SECTION_HEADER_SIZE,
+				.size = length
+			};
+			if (s->check && !s->check(gbc, r)) {
+				gbcc_log_error("Save state section %s doesn't "
+						"match this cartridge.\n", s->tag);
+				return false;
+			}
+			seen[s - sections] = true;
+		}
+		pos += SECTION_HEADER_SIZE + length;
+	}
+	for (size_t i = 0; i < N_ELEM(sections); i++) {
+		const struct section *s = &sections[i];
+		if (seen[i] || s->optional) {
+			continue;
+		}
+		if (!s->present || s->present(gbc)) {
+			gbcc_log_error("Save state is missing section %s.\n", s->tag);
+			return false;
+		}
+	}
+
+	pos = HEADER_SIZE;
+	while (pos < size) {
+		struct reader r = {.data = data + pos + 4, .size = 8};
+		uint32_t section_version = get_u32(&r);
+		uint32_t length = get_u32(&r);
+		const struct section *s = find_section(data + pos);
+		if (s) {
+			r = (struct reader){
+				.data = data + pos + SECTION_HEADER_SIZE,
+				.size = length
+			};
+			s->load(&r, gbc, section_version);
+		}
+		pos += SECTION_HEADER_SIZE + length;
+	}
+	rebuild(gbc);
+	return true;
+}
+
+/*
+ * Legacy states are converted on top of a copy of the running core, so
+ * anything they don't hold carries on as it was. The result is then rebuilt
+ * like any other state.
+ */
+bool load_legacy(struct gbcc_core *gbc, const uint8_t *data, size_t size)
+{
+	struct gbcc_core *tmp = malloc(sizeof(*tmp));
+	if (!tmp) {
+		gbcc_log_error("Couldn't allocate memory for save state.\n");
+		return false;
+	}
+	*tmp = *gbc;
+	bool success = gbcc_state_legacy_convert(tmp, data, size);
+	if (success) {
+		*gbc = *tmp;
+		rebuild(gbc);
+		/* Rare enough to not bother working out what's changed */
+		gbcc_icache_flush(gbc->icache);
+	}
+	free(tmp);
+	return success;
+}
+
+void write_state(struct writer *w, const struct gbcc_core *gbc)
+{
+	put_bytes(w, MAGIC, 4);
+	put_u32(w, FORMAT_VERSION);
+	for (size_t i = 0; i < N_ELEM(sections); i++) {
+		const struct section *s = &sections[i];
+		if (s->present && !s->present(gbc)) {
+			continue;
+		}
+		put_bytes(w, s->tag, 4);
+		put_u32(w, s->version);
+		/* The length is filled in once the section's been written */
+		size_t length_pos = w->pos;
+		put_u32(w, 0);
+		s->save(w, gbc);
+		patch_u32(w, length_pos, (uint32_t)(w->pos - length_pos - 4));
+	}
+}
+
+const struct section *find_section(const uint8_t *tag)
+{
+	for (size_t i = 0; i < N_ELEM(sections); i++) {
+		if (memcmp(tag, sections[i].tag, 4) == 0) {
+			return &sections[i];
+		}
+	}
+	return NULL;
+}
+
+/* Point everything that isn't saved back at the newly loaded state */
+void rebuild(struct gbcc_core *gbc)
+{
+	const uint8_t *ioreg = gbc->memory.ioreg;
+	uint8_t wram_bank = 1;
+	uint8_t vram_bank = 0;
+	if (gbc->mode == GBC) {
+		wram_bank = ioreg[SVBK - IOREG_START] & 0x07u;
+		wram_bank += !wram_bank;
+		vram_bank = ioreg[VBK - IOREG_START] & 0x01u;
+	}
+	gbc->memory.rom0 = gbc->cart.rom + gbc->cart.mbc.rom0_bank * ROM0_SIZE;
+	gbc->memory.romx = gbc->cart.rom + gbc->cart.mbc.romx_bank * ROMX_SIZE;
+	gbc->memory.vram = gbc->memory.vram_bank[vram_bank];
+	if (gbc->cart.ram != NULL) {
+		gbc->memory.sram = gbc->cart.ram + gbc->cart.mbc.sram_bank * SRAM_SIZE;
+	} else {
+		gbc->memory.sram = NULL;
+	}
+	gbc->memory.wram0 = gbc->memory.wram_bank[0];
+	gbc->memory.wramx = gbc->memory.wram_bank[wram_bank];
+	gbc->memory.echo = gbc->memory.wram0;
+
+	gbc->cpu.flags.op = GBCC_FLAGS_SYNCED;
+	memset(&gbc->idle, 0, sizeof(gbc->idle));
+	gbcc_ppu_update_colours(gbc);
+	gbcc_memory_update_map(gbc);
+	gbcc_interrupt_update(gbc);
+	gbcc_scheduler_reset(gbc);
+	gbcc_tile_cache_flush(gbc->tile_cache);
+}
+
+void save_cpu(struct writer *w, const struct gbcc_core *gbc)
+{
+	const struct cpu *cpu = &gbc->cpu;
+	put_u16(w, cpu->reg.af);
+	put_u16(w, cpu->reg.bc);
+	put_u16(w, cpu->reg.de);
+	put_u16(w, cpu->reg.hl);
+	put_u16(w, cpu->reg.sp);
+	put_u16(w, cpu->reg.pc);
+	put_u8(w, cpu->opcode);
+	put_u8(w, cpu->ime);
+	put_u8(w, cpu->stop);
+	put_u8(w, cpu->double_speed);
+	put_u8(w, cpu->tac_bit);
+	put_u16(w, cpu->div_timer);
+	put_u8(w, cpu->tima_reload);
+	put_u8(w, cpu->clock);
+	put_u8(w, cpu->ime_timer.timer);
+	put_u8(w, cpu->ime_timer.target_state);
+	put_u8(w, cpu->halt.set);
+	put_u8(w, cpu->halt.no_interrupt);
+	put_u8(w, cpu->halt.skip);
+	put_u16(w, cpu->dma.source);
+	put_u16(w, cpu->dma.new_source);
+	put_u16(w, cpu->dma.timer);
+	put_u8(w, cpu->dma.requested);
+	put_u8(w, cpu->dma.running);
+	put_u16(w, cpu->interrupt.addr);
+	put_u8(w, cpu->interrupt.request);
+	put_u8(w, cpu->interrupt.running);
+	put_u16(w, cpu->instruction.addr);
+	put_u8(w, cpu->instruction.op1);
+	put_u8(w, cpu->instruction.op2);
+	put_u8(w, cpu->instruction.mod);
+	put_u8(w, cpu->instruction.div);
+	put_u8(w, cpu->instruction.step);
+	put_u8(w, cpu->instruction.running);
+	put_u8(w, cpu->instruction.prefix_cb);
+}
+
+void load_cpu(struct reader *r, struct gbcc_core *gbc, uint32_t version)
+{
+	struct cpu *cpu = &gbc->cpu;
+	cpu->reg.af = get_u16(r);
+	cpu->reg.bc = get_u16(r);
+	cpu->reg.de = get_u16(r);
+	cpu->reg.hl = get_u16(r);
+	cpu->reg.sp = get_u16(r);
+	cpu->reg.pc = get_u16(r);
+	cpu->opcode = get_u8(r);
+	cpu->ime = get_bool(r);
+	cpu->stop = get_bool(r);
+	cpu->double_speed = get_bool(r);
+	cpu->tac_bit = get_bool(r);
+	cpu->div_timer = get_u16(r);
+	cpu->tima_reload = get_u8(r);
+	cpu->clock = get_u8(r);
+	cpu->ime_timer.timer = get_u8(r);
+	cpu->ime_timer.target_state = get_bool(r);
+	cpu->halt.set = get_bool(r);
+	cpu->halt.no_interrupt = get_bool(r);
+	cpu->halt.skip = get_bool(r);
+	cpu->dma.source = get_u16(r);
+	cpu->dma.new_source = get_u16(r);
+	cpu->dma.timer = get_u16(r);
+	cpu->dma.requested = get_bool(r);
+	cpu->dma.running = get_bool(r);
+	cpu->interrupt.addr = get_u16(r);
+	cpu->interrupt.request = get_bool(r);
+	cpu->interrupt.running = get_bool(r);
+	cpu->instruction.addr = get_u16(r);
+	cpu->instruction.op1 = get_u8(r);
+	cpu->instruction.op2 = get_u8(r);
+	cpu->instruction.mod = get_u8(r);
+	cpu->instruction.div = get_u8(r);
+	cpu->instruction.step = get_u8(r);
+	cpu->instruction.running = get_bool(r);
+	cpu->instruction.prefix_cb = get_bool(r);
+}
+
+static void put_timer(struct writer *w, const struct timer *timer)
+{
+	put_u16(w, timer->period);
+	put_u16(w, timer->counter);
+}
+
+static void get_timer(struct reader *r, struct timer *timer)
+{
+	timer->period = get_u16(r);
+	timer->counter = get_u16(r);
+}
+
+static void put_channel(struct writer *w, const struct channel *ch)
+{
+	put_timer(w, &ch->envelope.timer);
+	put_u8(w, ch->envelope.start_volume);
+	put_u8(w, ch->envelope.volume);
+	put_u8(w, (uint8_t)ch->envelope.dir);
+	put_u8(w, ch->envelope.enabled);
+	put_timer(w, &ch->duty.timer);
+	put_u8(w, ch->duty.counter);
+	put_u8(w, ch->duty.cycle);
+	put_u16(w, ch->duty.freq);
+	put_u8(w, ch->duty.enabled);
+	put_u16(w, ch->counter);
+	put_u8(w, ch->length_enable);
+	put_u8(w, ch->state);
+	put_u8(w, ch->enabled);
+	put_u8(w, ch->dac);
+	put_u8(w, ch->left);
+	put_u8(w, ch->right);
+}
+
+static void get_channel(struct reader *r, struct channel *ch)
+{
+	get_timer(r, &ch->envelope.timer);
+	ch->envelope.start_volume = get_u8(r);
+	ch->envelope.volume = get_u8(r);
+	ch->envelope.dir = (int8_t)get_u8(r);
+	ch->envelope.enabled = get_bool(r);
+	get_timer(r, &ch->duty.timer);
+	ch->duty.counter = get_u8(r);
+	ch->duty.cycle = get_u8(r);
+	ch->duty.freq = get_u16(r);
+	ch->duty.enabled = get_bool(r);
+	ch->counter = get_u16(r);
+	ch->length_enable = get_bool(r);
+	ch->state = get_bool(r);
+	ch->enabled = get_bool(r);
+	ch->dac = get_bool(r);
+	ch->left = get_bool(r);
+	ch->right = get_bool(r);
+}
+
+/* The output side of the APU carries on from where it is, so isn't saved */
+void save_apu(struct writer *w, const struct gbcc_core *gbc)
+{
+	const struct apu *apu = &gbc->apu;
+	put_u8(w, apu->left_vol);
+	put_u8(w, apu->right_vol);
+	put_u8(w, apu->disabled);
+	put_u8(w, apu->div_bit);
+	put_channel(w, &apu->ch1);
+	put_channel(w, &apu->ch2);
+	put_channel(w, &apu->ch3);
+	put_channel(w, &apu->ch4);
+	put_timer(w, &apu->sweep.timer);
+	put_u16(w, apu->sweep.freq);
+	put_u16(w, apu->sweep.period);
+	put_u8(w, apu->sweep.shift);
+	put_u8(w, apu->sweep.decreasing);
+	put_u8(w, apu->sweep.enabled);
+	put_u8(w, apu->sweep.calculated);
+	put_timer(w, &apu->noise.timer);
+	put_u8(w, apu->noise.shift);
+	put_u8(w, apu->noise.width_mode);
+	put_u16(w, apu->noise.lfsr);
+	put_timer(w, &apu->wave.timer);
+	put_u16(w, apu->wave.addr);
+	put_u16(w, apu->wave.freq);
+	put_u8(w, apu->wave.buffer);
+	put_u8(w, apu->wave.position);
+	put_u8(w, apu->wave.shift);
+	put_u8(w, apu->sequencer_counter);
+}
+
+void load_apu(struct reader *r, struct gbcc_core *gbc, uint32_t version)
+{
+	struct apu *apu = &gbc->apu;
+	apu->left_vol = get_u8(r);
+	apu->right_vol = get_u8(r);
+	apu->disabled = get_bool(r);
+	apu->div_bit = get_bool(r);
+	get_channel(r, &apu->ch1);
+	get_channel(r, &apu->ch2);
+	get_channel(r, &apu->ch3);
+	get_channel(r, &apu->ch4);
+	get_timer(r, &apu->sweep.timer);
+	apu->sweep.freq = get_u16(r);
+	apu->sweep.period = get_u16(r);
+	apu->sweep.shift = get_u8(r);
+	apu->sweep.decreasing = get_bool(r);
+	apu->sweep.enabled = get_bool(r);
+	apu->sweep.calculated = get_bool(r);
+	get_timer(r, &apu->noise.timer);
+	apu->noise.shift = get_u8(r);
+	apu->noise.width_mode = get_bool(r);
+	apu->noise.lfsr = get_u16(r);
+	get_timer(r, &apu->wave.timer);
+	apu->wave.addr = get_u16(r);
+	apu->wave.freq = get_u16(r);
+	apu->wave.buffer = get_u8(r);
+	apu->wave.position = get_u8(r);
+	apu->wave.shift = get_u8(r);
+	apu->sequencer_counter = get_u8(r);
+}
+
+static void put_line(struct writer *w, const struct line_buffer *line)
+{
+	for (size_t i = 0; i < N_ELEM(line->colour); i++) {
+		put_u32(w, line->colour[i]);
+	}
+	put_bytes(w, line->attr, sizeof(line->attr));
+}
+
+static void get_line(struct reader *r, struct line_buffer *line)
+{
+	for (size_t i = 0; i < N_ELEM(line->colour); i++) {
+		line->colour[i] = get_u32(r);
+	}
+	get_bytes(r, line->attr, sizeof(line->attr));
+}
+
+static void put_tile(struct writer *w, const struct tile *tile)
+{
+	put_bytes(w, tile->pixels, sizeof(tile->pixels));
+	put_u8(w, tile->x);
+	put_u8(w, tile->attr);
+}
+
+static void get_tile(struct reader *r, struct tile *tile)
+{
+	get_bytes(r, tile->pixels, sizeof(tile->pixels));
+	tile->x = get_u8(r);
+	tile->attr = get_u8(r);
+}
+
+/*
+ * The DMG shades & final palette colours are left out, as they're rebuilt
+ * from the settings & palette registers.
+ */
+void save_ppu(struct writer *w, const struct gbcc_core *gbc)
+{
+	const struct ppu *ppu = &gbc->ppu;
+	put_u64(w, ppu->frame);
+	put_u32(w, ppu->clock);
+	put_u8(w, ppu->lcd_disable);
+	put_bytes(w, ppu->bgp, sizeof(ppu->bgp));
+	put_bytes(w, ppu->obp, sizeof(ppu->obp));
+	put_line(w, &ppu->bg_line);
+	put_line(w, &ppu->window_line);
+	put_line(w, &ppu->sprite_line);
+	put_u8(w, ppu->scy);
+	put_u8(w, ppu->scx);
+	put_u8(w, ppu->ly);
+	put_u8(w, ppu->lyc);
+	put_u8(w, ppu->wy);
+	put_u8(w, ppu->wx);
+	put_u8(w, ppu->lcdc);
+	put_u8(w, ppu->last_stat);
+	put_u8(w, ppu->x);
+	put_u8(w, ppu->window_ly);
+	put_u8(w, ppu->line_window_ly);
+	put_u16(w, ppu->next_dot);
+	put_u16(w, ppu->hblank_dot);
+	put_u8(w, ppu->line_drawn);
+	put_u8(w, ppu->n_sprites);
+	for (size_t i = 0; i < N_ELEM(ppu->sprites); i++) {
+		const struct sprite *s = &ppu->sprites[i];
+		put_u8(w, s->x);
+		put_u8(w, s->y);
+		put_u16(w, s->address);
+		put_tile(w, &s->tile);
+		put_u8(w, s->loaded);
+	}
+	put_tile(w, &ppu->bg_tile);
+	put_tile(w, &ppu->window_tile);
+}
+
+void load_ppu(struct reader *r, struct gbcc_core *gbc, uint32_t version)
+{
+	struct ppu *ppu = &gbc->ppu;
+	ppu->frame = get_u64(r);
+	ppu->clock = get_u32(r);
+	ppu->lcd_disable = get_bool(r);
+	get_bytes(r, ppu->bgp, sizeof(ppu->bgp));
+	get_bytes(r, ppu->obp, sizeof(ppu->obp));
+	get_line(r, &ppu->bg_line);
+	get_line(r, &ppu->window_line);
+	get_line(r, &ppu->sprite_line);
+	ppu->scy = get_u8(r);
+	ppu->scx = get_u8(r);
+	ppu->ly = get_u8(r);
+	ppu->lyc = get_u8(r);
+	ppu->wy = get_u8(r);
+	ppu->wx = get_u8(r);
+	ppu->lcdc = get_u8(r);
+	ppu->last_stat = get_bool(r);
+	ppu->x = get_u8(r);
+	ppu->window_ly = get_u8(r);
+	ppu->line_window_ly = get_u8(r);
+	ppu->next_dot = get_u16(r);
+	ppu->hblank_dot = get_u16(r);
+	ppu->line_drawn = get_bool(r);
+	ppu->n_sprites = get_u8(r);
+	for (size_t i = 0; i < N_ELEM(ppu->sprites); i++) {
+		struct sprite *s = &ppu->sprites[i];
+		s->x = get_u8(r);
+		s->y = get_u8(r);
+		s->address = get_u16(r);
+		get_tile(r, &s->tile);
+		s->loaded = get_bool(r);
+	}
+	get_tile(r, &ppu->bg_tile);
+	get_tile(r, &ppu->window_tile);
+}
+
+void save_hdma(struct writer *w, const struct gbcc_core *gbc)
+{
+	put_u16(w, gbc->hdma.source);
+	put_u16(w, gbc->hdma.dest);
+	put_u16(w, gbc->hdma.length);
+	put_u16(w, gbc->hdma.to_copy);
+	put_u8(w, gbc->hdma.hblank);
+}
+
+void load_hdma(struct reader *r, struct gbcc_core *gbc, uint32_t version)
+{
+	gbc->hdma.source = get_u16(r);
+	gbc->hdma.dest = get_u16(r);
+	gbc->hdma.length = get_u16(r);
+	gbc->hdma.to_copy = get_u16(r);
+	gbc->hdma.hblank = get_bool(r);
+}
+
+/* DMG mode only uses the first two WRAM banks & the first VRAM bank */
+static uint8_t wram_banks(bool dmg)
+{
+	return dmg ? 2 : 8;
+}
+
+static uint8_t vram_banks(bool dmg)
+{
+	return dmg ? 1 : 2;
+}
+
+bool check_memory(const struct gbcc_core *gbc, struct reader r)
+{
+	bool dmg = get_bool(&r);
+	size_t expected = 1 + OAM_SIZE + UNUSED_SIZE + IOREG_SIZE + HRAM_SIZE + 1
+		+ wram_banks(dmg) * WRAM0_SIZE
+		+ vram_banks(dmg) * VRAM_SIZE;
+	return r.size == expected;
+}
+
+void save_memory(struct writer *w, const struct gbcc_core *gbc)
+{
+	bool dmg = (gbc->mode == DMG);
+	put_u8(w, dmg);
+	put_bytes(w, gbc->memory.oam, OAM_SIZE);
+	put_bytes(w, gbc->memory.unused, UNUSED_SIZE);
+	put_bytes(w, gbc->memory.ioreg, IOREG_SIZE);
+	put_bytes(w, gbc->memory.hram, HRAM_SIZE);
+	put_u8(w, gbc->memory.iereg);
+	for (uint8_t i = 0; i < wram_banks(dmg); i++) {
+		put_bytes(w, gbc->memory.wram_bank[i], WRAM0_SIZE);
+	}
+	for (uint8_t i = 0; i < vram_banks(dmg); i++) {
+		put_bytes(w, gbc->memory.vram_bank[i], VRAM_SIZE);
+	}
+}
+
+void load_memory(struct reader *r, struct gbcc_core *gbc, uint32_t version)
+{
+	bool dmg = get_bool(r);
+	gbc->mode = dmg ? DMG : GBC;
+	get_bytes(r, gbc->memory.oam, OAM_SIZE);
+	get_bytes(r, gbc->memory.unused, UNUSED_SIZE);
+	get_bytes(r, gbc->memory.ioreg, IOREG_SIZE);
+	get_bytes(r, gbc->memory.hram, HRAM_SIZE);
+	gbc->memory.iereg = get_u8(r);
+	/* Only the banks that actually change lose their decoded instructions */
+	uint8_t changed = 0;
+	for (uint8_t i = 0; i < wram_banks(dmg); i++) {
+		uint8_t *bank = gbc->memory.wram_bank[i];
+		if (r->pos + WRAM0_SIZE > r->size || memcmp(r->data + r->pos, bank, WRAM0_SIZE) != 0) {
+			changed |= (uint8_t)(1u << i);
+		}
+		get_bytes(r, bank, WRAM0_SIZE);
+	}
+	gbcc_icache_flush_some(gbc->icache, changed);
+	for (uint8_t i = 0; i < vram_banks(dmg); i++) {
+		get_bytes(r, gbc->memory.vram_bank[i], VRAM_SIZE);
+	}
+}
+
+void save_mbc(struct writer *w, const struct gbcc_core *gbc)
+{
+	const struct gbcc_mbc *mbc = &gbc->cart.mbc;
+	put_u16(w, mbc->rom0_bank);
+	put_u16(w, mbc->romx_bank);
+	put_u8(w, mbc->sram_bank);
+	put_u8(w, mbc->ramg);
+	put_u8(w, mbc->romb0);
+	put_u8(w, mbc->romb1);
+	put_u8(w, mbc->ramb);
+	put_u8(w, mbc->unlocked);
+	put_u8(w, mbc->sram_enable);
+}
+
+void load_mbc(struct reader *r, struct gbcc_core *gbc, uint32_t version)
+{
+	struct gbcc_mbc *mbc = &gbc->cart.mbc;
+	mbc->rom0_bank = get_u16(r);
+	mbc->romx_bank = get_u16(r);
+	mbc->sram_bank = get_u8(r);
+	mbc->ramg = get_u8(r);
+	mbc->romb0 = get_u8(r);
+	mbc->romb1 = get_u8(r);
+	mbc->ramb = get_u8(r);
+	mbc->unlocked = get_bool(r);
+	mbc->sram_enable = get_bool(r);
+	/* Out of range banks would point outside the ROM */
+	if (gbc->cart.rom_banks > 0) {
+		mbc->rom0_bank = (uint16_t)(mbc->rom0_bank % gbc->cart.rom_banks);
+		mbc->romx_bank = (uint16_t)(mbc->romx_bank % gbc->cart.rom_banks);
+	}
+	if (gbc->cart.ram_banks > 0) {
+		mbc->sram_bank = (uint8_t)(mbc->sram_bank % gbc->cart.ram_banks);
+	}
+}
+
+bool has_rtc(const struct gbcc_core *gbc)
+{
+	return gbc->cart.mbc.type == MBC3;
+}
+
+void save_rtc(struct writer *w, const struct gbcc_core *gbc)
+{
+	const struct gbcc_rtc *rtc = &gbc->cart.mbc.rtc;
+	put_u64(w, (uint64_t)rtc->base_time.tv_sec);
+	put_u64(w, (uint64_t)rtc->base_time.tv_nsec);
+	put_u8(w, rtc->seconds);
+	put_u8(w, rtc->minutes);
+	put_u8(w, rtc->hours);
+	put_u8(w, rtc->day_low);
+	put_u8(w, rtc->day_high);
+	put_u8(w, rtc->latch);
+	put_u8(w, rtc->cur_reg);
+	put_u8(w, rtc->mapped);
+	put_u8(w, rtc->halt);
+}
+
+void load_rtc(struct reader *r, struct gbcc_core *gbc, uint32_t version)
+{
+	struct gbcc_rtc *rtc = &gbc->cart.mbc.rtc;
+	rtc->base_time.tv_sec = (time_t)get_u64(r);
+	rtc->base_time.tv_nsec = (long)get_u64(r);
+	rtc->seconds = get_u8(r);
+	rtc->minutes = get_u8(r);
+	rtc->hours = get_u8(r);
+	rtc->day_low = get_u8(r);
+	rtc->day_high = get_u8(r);
+	rtc->latch = get_u8(r);
+	rtc->cur_reg = get_u8(r);
+	rtc->mapped = get_bool(r);
+	rtc->halt = get_bool(r);
+}
+
+bool has_mbc7(const struct gbcc_core *gbc)
+{
+	return gbc->cart.mbc.type == MBC7;
+}
+
+/* The accelerometer's tilt is input, so isn't saved */
+void save_mbc7(struct writer *w, const struct gbcc_core *gbc)
+{
+	const struct gbcc_accelerometer *acc = &gbc->cart.mbc.accelerometer;
+	const struct gbcc_eeprom *eeprom = &gbc->cart.mbc.eeprom;
+	put_u16(w, acc->x);
+	put_u16(w, acc->y);
+	put_u16(w, acc->real_x);
+	put_u16(w, acc->real_y);
+	put_u8(w, acc->latch);
+	put_u8(w, (uint8_t)eeprom->current_command);
+	put_u16(w, eeprom->command);
+	put_u8(w, eeprom->command_bit);
+	put_u8(w, eeprom->start);
+	put_u8(w, eeprom->write_enable);
+	put_u8(w, eeprom->DO);
+	put_u8(w, eeprom->DI);
+	put_u8(w, eeprom->CLK);
+	put_u8(w, eeprom->CS);
+	put_u8(w, eeprom->last_DI);
+	put_u8(w, eeprom->last_CLK);
+	put_u8(w, eeprom->last_CS);
+	put_u8(w, eeprom->value_bit);
+	put_u8(w, eeprom->address);
+	put_u16(w, eeprom->value);
+	for (size_t i = 0; i < N_ELEM(eeprom->data); i++) {
+		put_u16(w, eeprom->data[i]);
+	}
+}
+
+void load_mbc7(struct reader *r, struct gbcc_core *gbc, uint32_t version)
+{
+	struct gbcc_accelerometer *acc = &gbc->cart.mbc.accelerometer;
+	struct gbcc_eeprom *eeprom = &gbc->cart.mbc.eeprom;
+	acc->x = get_u16(r);
+	acc->y = get_u16(r);
+	acc->real_x = get_u16(r);
+	acc->real_y = get_u16(r);
+	acc->latch = get_bool(r);
+	eeprom->current_command = (enum EEPROM_COMMAND)get_u8(r);
+	eeprom->command = get_u16(r);
+	eeprom->command_bit = get_u8(r);
+	eeprom->start = get_bool(r);
+	eeprom->write_enable = get_bool(r);
+	eeprom->DO = get_bool(r);
+	eeprom->DI = get_bool(r);
+	eeprom->CLK = get_bool(r);
+	eeprom->CS = get_bool(r);
+	eeprom->last_DI = get_bool(r);
+	eeprom->last_CLK = get_bool(r);
+	eeprom->last_CS = get_bool(r);
+	eeprom->value_bit = get_u8(r);
+	eeprom->address = get_u8(r);
+	eeprom->value = get_u16(r);
+	for (size_t i = 0; i < N_ELEM(eeprom->data); i++) {
+		eeprom->data[i] = get_u16(r);
+	}
+}
+
+bool has_camera(const struct gbcc_core *gbc)
+{
+	return gbc->cart.mbc.type == CAMERA;
+}
+
+void save_camera(struct writer *w, const struct gbcc_core *gbc)
+{
+	const struct gbcc_camera *cam = &gbc->cart.mbc.camera;
+	put_u32(w, cam->capture_timer);
+	put_u8(w, cam->capture_request);
+	put_u8(w, cam->mapped);
+	put_u8(w, cam->filter_mode);
+	put_bytes(w, cam->matrix, sizeof(cam->matrix));
+	put_u8(w, cam->reg0);
+	put_u8(w, cam->reg1);
+	put_u8(w, cam->reg2);
+	put_u8(w, cam->reg3);
+	put_u8(w, cam->reg4);
+	put_u8(w, cam->reg5);
+	put_u8(w, cam->reg6);
+	put_u8(w, cam->reg7);
+	put_u8(w, cam->reg.n);
+	put_u8(w, cam->reg.vh);
+	put_u8(w, cam->reg.g);
+	put_u16(w, cam->reg.exposure_steps);
+	put_u8(w, cam->reg.p);
+	put_u8(w, cam->reg.m);
+	put_u8(w, cam->reg.x);
+	put_u8(w, cam->reg.e);
+	put_u8(w, cam->reg.i);
+	put_u8(w, cam->reg.v);
+	put_u8(w, cam->reg.z);
+	put_u8(w, cam->reg.o);
+}
+
+void load_camera(struct reader *r, struct gbcc_core *gbc, uint32_t version)
+{
+	struct gbcc_camera *cam = &gbc->cart.mbc.camera;
+	cam->capture_timer = get_u32(r);
+	cam->capture_request = get_bool(r);
+	cam->mapped = get_bool(r);
+	cam->filter_mode = get_u8(r);
+	get_bytes(r, cam->matrix, sizeof(cam->matrix));
+	cam->reg0 = get_u8(r);
+	cam->reg1 = get_u8(r);
+	cam->reg2 = get_u8(r);
+	cam->reg3 = get_u8(r);
+	cam->reg4 = get_u8(r);
+	cam->reg5 = get_u8(r);
+	cam->reg6 = get_u8(r);
+	cam->reg7 = get_u8(r);
+	cam->reg.n = get_bool(r);
+	cam->reg.vh = get_u8(r);
+	cam->reg.g = get_u8(r);
+	cam->reg.exposure_steps = get_u16(r);
+	cam->reg.p = get_u8(r);
+	cam->reg.m = get_u8(r);
+	cam->reg.x = get_u8(r);
+	cam->reg.e = get_u8(r);
+	cam->reg.i = get_bool(r);
+	cam->reg.v = get_u8(r);
+	cam->reg.z = get_u8(r);
+	cam->reg.o = get_u8(r);
+}
+
+bool has_sram(const struct gbcc_core *gbc)
+{
+	return gbc->cart.ram_size > 0;
+}
+
+bool check_sram(const struct gbcc_core *gbc, struct reader r)
+{
+	return r.size == gbc->cart.ram_size;
+}
+
+void save_sram(struct writer *w, const struct gbcc_core *gbc)
+{
+	put_bytes(w, gbc->cart.ram, gbc->cart.ram_size);
+}
+
+void load_sram(struct reader *r, struct gbcc_core *gbc, uint32_t version)
+{
+	get_bytes(r, gbc->cart.ram, gbc->cart.ram_size);
+}
+
+void save_link_cable(struct writer *w, const struct gbcc_core *gbc)
+{
+	put_u8(w, gbc->link_cable.received);
+	put_u8(w, gbc->link_cable.current_bit);
+	put_u16(w, gbc->link_cable.divider);
+	put_u16(w, gbc->link_cable.clock);
+	put_u8(w, (uint8_t)gbc->link_cable.state);
+}
+
+void load_link_cable(struct reader *r, struct gbcc_core *gbc, uint32_t version)
+{
+	gbc->link_cable.received = get_u8(r);
+	gbc->link_cable.current_bit = get_u8(r);
+	gbc->link_cable.divider = get_u16(r);
+	gbc->link_cable.clock = get_u16(r);
+	uint8_t state = get_u8(r);
+	if (state >= GBCC_LINK_CABLE_STATE_NUM_STATES) {
+		state = GBCC_LINK_CABLE_STATE_DISCONNECTED;
+	}
+	gbc->link_cable.state = (enum GBCC_LINK_CABLE_STATE)state;
+}
+
+bool has_printer(const struct gbcc_core *gbc)
+{
+	return gbc->link_cable.state == GBCC_LINK_CABLE_STATE_PRINTER;
+}
+
+/* Only the used part of the image buffer is saved */
+void save_printer(struct writer *w, const struct gbcc_core *gbc)
+{
+	const struct printer *p = &gbc->printer;
+	put_u16(w, p->image_buffer.length);
+	put_bytes(w, p->image_buffer.data, p->image_buffer.length);
+	put_u8(w, p->packet.command);
+	put_u8(w, p->packet.compression);
+	put_u16(w, p->packet.data_length);
+	put_u16(w, p->packet.printer_checksum);
+	put_u16(w, p->packet.gb_checksum);
+	put_u16(w, p->packet.current_byte);
+	put_u16(w, p->packet.data_byte);
+	put_u8(w, p->margin.top_width);
+	put_u8(w, p->margin.top_line);
+	put_u8(w, p->margin.bottom_width);
+	put_u8(w, p->margin.bottom_line);
+	put_u8(w, p->palette);
+	put_u8(w, p->exposure);
+	put_u8(w, p->status);
+	put_u8(w, p->magic);
+	put_u8(w, p->in_packet);
+	put_u16(w, p->print_byte);
+	put_u8(w, p->print_line);
+}
+
+void load_printer(struct reader *r, struct gbcc_core *gbc, uint32_t version)
+{
+	struct printer *p = &gbc->printer;
+	p->image_buffer.length = get_u16(r);
+	if (p->image_buffer.length > sizeof(p->image_buffer.data)) {
+		p->image_buffer.length = sizeof(p->image_buffer.data);
+	}
+	get_bytes(r, p->image_buffer.data, p->image_buffer.length);
+	p->packet.command = get_u8(r);
+	p->packet.compression = get_u8(r);
+	p->packet.data_length = get_u16(r);
+	p->packet.printer_checksum = get_u16(r);
+	p->packet.gb_checksum = get_u16(r);
+	p->packet.current_byte = get_u16(r);
+	p->packet.data_byte = get_u16(r);
+	p->margin.top_width = get_u8(r);
+	p->margin.top_line = get_u8(r);
+	p->margin.bottom_width = get_u8(r);
+	p->margin.bottom_line = get_u8(r);
+	p->palette = get_u8(r);
+	p->exposure = get_u8(r);
+	p->status = get_u8(r);
+	p->magic = get_bool(r);
+	p->in_packet = get_bool(r);
+	p->print_byte = get_u16(r);
+	p->print_line = get_u8(r);
+}
+
+void put_bytes(struct writer *w, const void *bytes, size_t n)
+{
+	if (w->buf) {
+		if (n > w->size - w->pos || w->pos > w->size) {
+			w->overflow = true;
+		} else {
+			memcpy(w->buf + w->pos, bytes, n);
+		}
+	}
+	w->pos += n;
+}
+
+void put_u8(struct writer *w, uint8_t val)
+{
+	put_bytes(w, &val, 1);
+}
+
+void put_u16(struct writer *w, uint16_t val)
+{
+	uint8_t bytes[2] = {val & 0xFFu, (uint8_t)(val >> 8u)};
+	put_bytes(w, bytes, sizeof(bytes));
+}
+
+void put_u32(struct writer *w, uint32_t val)
+{
+	put_u16(w, val & 0xFFFFu);
+	put_u16(w, (uint16_t)(val >> 16u));
+}
+
+void put_u64(struct writer *w, uint64_t val)
+{
+	put_u32(w, val & 0xFFFFFFFFu);
+	put_u32(w, (uint32_t)(val >> 32u));
+}
+
+void patch_u32(struct writer *w, size_t pos, uint32_t val)
+{
+	if (!w->buf || w->overflow) {
+		return;
+	}
+	for (uint8_t i = 0; i < 4; i++) {
+		w->buf[pos + i] = (uint8_t)(val >> (8u * i));
+	}
+}
+
+void get_bytes(struct reader *r, void *bytes, size_t n)
+{
+	size_t avail = 0;
+	if (r->pos < r->size) {
+		avail = r->size - r->pos;
+	}
+	if (avail > n) {
+		avail = n;
+	}
+	if (avail > 0) {
+		memcpy(bytes, r->data + r->pos, avail);
+	}
+	memset((uint8_t *)bytes + avail, 0, n - avail);
+	r->pos += n;
+}
+
+uint8_t get_u8(struct reader *r)
+{
+	uint8_t val;
+	get_bytes(r, &val, 1);
+	return val;
+}
+
+bool get_bool(struct reader *r)
+{
+	return get_u8(r) != 0;
+}
+
+uint16_t get_u16(struct reader *r)
+{
+	uint8_t bytes[2];
+	get_bytes(r, bytes, sizeof(bytes));
+	return (uint16_t)(bytes[0] | (bytes[1] << 8u));
+}
+
+uint32_t get_u32(struct reader *r)
+{
+	uint32_t lo = get_u16(r);
+	uint32_t hi = get_u16(r);
+	return lo | (hi << 16u);
+}
+
+uint64_t get_u64(struct reader *r)
+{
+	uint64_t lo = get_u32(r);
+	uint64_t hi = get_u32(r);
+	return lo | (hi << 32u);
+}
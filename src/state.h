@@ -0,0 +1,45 @@
+/*
+ * Copyright (C) 2017-2020 Philip Jones
+ *
+ * Licensed under the MIT License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/licenses/MIT
+ *
+ */
+
+#ifndef GBCC_STATE_H
+#define GBCC_STATE_H
+
+#include "core.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Savestate serialisation.
+ *
+ * A state is a short header, followed by a section for each part of the
+ * core, e.g. the cpu or the memory banks. Each section has a 4-character tag,
+ * its own version & its length, and its fields are written one at a time in
+ * little-endian order, so nothing depends on struct layout, the compiler or
+ * the host. Only real emulated state is written: pointers, settings & caches
+ * that can be rebuilt are all left out.
+ *
+ * New fields are added to the end of a section. Reading past the end of a
+ * section gives zeroes, so older states still load, and a section's version
+ * only needs bumping if existing fields change meaning. Sections with tags
+ * that aren't recognised are skipped.
+ *
+ * States go to & from a buffer provided by the caller, with no allocation or
+ * file access, so they're cheap enough to take every frame.
+ *
+ * States from before this format are converted when they're loaded, see
+ * state_legacy.h.
+ */
+
+size_t gbcc_state_size(const struct gbcc_core *gbc);
+size_t gbcc_state_save_to(struct gbcc_core *gbc, uint8_t *buf, size_t size);
+bool gbcc_state_load_from(struct gbcc_core *gbc, const uint8_t *buf, size_t size);
+
+#endif /* GBCC_STATE_H */
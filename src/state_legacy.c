@@ -0,0 +1,479 @@
+/*
+ * Copyright (C) 2017-2020 Philip Jones
+ *
+ * Licensed under the MIT License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/licenses/MIT
+ *
+ */
+
+#include "state_legacy.h"
+#include "bit_utils.h"
+#include "core.h"
+#include "debug.h"
+#include "nelem.h"
+#include "ppu.h"
+#include "tile_decode.h"
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * The core struct as of v8. These must never change, as they describe
+ * states that have already been written. Parts which haven't changed since
+ * then use the current types.
+ */
+
+struct legacy_tile {
+	uint8_t hi;
+	uint8_t lo;
+	uint8_t x;
+	uint8_t attr;
+};
+
+struct legacy_sprite {
+	uint8_t x;
+	uint8_t y;
+	uint16_t address;
+	struct legacy_tile tile;
+	bool loaded;
+};
+
+struct legacy_cpu {
+	/* Each register pair was a union with its two halves */
+	struct {
+		uint16_t af;
+		uint16_t bc;
+		uint16_t de;
+		uint16_t hl;
+		uint16_t sp;
+		uint16_t pc;
+	} reg;
+	uint8_t opcode;
+	bool ime;
+	bool stop;
+	bool double_speed;
+	bool tac_bit;
+	uint16_t div_timer;
+	uint8_t tima_reload;
+	uint8_t clock;
+	struct {
+		uint8_t timer;
+		bool target_state;
+	} ime_timer;
+	struct {
+		bool set;
+		bool no_interrupt;
+		bool skip;
+	} halt;
+	struct {
+		uint16_t source;
+		uint16_t new_source;
+		uint16_t timer;
+		bool requested;
+		bool running;
+	} dma;
+	struct {
+		uint16_t addr;
+		bool request;
+		bool running;
+	} interrupt;
+	struct {
+		uint16_t addr;
+		uint8_t op1;
+		uint8_t op2;
+		uint8_t step;
+		bool running;
+		bool prefix_cb;
+	} instruction;
+};
+
+struct legacy_apu {
+	uint16_t sync_clock;
+	uint16_t sample;
+	uint8_t left_vol;
+	uint8_t right_vol;
+	bool disabled;
+	bool div_bit;
+	struct timespec cur_time;
+	struct timespec start_time;
+	struct channel ch1;
+	struct channel ch2;
+	struct channel ch3;
+	struct channel ch4;
+	struct sweep sweep;
+	struct noise noise;
+	struct wave wave;
+	uint8_t sequencer_counter;
+};
+
+struct legacy_ppu {
+	uint64_t frame;
+	uint32_t clock;
+	bool lcd_disable;
+	uint8_t bgp[64];
+	uint8_t obp[64];
+	struct palette palette;
+	struct line_buffer bg_line;
+	struct line_buffer window_line;
+	struct line_buffer sprite_line;
+	struct {
+		uint32_t *buffer_0;
+		uint32_t *buffer_1;
+		uint32_t *gbc;
+		uint32_t *sdl;
+	} screen;
+	sem_t vsync_semaphore;
+	uint8_t scy;
+	uint8_t scx;
+	uint8_t ly;
+	uint8_t lyc;
+	uint8_t wy;
+	uint8_t wx;
+	uint8_t lcdc;
+	bool last_stat;
+	uint8_t x;
+	uint8_t window_ly;
+	uint16_t next_dot;
+	uint8_t n_sprites;
+	struct legacy_sprite sprites[10];
+	struct legacy_tile bg_tile;
+	struct legacy_tile window_tile;
+};
+
+struct legacy_mbc {
+	enum MBC type;
+	uint16_t rom0_bank;
+	uint16_t romx_bank;
+	uint8_t sram_bank;
+	uint8_t ramg;
+	uint8_t romb0;
+	uint8_t romb1;
+	uint8_t ramb;
+	bool unlocked;
+	bool sram_enable;
+	bool sram_changed;
+	time_t last_save_time;
+	struct gbcc_rtc rtc;
+	struct gbcc_accelerometer accelerometer;
+	struct gbcc_eeprom eeprom;
+	struct gbcc_camera camera;
+};
+
+struct legacy_core {
+	uint32_t version;
+	struct legacy_cpu cpu;
+	struct legacy_apu apu;
+	struct legacy_ppu ppu;
+	enum CART_MODE mode;
+	struct {
+		uint16_t source;
+		uint16_t dest;
+		uint16_t length;
+		uint16_t to_copy;
+		bool hblank;
+	} hdma;
+	struct {
+		uint8_t *rom0;
+		uint8_t *romx;
+		uint8_t *vram;
+		uint8_t *sram;
+		uint8_t *wram0;
+		uint8_t *wramx;
+		uint8_t *echo;
+		uint8_t oam[OAM_SIZE];
+		uint8_t unused[UNUSED_SIZE];
+		uint8_t ioreg[IOREG_SIZE];
+		uint8_t hram[HRAM_SIZE];
+		uint8_t iereg;
+		uint8_t wram_bank[8][WRAM0_SIZE];
+		uint8_t vram_bank[2][VRAM_SIZE];
+	} memory;
+	struct {
+		struct legacy_mbc mbc;
+		const char *filename;
+		uint8_t *rom;
+		size_t rom_size;
+		size_t rom_banks;
+		uint8_t *ram;
+		size_t ram_size;
+		size_t ram_banks;
+		bool battery;
+		bool timer;
+		bool rumble;
+		bool rumble_state;
+		char title[CART_TITLE_SIZE + 1];
+	} cart;
+	struct {
+		bool a;
+		bool b;
+		bool start;
+		bool select;
+		struct {
+			bool up;
+			bool down;
+			bool left;
+			bool right;
+		} dpad;
+		bool turbo;
+		bool interrupt;
+	} keys;
+	struct printer printer;
+	struct {
+		uint8_t received;
+		uint8_t current_bit;
+		uint16_t divider;
+		uint16_t clock;
+		enum GBCC_LINK_CABLE_STATE state;
+	} link_cable;
+	struct {
+		struct gbcc_gamegenie_cheat gamegenie[32];
+		struct gbcc_gameshark_cheat gameshark[32];
+		uint8_t num_genie_cheats;
+		uint8_t num_shark_cheats;
+		bool enabled;
+	} cheats;
+	bool sync_to_video;
+	bool hide_background;
+	bool hide_window;
+	bool hide_sprites;
+	bool initialised;
+	bool error;
+	const char *error_msg;
+};
+
+static void convert_cpu(struct cpu *cpu, const struct legacy_cpu *old);
+static void convert_apu(struct apu *apu, const struct legacy_apu *old);
+static void convert_ppu(struct ppu *ppu, const struct legacy_ppu *old);
+static void convert_tile(struct tile *tile, const struct legacy_tile *old);
+static void convert_mbc(struct gbcc_mbc *mbc, const struct legacy_mbc *old);
+
+/* Version of the struct a legacy state holds, or 0 if it isn't one */
+uint32_t gbcc_state_legacy_version(const uint8_t *data, size_t size)
+{
+	uint32_t version;
+	if (size < sizeof(version)) {
+		return 0;
+	}
+	memcpy(&version, data, sizeof(version));
+	if (version > GBCC_STATE_LEGACY_VERSION) {
+		return 0;
+	}
+	return version;
+}
+
+/*
+ * Fill in everything a savestate holds in out from a legacy state. The
+ * cartridge in out must already be set up, with its RAM allocated.
+ */
+bool gbcc_state_legacy_convert(struct gbcc_core *out, const uint8_t *data, size_t size)
+{
+	uint32_t version = gbcc_state_legacy_version(data, size);
+	if (version < GBCC_STATE_LEGACY_MIN_VERSION) {
+		gbcc_log_error("Save state version mismatch, tried to load v%u "
+				"(oldest supported version is v%u).\n",
+				version, GBCC_STATE_LEGACY_MIN_VERSION);
+		return false;
+	}
+
+	struct legacy_core *old = calloc(1, sizeof(*old));
+	if (!old) {
+		gbcc_log_error("Couldn't allocate memory for save state.\n");
+		return false;
+	}
+	size_t struct_size = sizeof(*old);
+	if (version == 7) {
+		/*
+		 * v8 added cheats, which aren't needed, so the struct was just
+		 * read that much shorter. Everything after them is settings
+		 * that aren't loaded anyway.
+		 */
+		struct_size -= sizeof(old->cheats);
+	}
+	if (size != struct_size + out->cart.ram_size) {
+		gbcc_log_error("Save state v%u doesn't match this cartridge, "
+				"or was saved on a different platform.\n",
+				version);
+		free(old);
+		return false;
+	}
+	/* The data may not be aligned */
+	memcpy(old, data, struct_size);
+
+	convert_cpu(&out->cpu, &old->cpu);
+	convert_apu(&out->apu, &old->apu);
+	convert_ppu(&out->ppu, &old->ppu);
+	out->mode = (old->mode == DMG) ? DMG : GBC;
+	out->hdma.source = old->hdma.source;
+	out->hdma.dest = old->hdma.dest;
+	out->hdma.length = old->hdma.length;
+	out->hdma.to_copy = old->hdma.to_copy;
+	out->hdma.hblank = old->hdma.hblank;
+
+	memcpy(out->memory.oam, old->memory.oam, OAM_SIZE);
+	memcpy(out->memory.unused, old->memory.unused, UNUSED_SIZE);
+	memcpy(out->memory.ioreg, old->memory.ioreg, IOREG_SIZE);
+	memcpy(out->memory.hram, old->memory.hram, HRAM_SIZE);
+	out->memory.iereg = old->memory.iereg;
+	memcpy(out->memory.wram_bank, old->memory.wram_bank, sizeof(old->memory.wram_bank));
+	memcpy(out->memory.vram_bank, old->memory.vram_bank, sizeof(old->memory.vram_bank));
+	/* The colour cache didn't exist yet */
+	gbcc_ppu_update_colours(out);
+
+	convert_mbc(&out->cart.mbc, &old->cart.mbc);
+	if (out->cart.ram_size > 0) {
+		memcpy(out->cart.ram, data + struct_size, out->cart.ram_size);
+	}
+
+	out->printer = old->printer;
+	out->link_cable.received = old->link_cable.received;
+	out->link_cable.current_bit = old->link_cable.current_bit;
+	out->link_cable.divider = old->link_cable.divider;
+	out->link_cable.clock = old->link_cable.clock;
+	out->link_cable.state = old->link_cable.state;
+	if (out->link_cable.state >= GBCC_LINK_CABLE_STATE_NUM_STATES) {
+		out->link_cable.state = GBCC_LINK_CABLE_STATE_DISCONNECTED;
+	}
+
+	free(old);
+	return true;
+}
+
+void convert_cpu(struct cpu *cpu, const struct legacy_cpu *old)
+{
+	cpu->reg.af = old->reg.af;
+	cpu->reg.bc = old->reg.bc;
+	cpu->reg.de = old->reg.de;
+	cpu->reg.hl = old->reg.hl;
+	cpu->reg.sp = old->reg.sp;
+	cpu->reg.pc = old->reg.pc;
+	/* F was always kept up to date back then */
+	cpu->flags.op = GBCC_FLAGS_SYNCED;
+	cpu->opcode = old->opcode;
+	cpu->ime = old->ime;
+	cpu->stop = old->stop;
+	cpu->double_speed = old->double_speed;
+	cpu->tac_bit = old->tac_bit;
+	cpu->div_timer = old->div_timer;
+	cpu->tima_reload = old->tima_reload;
+	cpu->clock = old->clock;
+	cpu->ime_timer.timer = old->ime_timer.timer;
+	cpu->ime_timer.target_state = old->ime_timer.target_state;
+	cpu->halt.set = old->halt.set;
+	cpu->halt.no_interrupt = old->halt.no_interrupt;
+	cpu->halt.skip = old->halt.skip;
+	cpu->dma.source = old->dma.source;
+	cpu->dma.new_source = old->dma.new_source;
+	cpu->dma.timer = old->dma.timer;
+	cpu->dma.requested = old->dma.requested;
+	cpu->dma.running = old->dma.running;
+	cpu->interrupt.addr = old->interrupt.addr;
+	cpu->interrupt.request = old->interrupt.request;
+	cpu->interrupt.running = old->interrupt.running;
+	cpu->instruction.addr = old->instruction.addr;
+	cpu->instruction.op1 = old->instruction.op1;
+	cpu->instruction.op2 = old->instruction.op2;
+	/* Decoded from the opcode the same way for both tables */
+	cpu->instruction.mod = old->opcode & 0x07u;
+	cpu->instruction.div = (old->opcode >> 3u) & 0x07u;
+	cpu->instruction.step = old->instruction.step;
+	cpu->instruction.running = old->instruction.running;
+	cpu->instruction.prefix_cb = old->instruction.prefix_cb;
+}
+
+/* The audio output carries on from where it is, not where it was saved */
+void convert_apu(struct apu *apu, const struct legacy_apu *old)
+{
+	apu->left_vol = old->left_vol;
+	apu->right_vol = old->right_vol;
+	apu->disabled = old->disabled;
+	apu->div_bit = old->div_bit;
+	apu->ch1 = old->ch1;
+	apu->ch2 = old->ch2;
+	apu->ch3 = old->ch3;
+	apu->ch4 = old->ch4;
+	apu->sweep = old->sweep;
+	apu->noise = old->noise;
+	apu->wave = old->wave;
+	apu->sequencer_counter = old->sequencer_counter;
+}
+
+/*
+ * Lines were drawn a dot at a time back then, so a state saved during mode 3
+ * carries on that way until the end of the line.
+ */
+void convert_ppu(struct ppu *ppu, const struct legacy_ppu *old)
+{
+	ppu->frame = old->frame;
+	ppu->clock = old->clock;
+	ppu->lcd_disable = old->lcd_disable;
+	memcpy(ppu->bgp, old->bgp, sizeof(ppu->bgp));
+	memcpy(ppu->obp, old->obp, sizeof(ppu->obp));
+	ppu->bg_line = old->bg_line;
+	ppu->window_line = old->window_line;
+	ppu->sprite_line = old->sprite_line;
+	ppu->scy = old->scy;
+	ppu->scx = old->scx;
+	ppu->ly = old->ly;
+	ppu->lyc = old->lyc;
+	ppu->wy = old->wy;
+	ppu->wx = old->wx;
+	ppu->lcdc = old->lcdc;
+	ppu->last_stat = old->last_stat;
+	ppu->x = old->x;
+	ppu->window_ly = old->window_ly;
+	ppu->line_window_ly = old->window_ly;
+	ppu->next_dot = old->next_dot;
+	/* HBLANK used to start on the dot after the last pixel */
+	ppu->hblank_dot = old->next_dot;
+	ppu->line_drawn = false;
+	ppu->n_sprites = old->n_sprites;
+	for (size_t i = 0; i < N_ELEM(ppu->sprites); i++) {
+		ppu->sprites[i].x = old->sprites[i].x;
+		ppu->sprites[i].y = old->sprites[i].y;
+		ppu->sprites[i].address = old->sprites[i].address;
+		convert_tile(&ppu->sprites[i].tile, &old->sprites[i].tile);
+		ppu->sprites[i].loaded = old->sprites[i].loaded;
+	}
+	convert_tile(&ppu->bg_tile, &old->bg_tile);
+	convert_tile(&ppu->window_tile, &old->window_tile);
+}
+
+/* Tiles used to hold the raw row, flipped as each pixel was drawn */
+void convert_tile(struct tile *tile, const struct legacy_tile *old)
+{
+	gbcc_tile_decode_row(old->lo, old->hi, tile->pixels);
+	if (check_bit(old->attr, 5)) {
+		for (uint8_t x = 0; x < 4; x++) {
+			uint8_t tmp = tile->pixels[x];
+			tile->pixels[x] = tile->pixels[7 - x];
+			tile->pixels[7 - x] = tmp;
+		}
+	}
+	tile->x = old->x;
+	tile->attr = old->attr;
+}
+
+/* The cartridge's own mbc type is kept */
+void convert_mbc(struct gbcc_mbc *mbc, const struct legacy_mbc *old)
+{
+	mbc->rom0_bank = old->rom0_bank;
+	mbc->romx_bank = old->romx_bank;
+	mbc->sram_bank = old->sram_bank;
+	mbc->ramg = old->ramg;
+	mbc->romb0 = old->romb0;
+	mbc->romb1 = old->romb1;
+	mbc->ramb = old->ramb;
+	mbc->unlocked = old->unlocked;
+	mbc->sram_enable = old->sram_enable;
+	mbc->rtc = old->rtc;
+	mbc->accelerometer = old->accelerometer;
+	mbc->eeprom = old->eeprom;
+	mbc->camera = old->camera;
+}
@@ -0,0 +1,35 @@
+/*
+ * Copyright (C) 2017-2020 Philip Jones
+ *
+ * Licensed under the MIT License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/licenses/MIT
+ *
+ */
+
+#ifndef GBCC_STATE_LEGACY_H
+#define GBCC_STATE_LEGACY_H
+
+#include "core.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Savestates from before the section format.
+ *
+ * These were a raw copy of the core struct, starting with its version
+ * number, followed by the cartridge RAM. They're picked apart field by field
+ * using a frozen copy of the old struct layout, so they only load on the
+ * same kind of host that wrote them, as before.
+ */
+
+/* Oldest & last versions of the raw core struct that can be converted */
+#define GBCC_STATE_LEGACY_MIN_VERSION 7
+#define GBCC_STATE_LEGACY_VERSION 8
+
+uint32_t gbcc_state_legacy_version(const uint8_t *data, size_t size);
+bool gbcc_state_legacy_convert(struct gbcc_core *out, const uint8_t *data, size_t size);
+
+#endif /* GBCC_STATE_LEGACY_H */
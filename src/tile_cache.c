@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2017-2020 Philip Jones
+ *
+ * Licensed under the MIT License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/licenses/MIT
+ *
+ */
+
+#include "core.h"
+#include "tile_cache.h"
+#include "tile_decode.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void decode(struct gbcc_core *gbc, uint8_t bank, uint16_t tile);
+
+struct gbcc_tile_cache *gbcc_tile_cache_create(void)
+{
+	return calloc(1, sizeof(struct gbcc_tile_cache));
+}
+
+void gbcc_tile_cache_destroy(struct gbcc_tile_cache *cache)
+{
+	free(cache);
+}
+
+/* Drop everything, e.g. after VRAM has been replaced by a savestate */
+void gbcc_tile_cache_flush(struct gbcc_tile_cache *cache)
+{
+	memset(cache->valid, 0, sizeof(cache->valid));
+}
+
+/* Called whenever a byte of VRAM is written to, in either bank */
+void gbcc_tile_cache_invalidate(struct gbcc_core *gbc, const uint8_t *byte)
+{
+	size_t idx = (size_t)(byte - gbc->memory.vram_bank[0]);
+	size_t offset = idx % VRAM_SIZE;
+	if (offset < 16 * GBCC_VRAM_TILES) {
+		gbc->tile_cache->valid[idx / VRAM_SIZE][offset / 16] = false;
+	}
+}
+
+/*
+ * Returns the 8 colour indices of the tile row whose first byte is at offset
+ * in the given VRAM bank, in the order they're drawn.
+ */
+const uint8_t *gbcc_tile_cache_row(struct gbcc_core *gbc, uint8_t bank, uint16_t offset, bool flip)
+{
+	struct gbcc_tile_cache *cache = gbc->tile_cache;
+	uint16_t tile = offset / 16;
+	if (!cache->valid[bank][tile]) {
+		decode(gbc, bank, tile);
+	}
+	return cache->pixels[bank][tile][flip][(offset % 16) / 2];
+}
+
+void decode(struct gbcc_core *gbc, uint8_t bank, uint16_t tile)
+{
+	uint8_t (*pixels)[8][8] = gbc->tile_cache->pixels[bank][tile];
+	gbcc_tile_decode(&gbc->memory.vram_bank[bank][16 * tile], pixels[0]);
+	for (uint8_t y = 0; y < 8; y++) {
+		for (uint8_t x = 0; x < 8; x++) {
+			pixels[1][y][7 - x] = pixels[0][y][x];
+		}
+	}
+	gbc->tile_cache->valid[bank][tile] = true;
+}
@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) 2017-2020 Philip Jones
+ *
+ * Licensed under the MIT License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/licenses/MIT
+ *
+ */
+
+#ifndef GBCC_TILE_CACHE_H
+#define GBCC_TILE_CACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Tiles in the tile data area (0x8000 - 0x97FF) of each VRAM bank */
+#define GBCC_VRAM_TILES 384
+
+struct gbcc_core;
+
+/*
+ * Decoded tile cache.
+ *
+ * Each row of a tile is stored in VRAM as two bitplanes, so every pixel the
+ * ppu draws would otherwise need picking apart bit by bit. Instead, tiles are
+ * decoded into one colour index per byte, both as stored and flipped
+ * horizontally, the first time they're needed after being written to.
+ */
+
+struct gbcc_tile_cache {
+	uint8_t pixels[2][GBCC_VRAM_TILES][2][8][8];	/* [bank][tile][x flip][y][x] */
+	bool valid[2][GBCC_VRAM_TILES];
+};
+
+struct gbcc_tile_cache *gbcc_tile_cache_create(void);
+void gbcc_tile_cache_destroy(struct gbcc_tile_cache *cache);
+void gbcc_tile_cache_flush(struct gbcc_tile_cache *cache);
+void gbcc_tile_cache_invalidate(struct gbcc_core *gbc, const uint8_t *byte);
+const uint8_t *gbcc_tile_cache_row(struct gbcc_core *gbc, uint8_t bank, uint16_t offset, bool flip);
+
+#endif /* GBCC_TILE_CACHE_H */
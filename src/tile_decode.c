@@ -0,0 +1,205 @@
+/*
+ * Copyright (C) 2017-2020 Philip Jones
+ *
+ * Licensed under the MIT License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/licenses/MIT
+ *
+ */
+
+#include "bit_utils.h"
+#include "debug.h"
+#include "tile_decode.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define TILE_SIMD
+#include <immintrin.h>
+#endif
+
+/* Each byte of spread[i] holds one bit of i, most significant first */
+static uint64_t spread[256];
+
+static void decode_scalar(const uint8_t *data, uint8_t pixels[8][8]);
+static void encode_scalar(const uint8_t *image, size_t stride, uint8_t *data);
+#ifdef TILE_SIMD
+static void decode_sse2(const uint8_t *data, uint8_t pixels[8][8]);
+static void decode_avx2(const uint8_t *data, uint8_t pixels[8][8]);
+static void encode_sse2(const uint8_t *image, size_t stride, uint8_t *data);
+#endif
+
+static void (*decode_tile)(const uint8_t *data, uint8_t pixels[8][8]) = decode_scalar;
+static void (*encode_tile)(const uint8_t *image, size_t stride, uint8_t *data) = encode_scalar;
+
+void gbcc_tile_decode_init(void)
+{
+	for (int i = 0; i < 256; i++) {
+		uint8_t row[8];
+		for (uint8_t x = 0; x < 8; x++) {
+			row[x] = check_bit((uint8_t)i, 7 - x);
+		}
+		memcpy(&spread[i], row, sizeof(row));
+	}
+#ifdef TILE_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		decode_tile = decode_avx2;
+		encode_tile = encode_sse2;
+		gbcc_log_debug("Using AVX2 tile conversion.\n");
+	} else if (__builtin_cpu_supports("sse2")) {
+		decode_tile = decode_sse2;
+		encode_tile = encode_sse2;
+		gbcc_log_debug("Using SSE2 tile conversion.\n");
+	}
+#endif
+}
+
+/* The 8 colour indices of one row, leftmost first */
+void gbcc_tile_decode_row(uint8_t lo, uint8_t hi, uint8_t pixels[8])
+{
+	/* No carries between bytes, as each one is only 0 or 1 */
+	uint64_t row = spread[lo] | (spread[hi] << 1u);
+	memcpy(pixels, &row, sizeof(row));
+}
+
+/* All 64 colour indices of the 16 byte tile at data */
+void gbcc_tile_decode(const uint8_t *data, uint8_t pixels[8][8])
+{
+	decode_tile(data, pixels);
+}
+
+/*
+ * The reverse of gbcc_tile_decode(), taking an 8x8 block of colour indices
+ * from an image stride bytes wide. Only the bottom 2 bits of each pixel are
+ * used.
+ */
+void gbcc_tile_encode(const uint8_t *image, size_t stride, uint8_t *data)
+{
+	encode_tile(image, stride, data);
+}
+
+void decode_scalar(const uint8_t *data, uint8_t pixels[8][8])
+{
+	for (uint8_t y = 0; y < 8; y++) {
+		gbcc_tile_decode_row(data[2 * y], data[2 * y + 1], pixels[y]);
+	}
+}
+
+void encode_scalar(const uint8_t *image, size_t stride, uint8_t *data)
+{
+	for (uint8_t y = 0; y < 8; y++) {
+		const uint8_t *row = &image[y * stride];
+		uint8_t lo = 0;
+		uint8_t hi = 0;
+		for (uint8_t x = 0; x < 8; x++) {
+			lo = (uint8_t)(lo << 1u) | check_bit(row[x], 0);
+			hi = (uint8_t)(hi << 1u) | check_bit(row[x], 1);
+		}
+		data[2 * y] = lo;
+		data[2 * y + 1] = hi;
+	}
+}
+
+#ifdef TILE_SIMD
+
+/*
+ * Both SIMD decoders work the same way: copy each byte of a bitplane into
+ * all 8 pixels of its row, then test a different bit in each pixel.
+ */
+
+__attribute__((target("sse2")))
+void decode_sse2(const uint8_t *data, uint8_t pixels[8][8])
+{
+	const __m128i bits = _mm_setr_epi8(
+			-128, 64, 32, 16, 8, 4, 2, 1,
+			-128, 64, 32, 16, 8, 4, 2, 1);
+	const __m128i one = _mm_set1_epi8(1);
+	const __m128i two = _mm_set1_epi8(2);
+
+	__m128i tile = _mm_loadu_si128((const __m128i *)data);
+	/* Low bitplane in bytes 0-7, high in 8-15 */
+	__m128i planes = _mm_packus_epi16(
+			_mm_and_si128(tile, _mm_set1_epi16(0x00FF)),
+			_mm_srli_epi16(tile, 8));
+	__m128i lo2 = _mm_unpacklo_epi8(planes, planes);
+	__m128i hi2 = _mm_unpackhi_epi8(planes, planes);
+	__m128i lo4[2] = {_mm_unpacklo_epi16(lo2, lo2), _mm_unpackhi_epi16(lo2, lo2)};
+	__m128i hi4[2] = {_mm_unpacklo_epi16(hi2, hi2), _mm_unpackhi_epi16(hi2, hi2)};
+
+	/* Two rows at a time */
+	for (int i = 0; i < 4; i++) {
+		__m128i lo, hi;
+		if (i % 2 == 0) {
+			lo = _mm_unpacklo_epi32(lo4[i / 2], lo4[i / 2]);
+			hi = _mm_unpacklo_epi32(hi4[i / 2], hi4[i / 2]);
+		} else {
+			lo = _mm_unpackhi_epi32(lo4[i / 2], lo4[i / 2]);
+			hi = _mm_unpackhi_epi32(hi4[i / 2], hi4[i / 2]);
+		}
+		lo = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(lo, bits), bits), one);
+		hi = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(hi, bits), bits), two);
+		_mm_storeu_si128((__m128i *)pixels[2 * i], _mm_or_si128(lo, hi));
+	}
+}
+
+__attribute__((target("avx2")))
+void decode_avx2(const uint8_t *data, uint8_t pixels[8][8])
+{
+	const __m256i bits = _mm256_setr_epi8(
+			-128, 64, 32, 16, 8, 4, 2, 1,
+			-128, 64, 32, 16, 8, 4, 2, 1,
+			-128, 64, 32, 16, 8, 4, 2, 1,
+			-128, 64, 32, 16, 8, 4, 2, 1);
+	/* Low bitplane bytes of rows 0-3; add 1 for the high, 8 for rows 4-7 */
+	const __m256i rows = _mm256_setr_epi8(
+			0, 0, 0, 0, 0, 0, 0, 0,
+			2, 2, 2, 2, 2, 2, 2, 2,
+			4, 4, 4, 4, 4, 4, 4, 4,
+			6, 6, 6, 6, 6, 6, 6, 6);
+	const __m256i one = _mm256_set1_epi8(1);
+	const __m256i two = _mm256_set1_epi8(2);
+
+	/* Shuffles only work within each 128-bit half */
+	__m256i tile = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)data));
+
+	/* Four rows at a time */
+	for (int i = 0; i < 2; i++) {
+		__m256i idx = _mm256_add_epi8(rows, _mm256_set1_epi8((char)(8 * i)));
+		__m256i lo = _mm256_shuffle_epi8(tile, idx);
+		__m256i hi = _mm256_shuffle_epi8(tile, _mm256_add_epi8(idx, one));
+		lo = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(lo, bits), bits), one);
+		hi = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(hi, bits), bits), two);
+		_mm256_storeu_si256((__m256i *)pixels[4 * i], _mm256_or_si256(lo, hi));
+	}
+}
+
+/*
+ * Shifting each pixel's bit into the top of its byte lets movemask gather a
+ * whole bitplane row at once. Rows are byte-swapped first, because movemask
+ * puts the leftmost pixel in the lowest bit rather than the highest.
+ */
+__attribute__((target("sse2")))
+void encode_sse2(const uint8_t *image, size_t stride, uint8_t *data)
+{
+	/* Two rows at a time */
+	for (int y = 0; y < 8; y += 2) {
+		uint64_t r0;
+		uint64_t r1;
+		memcpy(&r0, &image[(size_t)y * stride], sizeof(r0));
+		memcpy(&r1, &image[(size_t)(y + 1) * stride], sizeof(r1));
+		__m128i row = _mm_set_epi64x(
+				(long long)__builtin_bswap64(r1),
+				(long long)__builtin_bswap64(r0));
+		int lo = _mm_movemask_epi8(_mm_slli_epi16(row, 7));
+		int hi = _mm_movemask_epi8(_mm_slli_epi16(row, 6));
+		data[2 * y] = (uint8_t)lo;
+		data[2 * y + 1] = (uint8_t)hi;
+		data[2 * y + 2] = (uint8_t)(lo >> 8);
+		data[2 * y + 3] = (uint8_t)(hi >> 8);
+	}
+}
+
+#endif /* TILE_SIMD */
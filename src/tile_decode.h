@@ -0,0 +1,34 @@
+/*
+ * Copyright (C) 2017-2020 Philip Jones
+ *
+ * Licensed under the MIT License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/licenses/MIT
+ *
+ */
+
+#ifndef GBCC_TILE_DECODE_H
+#define GBCC_TILE_DECODE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Conversion between the Game Boy's 2bpp tile format and one colour index
+ * per byte.
+ *
+ * Each 8 pixel row of a tile is stored as two bytes, the first holding bit 0
+ * of every pixel's colour and the second bit 1, with the leftmost pixel in
+ * bit 7. Whole tiles (16 bytes to 64 pixels and back) are converted with
+ * SSE2 or AVX2 where the CPU has them, picked once by gbcc_tile_decode_init();
+ * single rows are done with a lookup table, as that's already about as
+ * cheap as it gets.
+ */
+
+void gbcc_tile_decode_init(void);
+void gbcc_tile_decode_row(uint8_t lo, uint8_t hi, uint8_t pixels[8]);
+void gbcc_tile_decode(const uint8_t *data, uint8_t pixels[8][8]);
+void gbcc_tile_encode(const uint8_t *image, size_t stride, uint8_t *data);
+
+#endif /* GBCC_TILE_DECODE_H */
@@ -0,0 +1,194 @@
+/*
+ * Copyright (C) 2017-2020 Philip Jones
+ *
+ * Licensed under the MIT License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/licenses/MIT
+ *
+ */
+
+#include "core.h"
+#include "apu.h"
+#include "bit_utils.h"
+#include "interrupt.h"
+#include "memory.h"
+#include "scheduler.h"
+#include "timer.h"
+#include <stdint.h>
+
+/*
+ * The DIV counter itself is still incremented every tick by the CPU, but the
+ * edge detectors attached to it are only run on the ticks where something
+ * can happen. Between those ticks, cpu.tac_bit and apu.div_bit hold the value
+ * the detector will see as the "previous" bit the next time it runs, rather
+ * than the value from the last tick.
+ */
+
+static uint16_t tima_mask(struct gbcc_core *gbc);
+static uint16_t sequencer_mask(struct gbcc_core *gbc);
+static uint32_t next_edge(uint16_t div, uint16_t mask, bool old_bit);
+static void schedule_tima(struct gbcc_core *gbc);
+static void schedule_sequencer(struct gbcc_core *gbc);
+
+void gbcc_timer_tima_clock(struct gbcc_core *gbc)
+{
+	struct cpu *cpu = &gbc->cpu;
+	bool old_bit = cpu->tac_bit;
+	cpu->tac_bit = cpu->div_timer & tima_mask(gbc);
+	if (old_bit && !cpu->tac_bit) {
+		/*
+		 * The selected bit was previously high, and is now low, so
+		 * the tima increment logic triggers.
+		 */
+		uint8_t tima = gbcc_memory_read(gbc, TIMA);
+		tima++;
+		if (tima == 0) {
+			/*
+			 * TIMA overflow
+			 * Rather than being reloaded immediately, TIMA takes
+			 * 4 cycles to be reloaded, and another 4 to write,
+			 * so we just queue it here. This also affects the
+			 * interrupt.
+			 */
+			cpu->tima_reload = 8;
+		}
+		gbcc_memory_write(gbc, TIMA, tima);
+	}
+	if (cpu->tima_reload > 0) {
+		cpu->tima_reload--;
+		if (cpu->tima_reload == 4) {
+			/*
+			 * Some more weird behaviour here: if TIMA has been
+			 * written to while this copy & interrupt are waiting,
+			 * they get cancelled, and everything proceeds as
+			 * normal.
+			 */
+			if (gbcc_memory_read(gbc, TIMA) != 0) {
+				cpu->tima_reload = 0;
+			} else {
+				gbcc_memory_copy(gbc, TMA, TIMA);
+				gbcc_interrupt_request(gbc, 2);
+			}
+		}
+		else if (cpu->tima_reload == 0) {
+			gbcc_memory_copy(gbc, TMA, TIMA);
+		}
+	}
+	schedule_tima(gbc);
+}
+
+void gbcc_timer_sequencer_clock(struct gbcc_core *gbc)
+{
+	/* APU also updates based on falling edge of DIV timer bit */
+	bool old_bit = gbc->apu.div_bit;
+	gbc->apu.div_bit = gbc->cpu.div_timer & sequencer_mask(gbc);
+	if (old_bit && !gbc->apu.div_bit) {
+		gbcc_apu_sequencer_clock(gbc);
+	}
+	schedule_sequencer(gbc);
+}
+
+/* Set the edge detectors to the bits they saw on the last tick */
+void gbcc_timer_sync(struct gbcc_core *gbc)
+{
+	gbc->cpu.tac_bit = gbc->cpu.div_timer & tima_mask(gbc);
+	if (!gbc->apu.disabled) {
+		gbc->apu.div_bit = gbc->cpu.div_timer & sequencer_mask(gbc);
+	}
+}
+
+void gbcc_timer_schedule(struct gbcc_core *gbc)
+{
+	schedule_tima(gbc);
+	schedule_sequencer(gbc);
+}
+
+uint16_t tima_mask(struct gbcc_core *gbc)
+{
+	uint8_t tac = gbcc_memory_read_force(gbc, TAC);
+	uint16_t mask = 0;
+	switch (tac & 0x03u) {
+		/*
+		 * TIMA register detects the falling edge of a bit in
+		 * the internal DIV timer, which is selected by TAC.
+		 */
+		case 0:
+			mask = bit16(9);
+			break;
+		case 1:
+			mask = bit16(3);
+			break;
+		case 2:
+			mask = bit16(5);
+			break;
+		case 3:
+			mask = bit16(7);
+			break;
+	}
+	/* If TAC is disabled, this will always see 0 */
+	mask *= check_bit(tac, 2);
+	return mask;
+}
+
+uint16_t sequencer_mask(struct gbcc_core *gbc)
+{
+	if (gbc->cpu.double_speed) {
+		return bit16(13);
+	}
+	return bit16(12);
+}
+
+/*
+ * Number of ticks until the masked bit of DIV next goes from high to low,
+ * given the bit the detector saw on the last tick, or 0 if it never will.
+ */
+uint32_t next_edge(uint16_t div, uint16_t mask, bool old_bit)
+{
+	if (!mask) {
+		return 0;
+	}
+	if (old_bit && !((uint16_t)(div + 1) & mask)) {
+		return 1;
+	}
+	/* Otherwise, the bit falls whenever the bits below it wrap around */
+	uint32_t period = 2u * mask;
+	uint32_t n = period - (div & (period - 1));
+	if (n < 2) {
+		n += period;
+	}
+	return n;
+}
+
+void schedule_tima(struct gbcc_core *gbc)
+{
+	struct cpu *cpu = &gbc->cpu;
+	if (cpu->tima_reload > 0) {
+		/* Step through the reload a tick at a time */
+		gbcc_scheduler_add(gbc, GBCC_EVENT_TIMA, gbcc_scheduler_tick_time(gbc, 1));
+		return;
+	}
+	uint32_t n = next_edge(cpu->div_timer, tima_mask(gbc), cpu->tac_bit);
+	if (n == 0) {
+		gbcc_scheduler_remove(gbc, GBCC_EVENT_TIMA);
+		return;
+	}
+	if (n > 1) {
+		cpu->tac_bit = true;
+	}
+	gbcc_scheduler_add(gbc, GBCC_EVENT_TIMA, gbcc_scheduler_tick_time(gbc, n));
+}
+
+void schedule_sequencer(struct gbcc_core *gbc)
+{
+	struct apu *apu = &gbc->apu;
+	if (apu->disabled) {
+		gbcc_scheduler_remove(gbc, GBCC_EVENT_APU_SEQUENCER);
+		return;
+	}
+	uint32_t n = next_edge(gbc->cpu.div_timer, sequencer_mask(gbc), apu->div_bit);
+	if (n > 1) {
+		apu->div_bit = true;
+	}
+	gbcc_scheduler_add(gbc, GBCC_EVENT_APU_SEQUENCER, gbcc_scheduler_tick_time(gbc, n));
+}
@@ -0,0 +1,30 @@
+/*
+ * Copyright (C) 2017-2020 Philip Jones
+ *
+ * Licensed under the MIT License.
+ * See either the LICENSE file, or:
+ *
+ * https://opensource.org/licenses/MIT
+ *
+ */
+
+#ifndef GBCC_TIMER_H
+#define GBCC_TIMER_H
+
+struct gbcc_core;
+
+/*
+ * Everything driven by falling edges of the internal DIV counter: TIMA and
+ * the APU frame sequencer.
+ *
+ * Anything that disturbs the edge detectors (writes to DIV, TAC or NR52, or a
+ * CPU speed switch) must be wrapped in gbcc_timer_sync() and
+ * gbcc_timer_schedule().
+ */
+
+void gbcc_timer_tima_clock(struct gbcc_core *gbc);
+void gbcc_timer_sequencer_clock(struct gbcc_core *gbc);
+void gbcc_timer_sync(struct gbcc_core *gbc);
+void gbcc_timer_schedule(struct gbcc_core *gbc);
+
+#endif /* GBCC_TIMER_H */
@@ -9,11 +9,10 @@
  */
 
 #include "gbcc.h"
-#include "bit_utils.h"
 #include "constants.h"
 #include "debug.h"
 #include "memory.h"
-#include "nelem.h"
+#include "tile_decode.h"
 #include "window.h"
 #include "vram_window.h"
 #ifdef __ANDROID__
@@ -130,7 +129,8 @@ void gbcc_vram_window_initialise(struct gbcc *gbc)
 	glGenTextures(1, &win->gl.texture);
 	glBindTexture(GL_TEXTURE_2D, win->gl.texture);
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, VRAM_WINDOW_WIDTH, VRAM_WINDOW_HEIGHT, 0, GL_RGBA,
-			GL_UNSIGNED_BYTE, NULL);
+			GBCC_PIXEL_TYPE, NULL);
+	gbcc_window_set_pixel_swizzle();
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
@@ -166,13 +166,13 @@ void gbcc_vram_window_update(struct gbcc *gbc)
 	for (int bank = 0; bank < 2; bank++) {
 		for (int j = 0; j < VRAM_WINDOW_HEIGHT_TILES / 2; j++) {
 			for (int i = 0; i < VRAM_WINDOW_WIDTH_TILES; i++) {
+				uint16_t tile = (uint16_t)(j * VRAM_WINDOW_WIDTH_TILES + i);
+				uint8_t pixels[8][8];
+				gbcc_tile_decode(&gbc->core.memory.vram_bank[bank][16 * tile], pixels);
 				for (int y = 0; y < 8; y++) {
-					uint8_t lo = gbc->core.memory.vram_bank[bank][16 * (j * VRAM_WINDOW_WIDTH_TILES + i) + 2*y];
-					uint8_t hi = gbc->core.memory.vram_bank[bank][16 * (j * VRAM_WINDOW_WIDTH_TILES + i) + 2*y + 1];
 					for (uint8_t x = 0; x < 8; x++) {
-						uint8_t colour = (uint8_t)(check_bit(hi, 7 - x) << 1u) | check_bit(lo, 7 - x);
 						uint32_t p = 0;
-						switch (colour) {
+						switch (pixels[y][x]) {
 							case 3:
 								p = 0x000000ffu;
 								break;
@@ -199,14 +199,6 @@ void gbcc_vram_window_update(struct gbcc *gbc)
 	glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &read_framebuffer);
 	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &draw_framebuffer);
 
-	for (size_t i = 0; i < N_ELEM(win->buffer); i++) {
-		uint32_t tmp = win->buffer[i];
-		win->buffer[i] = (tmp & 0xFFu) << 24u
-				| (tmp & 0xFF00u) << 8u
-				| (tmp & 0xFF0000u) >> 8u
-				| (tmp & 0xFF000000u) >> 24u;
-	}
-
 
 	/* First pass - render the gbc screen to the framebuffer */
 	glBindFramebuffer(GL_FRAMEBUFFER, win->gl.fbo);
@@ -215,7 +207,7 @@ void gbcc_vram_window_update(struct gbcc *gbc)
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 	glBindTexture(GL_TEXTURE_2D, win->gl.texture);
 	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, VRAM_WINDOW_WIDTH, VRAM_WINDOW_HEIGHT, GL_RGBA,
-			GL_UNSIGNED_BYTE, (GLvoid *)win->buffer);
+			GBCC_PIXEL_TYPE, (GLvoid *)win->buffer);
 	glUseProgram(win->gl.shader);
 	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
 
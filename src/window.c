@@ -40,17 +40,17 @@ static void render_text(struct gbcc_window *win, const char *text, uint8_t x, ui
 static void render_character(struct gbcc_window *win, unsigned char c, uint8_t x, uint8_t y);
 static void render_box(struct gbcc_window *win, unsigned int x, unsigned int y);
 static void update_timers(struct gbcc *gbc);
+static void resize_framebuffers(struct gbcc_window *win, unsigned int width, unsigned int height);
+static void upload_frame(struct gbcc_window *win, const void *frame, size_t size, GLenum type);
+#ifndef __ANDROID__
+static void decode_packed_frame(struct gbcc *gbc, const uint16_t *frame);
+#endif
 
 void gbcc_window_initialise(struct gbcc *gbc)
 {
 	struct gbcc_window *win = &gbc->window;
 	*win = (struct gbcc_window){0};
 
-	GLint read_framebuffer = 0;
-	GLint draw_framebuffer = 0;
-	glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &read_framebuffer);
-	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &draw_framebuffer);
-
 	clock_gettime(CLOCK_REALTIME, &win->fps.last_time);
 	gbcc_fontmap_load(&win->font);
 
@@ -84,6 +84,13 @@ void gbcc_window_initialise(struct gbcc *gbc)
 			SHADER_PATH "nothing.frag"
 			);
 
+#ifndef __ANDROID__
+	win->gl.packed.shader = gbcc_create_shader_program(
+			SHADER_PATH "vert.vert",
+			SHADER_PATH "packed.frag"
+			);
+#endif
+
 
 	/* Create a vertex buffer for a quad filling the screen */
 	float vertices[] = {
@@ -126,53 +133,67 @@ void gbcc_window_initialise(struct gbcc *gbc)
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-	/* Framebuffer for post-processing */
-	glGenTextures(1, &win->gl.fbo_texture);
-	glBindTexture(GL_TEXTURE_2D, win->gl.fbo_texture);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, GBC_SCREEN_WIDTH, GBC_SCREEN_HEIGHT, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glBindTexture(GL_TEXTURE_2D, 0);
-
-	/* Copy of framebuffer for frameblending */
-	glGenTextures(1, &win->gl.last_frame_texture);
-	glBindTexture(GL_TEXTURE_2D, win->gl.last_frame_texture);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, GBC_SCREEN_WIDTH, GBC_SCREEN_HEIGHT, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	/*
+	 * Framebuffers for post-processing. Each frame is drawn into the
+	 * opposite one to the last, so the last can be blended with it.
+	 */
+	glGenTextures(2, win->gl.fbo_texture);
+	for (int i = 0; i < 2; i++) {
+		glBindTexture(GL_TEXTURE_2D, win->gl.fbo_texture[i]);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	}
 	glBindTexture(GL_TEXTURE_2D, 0);
-	glActiveTexture(GL_TEXTURE0 + 2);
-	glBindTexture(GL_TEXTURE_2D, win->gl.last_frame_texture);
-	glActiveTexture(GL_TEXTURE0);
-
-	glGenFramebuffers(1, &win->gl.fbo);
-	glBindFramebuffer(GL_FRAMEBUFFER, win->gl.fbo);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, win->gl.fbo_texture, 0);
+	glGenFramebuffers(2, win->gl.fbo);
 
 	/* We don't care about the depth and stencil, so just use a
 	 * renderbuffer */
 	glGenRenderbuffers(1, &win->gl.rbo);
-	glBindRenderbuffer(GL_RENDERBUFFER, win->gl.rbo);
-	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, GBC_SCREEN_WIDTH, GBC_SCREEN_HEIGHT);
-	glBindRenderbuffer(GL_RENDERBUFFER, 0);
 
-	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, win->gl.rbo);
-
-	if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
-		gbcc_log_error("Framebuffer is not complete!\n");
-		exit(EXIT_FAILURE);
-	}
-	glBindFramebuffer(GL_READ_FRAMEBUFFER, read_framebuffer);
-	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, draw_framebuffer);
+	resize_framebuffers(win, GBC_SCREEN_WIDTH, GBC_SCREEN_HEIGHT);
 
 	/* This is the texture we're going to render the raw screen output to
 	 * before post-processing */
 	glGenTextures(1, &win->gl.texture);
 	glBindTexture(GL_TEXTURE_2D, win->gl.texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, GBC_SCREEN_WIDTH, GBC_SCREEN_HEIGHT, 0, GL_RGBA,
+			GBCC_PIXEL_TYPE, NULL);
+	gbcc_window_set_pixel_swizzle();
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	/*
+	 * Frames are streamed to that texture through a ring of pixel
+	 * buffers, so an upload never has to wait for the last one to finish.
+	 */
+	glGenBuffers(GBCC_NUM_PBOS, win->gl.pbo);
+	for (int i = 0; i < GBCC_NUM_PBOS; i++) {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, win->gl.pbo[i]);
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, GBC_SCREEN_SIZE * sizeof(uint32_t), NULL, GL_STREAM_DRAW);
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+#ifndef __ANDROID__
+	/*
+	 * Packed frames are uploaded as they are, then converted to RGBA at
+	 * the native resolution, which is then treated as the raw screen
+	 * output above. GLES doesn't have the reversed 1-5-5-5 format they need,
+	 * so they're converted by the cpu there instead.
+	 */
+	glGenTextures(1, &win->gl.packed.texture);
+	glBindTexture(GL_TEXTURE_2D, win->gl.packed.texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB5_A1, GBC_SCREEN_WIDTH, GBC_SCREEN_HEIGHT, 0, GL_RGBA,
+			GL_UNSIGNED_SHORT_1_5_5_5_REV, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+	glGenTextures(1, &win->gl.packed.fbo_texture);
+	glBindTexture(GL_TEXTURE_2D, win->gl.packed.fbo_texture);
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, GBC_SCREEN_WIDTH, GBC_SCREEN_HEIGHT, 0, GL_RGBA,
 			GL_UNSIGNED_BYTE, NULL);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
@@ -181,6 +202,16 @@ void gbcc_window_initialise(struct gbcc *gbc)
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 	glBindTexture(GL_TEXTURE_2D, 0);
 
+	glGenFramebuffers(1, &win->gl.packed.fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, win->gl.packed.fbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, win->gl.packed.fbo_texture, 0);
+	if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		gbcc_log_error("Framebuffer is not complete!\n");
+		exit(EXIT_FAILURE);
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+#endif
+
 	/* This is the 3D texture we use as a lookup-table for colour correction */
 	glGenTextures(1, &win->gl.lut_texture);
 
@@ -189,10 +220,6 @@ void gbcc_window_initialise(struct gbcc *gbc)
 
 	glActiveTexture(GL_TEXTURE0 + 1);
 	glBindTexture(GL_TEXTURE_3D, win->gl.lut_texture);
-	glUseProgram(win->gl.shaders[0].program);
-
-	GLint loc = glGetUniformLocation(win->gl.shaders[0].program, "lut");
-	glUniform1i(loc, 1);
 	glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA, 8, 8, 8, 0, GL_RGBA,
 			GL_UNSIGNED_BYTE, (GLvoid *)lut_data);
 	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
@@ -204,6 +231,31 @@ void gbcc_window_initialise(struct gbcc *gbc)
 	glActiveTexture(GL_TEXTURE0);
 	free(lut_data);
 
+	/*
+	 * Samplers always use the same texture units, so only need setting
+	 * once, and the rest of the uniforms are looked up now rather than
+	 * every frame.
+	 */
+	for (size_t i = 0; i < N_ELEM(win->gl.shaders); i++) {
+		GLuint program = win->gl.shaders[i].program;
+		glUseProgram(program);
+		glUniform1i(glGetUniformLocation(program, "tex"), 0);
+		glUniform1i(glGetUniformLocation(program, "lut"), 1);
+	}
+	glUseProgram(win->gl.base_shader);
+	glUniform1i(glGetUniformLocation(win->gl.base_shader, "tex"), 0);
+	glUniform1i(glGetUniformLocation(win->gl.base_shader, "last_tex"), 2);
+	win->gl.base_uniforms.odd_frame = glGetUniformLocation(win->gl.base_shader, "odd_frame");
+	win->gl.base_uniforms.interlacing = glGetUniformLocation(win->gl.base_shader, "interlacing");
+	win->gl.base_uniforms.frameblending = glGetUniformLocation(win->gl.base_shader, "frameblending");
+#ifndef __ANDROID__
+	glUseProgram(win->gl.packed.shader);
+	glUniform1i(glGetUniformLocation(win->gl.packed.shader, "tex"), 0);
+	win->gl.packed.dmg = glGetUniformLocation(win->gl.packed.shader, "dmg");
+	win->gl.packed.palette = glGetUniformLocation(win->gl.packed.shader, "palette");
+#endif
+	glUseProgram(0);
+
 	/* Bind the actual bits we'll be using to render */
 	glBindVertexArray(win->gl.vao);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, win->gl.ebo);
@@ -228,11 +280,18 @@ void gbcc_window_deinitialise(struct gbcc *gbc)
 	glDeleteBuffers(1, &win->gl.vbo);
 	glDeleteVertexArrays(1, &win->gl.vao);
 	glDeleteBuffers(1, &win->gl.ebo);
-	glDeleteFramebuffers(1, &win->gl.fbo);
-	glDeleteTextures(1, &win->gl.fbo_texture);
+	glDeleteFramebuffers(2, win->gl.fbo);
+	glDeleteTextures(2, win->gl.fbo_texture);
 	glDeleteRenderbuffers(1, &win->gl.rbo);
 	glDeleteTextures(1, &win->gl.texture);
+	glDeleteBuffers(GBCC_NUM_PBOS, win->gl.pbo);
 	glDeleteTextures(1, &win->gl.lut_texture);
+#ifndef __ANDROID__
+	glDeleteTextures(1, &win->gl.packed.texture);
+	glDeleteFramebuffers(1, &win->gl.packed.fbo);
+	glDeleteTextures(1, &win->gl.packed.fbo_texture);
+	glDeleteProgram(win->gl.packed.shader);
+#endif
 	for (size_t i = 0; i < N_ELEM(win->gl.shaders); i++) {
 		glDeleteProgram(win->gl.shaders[i].program);
 	}
@@ -261,8 +320,30 @@ void gbcc_window_update(struct gbcc *gbc)
 	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &draw_framebuffer);
 
 	bool screenshot = win->screenshot || win->raw_screenshot;
-
-	memcpy(win->buffer, gbc->core.ppu.screen.sdl, GBC_SCREEN_SIZE * sizeof(win->buffer[0]));
+	bool overlay = gbc->menu.show
+		|| (gbc->show_fps && !screenshot)
+		|| (win->msg.time_left > 0 && !screenshot);
+
+	/*
+	 * The frame can be uploaded straight from the ppu's buffer, unless
+	 * there's text to draw on top or a screenshot to take. Packed frames
+	 * are then converted to RGBA here rather than by the shaders.
+	 */
+	const uint32_t *frame = gbcc_screen_acquire(gbc->core.ppu.screen);
+	bool packed = gbc->core.packed_frames;
+#ifdef __ANDROID__
+	bool unpack = packed;
+#else
+	bool unpack = packed && (overlay || screenshot);
+#endif
+	if (unpack) {
+		gbcc_ppu_unpack_frame(&gbc->core, (const uint16_t *)frame, win->buffer);
+		frame = win->buffer;
+		packed = false;
+	} else if (overlay || screenshot) {
+		memcpy(win->buffer, frame, GBC_SCREEN_SIZE * sizeof(win->buffer[0]));
+		frame = win->buffer;
+	}
 	{
 		int val = 0;
 		sem_getvalue(&gbc->core.ppu.vsync_semaphore, &val);
@@ -297,14 +378,6 @@ void gbcc_window_update(struct gbcc *gbc)
 		}
 	}
 
-	for (size_t i = 0; i < N_ELEM(win->buffer); i++) {
-		uint32_t tmp = win->buffer[i];
-		win->buffer[i] = (tmp & 0xFFu) << 24u
-				| (tmp & 0xFF00u) << 8u
-				| (tmp & 0xFF0000u) >> 8u
-				| (tmp & 0xFF000000u) >> 24u;
-	}
-
 	/* Setup - resize our screen textures if needed */
 	if (gbc->fractional_scaling) {
 		win->scale = min((float)win->width / GBC_SCREEN_WIDTH, (float)win->height / GBC_SCREEN_HEIGHT);
@@ -316,27 +389,34 @@ void gbcc_window_update(struct gbcc *gbc)
 	win->x = ((unsigned int)win->width - width) / 2;
 	win->y = ((unsigned int)win->height - height) / 2;
 
-	glBindTexture(GL_TEXTURE_2D, win->gl.fbo_texture);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
-	glBindTexture(GL_TEXTURE_2D, win->gl.last_frame_texture);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
-	glBindTexture(GL_TEXTURE_2D, 0);
+	if (width == 0 || height == 0) {
+		/* Nowhere to draw, e.g. the window is minimised */
+		return;
+	}
+	if (width != win->gl.fbo_width || height != win->gl.fbo_height) {
+		resize_framebuffers(win, width, height);
+	}
+	int cur = win->gl.fbo_index;
+	int last = cur ^ 1;
 
-	glBindRenderbuffer(GL_RENDERBUFFER, win->gl.rbo);
-	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
-	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+#ifndef __ANDROID__
+	if (packed) {
+		decode_packed_frame(gbc, (const uint16_t *)frame);
+	}
+#endif
 
 	/* First pass - render the gbc screen to the framebuffer */
-	glBindFramebuffer(GL_FRAMEBUFFER, win->gl.fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, win->gl.fbo[cur]);
 	glViewport(0, 0, width, height);
 	glClearColor(0.0, 0.0, 0.0, 1.0);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-	glBindTexture(GL_TEXTURE_2D, win->gl.texture);
-	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, GBC_SCREEN_WIDTH, GBC_SCREEN_HEIGHT, GL_RGBA,
-			GL_UNSIGNED_BYTE, (GLvoid *)win->buffer);
+	if (packed) {
+		glBindTexture(GL_TEXTURE_2D, win->gl.packed.fbo_texture);
+	} else {
+		glBindTexture(GL_TEXTURE_2D, win->gl.texture);
+		upload_frame(win, frame, GBC_SCREEN_SIZE * sizeof(*frame), GBCC_PIXEL_TYPE);
+	}
 	glUseProgram(win->gl.shaders[win->gl.cur_shader].program);
-	glUniform1i(glGetUniformLocation(win->gl.shaders[win->gl.cur_shader].program, "tex"), 0);
-	glUniform1i(glGetUniformLocation(win->gl.shaders[win->gl.cur_shader].program, "lut"), 1);
 	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
 
 	/* Second pass - render the framebuffer to the screen */
@@ -345,28 +425,122 @@ void gbcc_window_update(struct gbcc *gbc)
 	glViewport(win->x, win->y, width, height);
 	glClearColor(0.0, 0.0, 0.0, 1.0);
 	glClear(GL_COLOR_BUFFER_BIT);
-	glBindTexture(GL_TEXTURE_2D, win->gl.fbo_texture);
+	glBindTexture(GL_TEXTURE_2D, win->gl.fbo_texture[cur]);
+	glActiveTexture(GL_TEXTURE0 + 2);
+	glBindTexture(GL_TEXTURE_2D, win->gl.fbo_texture[last]);
+	glActiveTexture(GL_TEXTURE0);
 	glUseProgram(win->gl.base_shader);
-	glUniform1i(glGetUniformLocation(win->gl.base_shader, "tex"), 0);
-	glUniform1i(glGetUniformLocation(win->gl.base_shader, "last_tex"), 2);
-	glUniform1i(glGetUniformLocation(win->gl.base_shader, "odd_frame"), gbc->core.ppu.frame & 1);
-	glUniform1i(glGetUniformLocation(win->gl.base_shader, "interlacing"), gbc->interlacing);
-	glUniform1i(glGetUniformLocation(win->gl.base_shader, "frameblending"), gbc->frame_blending);
+	glUniform1i(win->gl.base_uniforms.odd_frame, gbc->core.ppu.frame & 1);
+	glUniform1i(win->gl.base_uniforms.interlacing, gbc->interlacing);
+	glUniform1i(win->gl.base_uniforms.frameblending, gbc->frame_blending);
 	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
 
-	/* Copy the intermediate frame texture for frameblending next time */
-	glBindFramebuffer(GL_READ_FRAMEBUFFER, win->gl.fbo);
-	glBindTexture(GL_TEXTURE_2D, win->gl.last_frame_texture);
-	glReadBuffer(GL_COLOR_ATTACHMENT0);
-	glCopyTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 0, 0, width, height, 0);
-	glBindTexture(GL_TEXTURE_2D, 0);
-	glBindFramebuffer(GL_READ_FRAMEBUFFER, read_framebuffer);
+	/* This frame gets blended with the next one */
+	win->gl.fbo_index = last;
 
 	if (screenshot) {
 		gbcc_screenshot(gbc);
 	}
 }
 
+/*
+ * (Re)allocate the post-processing framebuffers, which only happens when the
+ * size of the window changes.
+ */
+void resize_framebuffers(struct gbcc_window *win, unsigned int width, unsigned int height)
+{
+	GLint read_framebuffer = 0;
+	GLint draw_framebuffer = 0;
+	glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &read_framebuffer);
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &draw_framebuffer);
+
+	glBindRenderbuffer(GL_RENDERBUFFER, win->gl.rbo);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, (GLsizei)width, (GLsizei)height);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	for (int i = 0; i < 2; i++) {
+		glBindTexture(GL_TEXTURE_2D, win->gl.fbo_texture[i]);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, (GLsizei)width, (GLsizei)height, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+		glBindFramebuffer(GL_FRAMEBUFFER, win->gl.fbo[i]);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, win->gl.fbo_texture[i], 0);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, win->gl.rbo);
+		if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+			gbcc_log_error("Framebuffer is not complete!\n");
+			exit(EXIT_FAILURE);
+		}
+		/* There's no last frame to blend with yet */
+		glClearColor(0.0, 0.0, 0.0, 1.0);
+		glClear(GL_COLOR_BUFFER_BIT);
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, read_framebuffer);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, draw_framebuffer);
+
+	win->gl.fbo_width = width;
+	win->gl.fbo_height = height;
+}
+
+/* Upload a frame of size bytes to the currently bound texture */
+void upload_frame(struct gbcc_window *win, const void *frame, size_t size, GLenum type)
+{
+	win->gl.pbo_index = (win->gl.pbo_index + 1) % GBCC_NUM_PBOS;
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, win->gl.pbo[win->gl.pbo_index]);
+	/* Invalidating lets the driver hand back fresh memory if it's busy */
+	void *pixels = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, (GLsizeiptr)size,
+			GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	if (pixels) {
+		memcpy(pixels, frame, size);
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		/* Now an offset into the pixel buffer */
+		frame = NULL;
+	} else {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	}
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, GBC_SCREEN_WIDTH, GBC_SCREEN_HEIGHT, GL_RGBA,
+			type, (const GLvoid *)frame);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+#ifndef __ANDROID__
+/* Convert a packed frame to RGBA in the packed framebuffer */
+void decode_packed_frame(struct gbcc *gbc, const uint16_t *frame)
+{
+	struct gbcc_window *win = &gbc->window;
+	bool dmg = gbc->core.mode == DMG;
+
+	glBindFramebuffer(GL_FRAMEBUFFER, win->gl.packed.fbo);
+	glViewport(0, 0, GBC_SCREEN_WIDTH, GBC_SCREEN_HEIGHT);
+	glBindTexture(GL_TEXTURE_2D, win->gl.packed.texture);
+	upload_frame(win, frame, GBC_SCREEN_SIZE * sizeof(*frame), GL_UNSIGNED_SHORT_1_5_5_5_REV);
+	glUseProgram(win->gl.packed.shader);
+	glUniform1i(win->gl.packed.dmg, dmg);
+	if (dmg) {
+		uint32_t shades[12];
+		GLfloat palette[12][3];
+		gbcc_ppu_packed_shades(&gbc->core, shades);
+		for (size_t i = 0; i < N_ELEM(shades); i++) {
+			palette[i][0] = (GLfloat)((shades[i] >> 24u) & 0xFFu) / 255.0f;
+			palette[i][1] = (GLfloat)((shades[i] >> 16u) & 0xFFu) / 255.0f;
+			palette[i][2] = (GLfloat)((shades[i] >> 8u) & 0xFFu) / 255.0f;
+		}
+		glUniform3fv(win->gl.packed.palette, (GLsizei)N_ELEM(palette), &palette[0][0]);
+	}
+	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+}
+#endif
+
+/* Called with the texture that pixels are uploaded to bound */
+void gbcc_window_set_pixel_swizzle(void)
+{
+#ifdef __ANDROID__
+	/* On little-endian machines, the bytes are in the order A, B, G, R */
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_R, GL_ALPHA);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_G, GL_BLUE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_B, GL_GREEN);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_A, GL_RED);
+#endif
+}
+
 void gbcc_load_shader(GLuint shader, const char *filename)
 {
 	errno = 0;
@@ -22,6 +22,18 @@
 #include <time.h>
 
 #define MSG_BUF_SIZE 128
+#define GBCC_NUM_PBOS 3
+
+/*
+ * Pixels are stored as 0xRRGGBBAA in native byte order. Desktop GL can
+ * unpack that as it is, but GLES only takes separate bytes, so textures are
+ * swizzled back into order by gbcc_window_set_pixel_swizzle() instead.
+ */
+#ifdef __ANDROID__
+#define GBCC_PIXEL_TYPE GL_UNSIGNED_BYTE
+#else
+#define GBCC_PIXEL_TYPE GL_UNSIGNED_INT_8_8_8_8
+#endif
 
 struct gbcc;
 
@@ -52,13 +64,31 @@ struct gbcc_window {
 		GLuint vbo;
 		GLuint vao;
 		GLuint ebo;
-		GLuint fbo;
-		GLuint fbo_texture;
-		GLuint last_frame_texture;
+		GLuint fbo[2];
+		GLuint fbo_texture[2];
+		int fbo_index;		/* Framebuffer the next frame is drawn to */
+		unsigned int fbo_width;
+		unsigned int fbo_height;
 		GLuint rbo;
 		GLuint texture;
+		GLuint pbo[GBCC_NUM_PBOS];
+		int pbo_index;
 		GLuint lut_texture;
+		/* Conversion of packed frames, see gbcc_core.packed_frames */
+		struct {
+			GLuint texture;
+			GLuint fbo;
+			GLuint fbo_texture;
+			GLuint shader;
+			GLint dmg;
+			GLint palette;
+		} packed;
 		GLuint base_shader;
+		struct {
+			GLint odd_frame;
+			GLint interlacing;
+			GLint frameblending;
+		} base_uniforms;
 		int cur_shader;
 		struct shader shaders[4];
 	} gl;
@@ -81,5 +111,6 @@ void gbcc_window_show_message(struct gbcc *gbc, const char *msg, unsigned second
 void gbcc_window_use_shader(struct gbcc *gbc, const char *name);
 void gbcc_load_shader(GLuint shader, const char *filename);
 GLuint gbcc_create_shader_program(const char *vert, const char *frag);
+void gbcc_window_set_pixel_swizzle(void);
 
 #endif /* GBCC_WINDOW_H */